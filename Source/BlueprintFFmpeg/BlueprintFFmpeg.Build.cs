@@ -40,6 +40,7 @@ public class BlueprintFFmpeg : ModuleRules
             {
                 "CoreUObject",
                 "Engine",
+                "Projects",
                 "Slate",
                 "SlateCore",
 				// ... add private dependencies that you statically link with here ...	
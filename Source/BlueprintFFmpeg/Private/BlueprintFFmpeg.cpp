@@ -2,17 +2,61 @@
 
 #include "BlueprintFFmpeg.h"
 
+#include "FFmpegEncodeGovernor.h"
+#include "FFmpegEncodeScheduler.h"
+#include "FFmpegEncoderPool.h"
+#include "FFmpegImagePool.h"
+#include "FFmpegReadbackPoller.h"
+#include "FFmpegSwsContextCache.h"
+#include "Interfaces/IPluginManager.h"
+#include "ShaderCore.h"
+
 #define LOCTEXT_NAMESPACE "FBlueprintFFmpegModule"
 
 void FBlueprintFFmpegModule::StartupModule()
 {
 	// This code will execute after your module is loaded into memory; the exact timing is specified in the .uplugin file per-module
+
+	// make shaders of this plugin visible to the shader compiler
+	const auto& ShaderDirectory = FPaths::Combine(
+	    IPluginManager::Get().FindPlugin(TEXT("BlueprintFFmpeg"))->GetBaseDir(),
+	    TEXT("Shaders"));
+	AddShaderSourceDirectoryMapping(TEXT("/Plugin/BlueprintFFmpeg"),
+	                                ShaderDirectory);
+
+	// complete GPU readbacks every tick
+	FFFmpegReadbackPoller::Get().Start();
+
+	// throttle encode work while the game is over its frame time budget
+	FFFmpegEncodeGovernor::Get().Start();
+
+	// free pooled codec contexts that have been idle for too long
+	FFFmpegEncoderPool::Get().Start();
 }
 
 void FBlueprintFFmpegModule::ShutdownModule()
 {
 	// This function may be called during shutdown to clean up your module.  For modules that support dynamic reloading,
 	// we call this function before unloading the module.
+
+	// stop throttling before the scheduler stops
+	FFFmpegEncodeGovernor::Get().Stop();
+
+	// complete GPU readbacks still in flight
+	FFFmpegReadbackPoller::Get().Stop();
+
+	// stop the workers of the shared scheduler
+	FFFmpegEncodeScheduler::Get().Shutdown();
+
+	// free cached SwsContexts while the FFmpeg libraries are still loaded
+	FFFmpegSwsContextCache::Get().Empty();
+
+	// free pooled images
+	FFFmpegImagePool::Get().Empty();
+
+	// free pooled codec contexts while the FFmpeg libraries are still loaded
+	FFFmpegEncoderPool::Get().Stop();
+	FFFmpegEncoderPool::Get().Empty();
 }
 
 #undef LOCTEXT_NAMESPACE
@@ -0,0 +1,278 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "FFmpegBufferedOutput.h"
+
+#include "HAL/PlatformFileManager.h"
+#include "LogFFmpegEncoder.h"
+#include "Misc/ScopeExit.h"
+
+#if FFMPEG_BUFFERED_OUTPUT_POSIX
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+extern "C" {
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+}
+
+FFFmpegBufferedOutput::~FFFmpegBufferedOutput() {
+	// Close does nothing for what has already been closed
+	Close();
+}
+
+bool FFFmpegBufferedOutput::Open(const FString&                      Path,
+                                 const FFFmpegBufferedOutputOptions& Options) {
+	// Open function must be called only once.
+	check(nullptr == IOContext);
+
+	// buffers are a multiple of the alignment
+	BufferSize = Align(
+	    FMath::Max<int64>(Options.BufferSize, IOContextBufferSize), Alignment);
+	bDirectIO = Options.bDirectIO;
+
+#if FFMPEG_BUFFERED_OUTPUT_POSIX
+	auto PathInUTF8 = StringCast<UTF8CHAR>(*Path);
+	const auto& PathInChar = reinterpret_cast<const char*>(PathInUTF8.Get());
+
+	// create file
+	const auto& Flags = O_WRONLY | O_CREAT | O_TRUNC;
+#if PLATFORM_LINUX
+	if (bDirectIO) {
+		FileDescriptor = open(PathInChar, Flags | O_DIRECT, 0644);
+
+		// some file systems do not support O_DIRECT
+		if (FileDescriptor < 0 && EINVAL == errno) {
+			UE_LOG(LogFFmpegEncoder, Warning,
+			       TEXT("O_DIRECT is not supported for %s. Writing through the ")
+			           TEXT("page cache."),
+			       *Path);
+			bDirectIO = false;
+		}
+	}
+	if (FileDescriptor < 0) {
+		FileDescriptor = open(PathInChar, Flags, 0644);
+	}
+#else
+	FileDescriptor = open(PathInChar, Flags, 0644);
+
+	// the closest to O_DIRECT on Mac
+	if (0 <= FileDescriptor && bDirectIO) {
+		fcntl(FileDescriptor, F_NOCACHE, 1);
+	}
+#endif
+	if (FileDescriptor < 0) {
+		return false;
+	}
+
+	// reserve space on disk so that the file is not fragmented
+#if PLATFORM_LINUX
+	if (0 < Options.PreallocateSize) {
+		if (const auto& Error =
+		        posix_fallocate(FileDescriptor, 0, Options.PreallocateSize);
+		    0 != Error) {
+			UE_LOG(LogFFmpegEncoder, Warning,
+			       TEXT("Failed to preallocate %lld bytes for %s (%d)."),
+			       Options.PreallocateSize, *Path, Error);
+		}
+	}
+#endif
+#else
+	// create file
+	FileHandle.Reset(
+	    FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*Path));
+	if (!FileHandle.IsValid()) {
+		return false;
+	}
+#endif
+
+	// allocate aligned write buffers
+	for (auto& Buffer : Buffers) {
+		Buffer.Data = static_cast<uint8*>(FMemory::Malloc(BufferSize, Alignment));
+	}
+
+	// allocate AVIOContext writing to this
+	const auto& IOContextBuffer =
+	    static_cast<unsigned char*>(av_malloc(IOContextBufferSize));
+	IOContext = avio_alloc_context(IOContextBuffer, IOContextBufferSize, 1, this,
+	                               nullptr, &WritePacket, &Seek);
+	if (nullptr == IOContext) {
+		av_free(IOContextBuffer);
+		return false;
+	}
+
+	return true;
+}
+
+AVIOContext* FFFmpegBufferedOutput::GetIOContext() const noexcept {
+	return IOContext;
+}
+
+bool FFFmpegBufferedOutput::Close() {
+	// write data left in AVIOContext and in buffers
+	if (nullptr != IOContext) {
+		avio_flush(IOContext);
+		av_freep(&IOContext->buffer);
+		avio_context_free(&IOContext);
+	}
+	FlushBuffer();
+	WaitForFlush();
+
+	// free buffers
+	for (auto& Buffer : Buffers) {
+		FMemory::Free(Buffer.Data);
+		Buffer = {};
+	}
+
+#if FFMPEG_BUFFERED_OUTPUT_POSIX
+	if (0 <= FileDescriptor) {
+		// cut off the preallocated space and the padding of aligned writes
+		if (ftruncate(FileDescriptor, FileSize) != 0) {
+			bFailed = true;
+		}
+		if (close(FileDescriptor) != 0) {
+			bFailed = true;
+		}
+		FileDescriptor = -1;
+	}
+#else
+	FileHandle.Reset();
+#endif
+
+	return !bFailed;
+}
+
+int FFFmpegBufferedOutput::WritePacket(void* Opaque, const uint8_t* Data,
+                                       int Size) {
+	auto& This = *static_cast<FFFmpegBufferedOutput*>(Opaque);
+
+	// a background write has failed
+	if (This.bFailed) {
+		return AVERROR(EIO);
+	}
+
+	const auto& WrittenSize = Size;
+	while (0 < Size) {
+		auto& Buffer = This.Buffers[This.CurrentBuffer];
+
+		// data that does not follow the buffered data goes to a new buffer
+		if (0 < Buffer.Size && Buffer.Offset + Buffer.Size != This.Position) {
+			This.FlushBuffer();
+			continue;
+		}
+		if (0 == Buffer.Size) {
+			Buffer.Offset = This.Position;
+		}
+
+		// append to the buffer
+		const auto& CopySize = static_cast<int32>(
+		    FMath::Min<int64>(Size, This.BufferSize - Buffer.Size));
+		FMemory::Memcpy(Buffer.Data + Buffer.Size, Data, CopySize);
+		Buffer.Size   += CopySize;
+		This.Position += CopySize;
+		This.FileSize  = FMath::Max(This.FileSize, This.Position);
+		Data          += CopySize;
+		Size          -= CopySize;
+
+		// write a full buffer in background
+		if (This.BufferSize == Buffer.Size) {
+			This.FlushBuffer();
+		}
+	}
+
+	return WrittenSize;
+}
+
+int64_t FFFmpegBufferedOutput::Seek(void* Opaque, const int64_t Offset,
+                                    const int Whence) {
+	auto& This = *static_cast<FFFmpegBufferedOutput*>(Opaque);
+
+	// the following writes are buffered from the new position
+	switch (Whence & ~AVSEEK_FORCE) {
+	case AVSEEK_SIZE:
+		return This.FileSize;
+	case SEEK_SET:
+		This.Position = Offset;
+		return This.Position;
+	case SEEK_CUR:
+		This.Position += Offset;
+		return This.Position;
+	case SEEK_END:
+		This.Position = This.FileSize + Offset;
+		return This.Position;
+	default:
+		return AVERROR(EINVAL);
+	}
+}
+
+void FFFmpegBufferedOutput::FlushBuffer() {
+	auto& Buffer = Buffers[CurrentBuffer];
+	if (0 == Buffer.Size) {
+		return;
+	}
+
+	// the other buffer must have been written before it is reused
+	WaitForFlush();
+
+	// write the buffer in background
+	FlushTask = UE::Tasks::Launch(
+	    UE_SOURCE_LOCATION,
+	    [this, Data = Buffer.Data, Size = Buffer.Size, Offset = Buffer.Offset]() {
+		    if (!WriteAt(Data, Size, Offset)) {
+			    bFailed = true;
+		    }
+	    },
+	    LowLevelTasks::ETaskPriority::BackgroundNormal);
+
+	// fill the other buffer
+	CurrentBuffer = 1 - CurrentBuffer;
+	Buffers[CurrentBuffer].Offset = Position;
+	Buffers[CurrentBuffer].Size   = 0;
+	Buffer.Size                   = 0;
+}
+
+void FFFmpegBufferedOutput::WaitForFlush() {
+	if (FlushTask.IsValid()) {
+		FlushTask.Wait();
+		FlushTask = UE::Tasks::FTask();
+	}
+}
+
+bool FFFmpegBufferedOutput::WriteAt(const uint8* Data, int64 Size,
+                                    int64 Offset) {
+#if FFMPEG_BUFFERED_OUTPUT_POSIX
+#if PLATFORM_LINUX
+	// O_DIRECT requires aligned offset and size. the tail of the file and
+	// rewrites of headers are written through the page cache.
+	const auto& bAligned = 0 == Offset % Alignment && 0 == Size % Alignment;
+	if (bDirectIO && !bAligned) {
+		fcntl(FileDescriptor, F_SETFL,
+		      fcntl(FileDescriptor, F_GETFL) & ~O_DIRECT);
+	}
+	ON_SCOPE_EXIT {
+		if (bDirectIO && !bAligned) {
+			fcntl(FileDescriptor, F_SETFL,
+			      fcntl(FileDescriptor, F_GETFL) | O_DIRECT);
+		}
+	};
+#endif
+
+	// write all bytes
+	while (0 < Size) {
+		const auto& Written = pwrite(FileDescriptor, Data, Size, Offset);
+		if (Written < 0) {
+			if (EINTR == errno) {
+				continue;
+			}
+			return false;
+		}
+		Data   += Written;
+		Size   -= Written;
+		Offset += Written;
+	}
+	return true;
+#else
+	return FileHandle->Seek(Offset) && FileHandle->Write(Data, Size);
+#endif
+}
@@ -0,0 +1,268 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "FFmpegCodecProfile.h"
+#include "FFmpegRateControl.h"
+#include "FFmpegUtils.h"
+#include "LogFFmpegEncoder.h"
+#include "Misc/ScopeExit.h"
+
+extern "C" {
+#include <libavutil/opt.h>
+#include <libavutil/pixdesc.h>
+}
+
+const AVCodec* FFFmpegCodecProfile::FindEncoder(
+    const FFFmpegEncoderConfig& Config) {
+	// helper function to take the first encoder found
+	const auto& FindFirst = [](std::initializer_list<const char*> Names,
+	                           AVCodecID                          ID) {
+		for (const auto& Name : Names) {
+			if (const auto& Codec = avcodec_find_encoder_by_name(Name)) {
+				return Codec;
+			}
+		}
+		return avcodec_find_encoder(ID);
+	};
+
+	switch (Config.Codec) {
+	case EFFmpegCodec::HEVC:
+		return FindFirst({"libx265"}, AV_CODEC_ID_HEVC);
+	case EFFmpegCodec::AV1:
+		return FindFirst({"libsvtav1", "libaom-av1"}, AV_CODEC_ID_AV1);
+	case EFFmpegCodec::VP9:
+		return FindFirst({"libvpx-vp9"}, AV_CODEC_ID_VP9);
+	case EFFmpegCodec::FFV1:
+		return avcodec_find_encoder(AV_CODEC_ID_FFV1);
+	case EFFmpegCodec::MJPEG:
+		return avcodec_find_encoder(AV_CODEC_ID_MJPEG);
+	default:
+		// RGB is encoded by libx264rgb without conversion.
+		return EFFmpegEncodePixelFormat::BGR0 == Config.EncodePixelFormat
+		           ? FindFirst({"libx264rgb"}, AV_CODEC_ID_H264)
+		           : FindFirst({"libx264"}, AV_CODEC_ID_H264);
+	}
+}
+
+AVPixelFormat FFFmpegCodecProfile::NegotiatePixelFormat(
+    const AVCodec& Codec, EFFmpegEncodePixelFormat EncodePixelFormat) {
+	const auto& Preferred = UFFmpegUtils::FFmpegFrameFormatOf(EncodePixelFormat);
+
+	// the codec does not tell which formats it supports
+	if (nullptr == Codec.pix_fmts) {
+		return Preferred;
+	}
+
+	// the codec supports the preferred format
+	for (auto Format = Codec.pix_fmts; AV_PIX_FMT_NONE != *Format; ++Format) {
+		if (Preferred == *Format) {
+			return Preferred;
+		}
+	}
+
+	// the closest format, e.g. GBRP for BGR0 or YUV420P12 for YUV420P10
+	const auto& BestFormat =
+	    avcodec_find_best_pix_fmt_of_list(Codec.pix_fmts, Preferred, 0, nullptr);
+	UE_LOG(LogFFmpegEncoder, Log,
+	       TEXT("%s does not support %s. Frames are converted to %s."),
+	       UTF8_TO_TCHAR(Codec.name),
+	       UTF8_TO_TCHAR(av_get_pix_fmt_name(Preferred)),
+	       UTF8_TO_TCHAR(av_get_pix_fmt_name(BestFormat)));
+	return BestFormat;
+}
+
+void FFFmpegCodecProfile::ApplyOptions(const FFFmpegEncoderConfig& Config,
+                                       const AVCodec&              Codec,
+                                       AVPixelFormat               PixelFormat,
+                                       AVCodecContext&             Context,
+                                       AVDictionary*&              Options) {
+	const auto& Name          = FAnsiStringView(Codec.name);
+	const auto& bLookahead    = 0 <= Config.LookaheadDepth;
+	const auto& bZeroLatency  = EFFmpegX264Tune::ZeroLatency == Config.Tune;
+	const auto& bHighBitDepth =
+	    8 < av_pix_fmt_desc_get(PixelFormat)->comp[0].depth;
+
+	// speed of the preset in [0, 1]. 0 is Placebo and 1 is Ultrafast.
+	const auto& Speed =
+	    1.0 - static_cast<double>(Config.Preset) /
+	              static_cast<double>(EFFmpegX264Preset::Placebo);
+
+	// x264 and x265 take the preset and tune by name
+	if (Name.StartsWith("libx264") || "libx265" == Name) {
+		av_dict_set(&Options, "preset",
+		            UFFmpegUtils::X264PresetNameOf(Config.Preset), 0);
+
+		// x265 has no film and stillimage tunes
+		const auto& TuneName = UFFmpegUtils::X264TuneNameOf(Config.Tune);
+		if (nullptr != TuneName &&
+		    ("libx265" != Name || (EFFmpegX264Tune::Film != Config.Tune &&
+		                           EFFmpegX264Tune::StillImage != Config.Tune))) {
+			av_dict_set(&Options, "tune", TuneName, 0);
+		}
+
+		if (bLookahead && "libx265" == Name) {
+			av_dict_set(&Options, "x265-params",
+			            TCHAR_TO_UTF8(*FString::Printf(TEXT("rc-lookahead=%d"),
+			                                           Config.LookaheadDepth)),
+			            0);
+		} else if (bLookahead) {
+			av_dict_set_int(&Options, "rc-lookahead", Config.LookaheadDepth, 0);
+		}
+
+		// 10-bit requires the High 10 or Main 10 profile
+		if (Config.Profile.IsEmpty() && bHighBitDepth) {
+			av_dict_set(&Options, "profile",
+			            "libx265" == Name ? "main10" : "high10", 0);
+		}
+	}
+
+	// SVT-AV1 takes the preset as a number from 0 (slowest) to 12
+	else if ("libsvtav1" == Name) {
+		av_dict_set_int(&Options, "preset", FMath::RoundToInt(Speed * 12.0), 0);
+		if (bLookahead) {
+			av_dict_set(&Options, "svtav1-params",
+			            TCHAR_TO_UTF8(*FString::Printf(TEXT("lookahead=%d"),
+			                                           Config.LookaheadDepth)),
+			            0);
+		}
+	}
+
+	// libaom and libvpx take cpu-used from 0 (slowest) to 8, and look ahead
+	// by lag-in-frames
+	else if ("libaom-av1" == Name || "libvpx-vp9" == Name) {
+		av_dict_set_int(&Options, "cpu-used", FMath::RoundToInt(Speed * 8.0), 0);
+		if (bZeroLatency) {
+			av_dict_set_int(&Options, "lag-in-frames", 0, 0);
+		} else if (bLookahead) {
+			av_dict_set_int(&Options, "lag-in-frames", Config.LookaheadDepth, 0);
+		}
+
+		// realtime mode for the fastest presets and zero latency
+		const auto& bRealtime =
+		    bZeroLatency || Config.Preset <= EFFmpegX264Preset::Superfast;
+		const auto& bBest = EFFmpegX264Preset::Placebo == Config.Preset;
+		if ("libaom-av1" == Name && bRealtime) {
+			av_dict_set(&Options, "usage", "realtime", 0);
+		} else if ("libvpx-vp9" == Name) {
+			av_dict_set(&Options, "deadline",
+			            bRealtime ? "realtime" : (bBest ? "best" : "good"), 0);
+			av_dict_set_int(&Options, "row-mt", 1, 0);
+		}
+	}
+
+	// FFV1 is threaded by slices, which requires version 3
+	else if ("ffv1" == Name) {
+		av_dict_set_int(&Options, "level", 3, 0);
+		av_dict_set_int(&Options, "slicecrc", 1, 0);
+	}
+
+	// frames are limited range, which MJPEG accepts only unofficially
+	else if ("mjpeg" == Name) {
+		Context.strict_std_compliance = FF_COMPLIANCE_UNOFFICIAL;
+	}
+
+	// set profile
+	if (!Config.Profile.IsEmpty() && HasOption(Codec, "profile")) {
+		av_dict_set(&Options, "profile", TCHAR_TO_UTF8(*Config.Profile), 0);
+	}
+}
+
+AVCodecContext* FFFmpegCodecProfile::OpenCodecContext(
+    const FFFmpegEncoderConfig& Config, const AVCodec& Codec,
+    const AVPixelFormat PixelFormat) {
+	// get Codec Context
+	auto CodecContext = avcodec_alloc_context3(&Codec);
+	if (nullptr == CodecContext) {
+		UE_LOG(LogFFmpegEncoder, Error, TEXT("Failed to allocate codec context."));
+		return nullptr;
+	}
+
+	// FrameRate as Rational
+	const auto FrameRateAsRational = av_d2q(Config.FrameRate, INT_MAX);
+
+	// set Codec Context settings
+	CodecContext->width     = Config.Width;
+	CodecContext->height    = Config.Height;
+	CodecContext->time_base = av_inv_q(FrameRateAsRational);
+	CodecContext->framerate = FrameRateAsRational;
+	CodecContext->pix_fmt   = PixelFormat;
+
+	// intra-only codecs such as MJPEG and FFV1 reject B-frames
+	const auto& Descriptor = avcodec_descriptor_get(Codec.id);
+	const auto& bIntraOnly = nullptr != Descriptor &&
+	                         0 != (Descriptor->props & AV_CODEC_PROP_INTRA_ONLY);
+
+	// -1 leaves the keyframe interval and B-frames to the codec, its preset
+	// and tune. zero latency allows no B-frames.
+	if (0 <= Config.GopSize) {
+		CodecContext->gop_size = Config.GopSize;
+	}
+	if (bIntraOnly || EFFmpegX264Tune::ZeroLatency == Config.Tune) {
+		CodecContext->max_b_frames = 0;
+	} else if (0 <= Config.MaxBFrames) {
+		CodecContext->max_b_frames = Config.MaxBFrames;
+	}
+
+	// set threading
+	CodecContext->thread_count = Config.Threads;
+	switch (Config.ThreadType) {
+	case EFFmpegThreadType::Frame:
+		CodecContext->thread_type = FF_THREAD_FRAME;
+		break;
+	case EFFmpegThreadType::Slice:
+		CodecContext->thread_type = FF_THREAD_SLICE;
+		break;
+	default:
+		break;
+	}
+
+	// set rate control mode and VBV
+	AVDictionary* EncodeOptions = nullptr;
+	ON_SCOPE_EXIT { av_dict_free(&EncodeOptions); };
+	FFFmpegRateControl::Configure(Config, Codec, *CodecContext, EncodeOptions);
+
+	// set preset, tune, lookahead and profile
+	ApplyOptions(Config, Codec, PixelFormat, *CodecContext, EncodeOptions);
+
+	// options specified as is override the settings above
+	for (const auto& [Key, Value] : Config.CodecOptions) {
+		av_dict_set(&EncodeOptions, TCHAR_TO_UTF8(*Key), TCHAR_TO_UTF8(*Value),
+		            0);
+	}
+
+	if (avcodec_open2(CodecContext, &Codec, &EncodeOptions) != 0) {
+		UE_LOG(LogFFmpegEncoder, Error, TEXT("Failed to open %s."),
+		       UTF8_TO_TCHAR(Codec.name));
+		avcodec_free_context(&CodecContext);
+		return nullptr;
+	}
+
+	// options left in EncodeOptions are not recognized by the codec
+	const AVDictionaryEntry* UnusedOption = nullptr;
+	while ((UnusedOption = av_dict_iterate(EncodeOptions, UnusedOption))) {
+		UE_LOG(LogFFmpegEncoder, Warning, TEXT("Unknown codec option: %s"),
+		       UTF8_TO_TCHAR(UnusedOption->key));
+	}
+
+	return CodecContext;
+}
+
+bool FFFmpegCodecProfile::HasSameCodecSettings(const FFFmpegEncoderConfig& A,
+                                               const FFFmpegEncoderConfig& B) {
+	return A.Codec == B.Codec && A.Width == B.Width && A.Height == B.Height &&
+	       A.FrameRate == B.FrameRate &&
+	       A.EncodePixelFormat == B.EncodePixelFormat &&
+	       A.BitRate == B.BitRate && A.RateControl == B.RateControl &&
+	       A.CRF == B.CRF && A.QP == B.QP && A.MaxBitRate == B.MaxBitRate &&
+	       A.VBVBufferSize == B.VBVBufferSize && A.Preset == B.Preset &&
+	       A.Tune == B.Tune && A.Profile == B.Profile &&
+	       A.Threads == B.Threads && A.ThreadType == B.ThreadType &&
+	       A.LookaheadDepth == B.LookaheadDepth && A.GopSize == B.GopSize &&
+	       A.MaxBFrames == B.MaxBFrames &&
+	       A.CodecOptions.OrderIndependentCompareEqual(B.CodecOptions);
+}
+
+bool FFFmpegCodecProfile::HasOption(const AVCodec& Codec, const char* Name) {
+	return nullptr != Codec.priv_class &&
+	       nullptr != av_opt_find(&Codec.priv_class, Name, nullptr, 0,
+	                              AV_OPT_SEARCH_FAKE_OBJ);
+}
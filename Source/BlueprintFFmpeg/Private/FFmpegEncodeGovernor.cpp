@@ -0,0 +1,178 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "FFmpegEncodeGovernor.h"
+#include "FFmpegEncodeScheduler.h"
+#include "FFmpegEncoderPool.h"
+#include "FFmpegUtils.h"
+#include "LogFFmpegEncoder.h"
+
+#include "HAL/IConsoleManager.h"
+#include "Misc/App.h"
+#include "RenderCore.h"
+
+namespace {
+TAutoConsoleVariable<bool> CVarGovernorEnable(
+    TEXT("ffmpeg.Governor.Enable"), true,
+    TEXT("If true, encode work is throttled while the game misses ")
+        TEXT("ffmpeg.Governor.TargetFrameTime."));
+
+TAutoConsoleVariable<float> CVarGovernorTargetFrameTime(
+    TEXT("ffmpeg.Governor.TargetFrameTime"), 16.667f,
+    TEXT("Frame time in milliseconds the game must keep while recording."));
+
+TAutoConsoleVariable<float> CVarGovernorHeadroom(
+    TEXT("ffmpeg.Governor.Headroom"), 0.2f,
+    TEXT("Fraction of the target the game and render threads must leave ")
+        TEXT("idle before the throttling is lifted a level."));
+
+TAutoConsoleVariable<int32> CVarGovernorFramesToThrottle(
+    TEXT("ffmpeg.Governor.FramesToThrottle"), 10,
+    TEXT("Number of consecutive frames over the target before the ")
+        TEXT("throttling is raised a level."));
+
+TAutoConsoleVariable<int32> CVarGovernorFramesToRestore(
+    TEXT("ffmpeg.Governor.FramesToRestore"), 120,
+    TEXT("Number of consecutive frames with headroom before the throttling ")
+        TEXT("is lifted a level."));
+} // namespace
+
+FFFmpegEncodeGovernor& FFFmpegEncodeGovernor::Get() {
+	static FFFmpegEncodeGovernor Instance;
+	return Instance;
+}
+
+void FFFmpegEncodeGovernor::Start() {
+	if (TickerHandle.IsValid()) {
+		return;
+	}
+
+	TickerHandle = FTSTicker::GetCoreTicker().AddTicker(
+	    FTickerDelegate::CreateRaw(this, &FFFmpegEncodeGovernor::Tick));
+}
+
+void FFFmpegEncodeGovernor::Stop() {
+	if (TickerHandle.IsValid()) {
+		FTSTicker::GetCoreTicker().RemoveTicker(TickerHandle);
+		TickerHandle.Reset();
+	}
+
+	// prewarming held back by the throttling is not needed on shutdown
+	FFFmpegEncoderPool::Get().ClearDeferredPrewarms();
+
+	// lift the throttling
+	if (0 != Level) {
+		SetLevel(0);
+	}
+}
+
+LowLevelTasks::ETaskPriority FFFmpegEncodeGovernor::GetTaskPriority(
+    const EFFmpegEncoderPriority Priority) const noexcept {
+	if (0 == Level) {
+		return UFFmpegUtils::TaskPriorityOf(Priority);
+	}
+
+	// one priority lower
+	return UFFmpegUtils::TaskPriorityOf(EFFmpegEncoderPriority::High == Priority
+	                                        ? EFFmpegEncoderPriority::Normal
+	                                        : EFFmpegEncoderPriority::Low);
+}
+
+EThreadPriority FFFmpegEncodeGovernor::GetThreadPriority(
+    const EFFmpegEncoderPriority Priority) const noexcept {
+	if (Level < 2) {
+		return UFFmpegUtils::ThreadPriorityOf(Priority);
+	}
+
+	// one priority lower, or the lowest at level 3
+	if (Level < 3) {
+		return UFFmpegUtils::ThreadPriorityOf(
+		    EFFmpegEncoderPriority::High == Priority
+		        ? EFFmpegEncoderPriority::Normal
+		        : EFFmpegEncoderPriority::Low);
+	}
+	return TPri_Lowest;
+}
+
+FFFmpegEncodeGovernorStats FFFmpegEncodeGovernor::GetStats() const {
+	FFFmpegEncodeGovernorStats Stats;
+	Stats.Level            = Level;
+	Stats.FrameTime        = FrameTime;
+	Stats.GameThreadTime   = GameThreadTime;
+	Stats.RenderThreadTime = RenderThreadTime;
+	Stats.NumThrottles     = NumThrottles;
+	return Stats;
+}
+
+bool FFFmpegEncodeGovernor::Tick(float DeltaTime) {
+	// nothing to throttle while no encoder is recording
+	if (!CVarGovernorEnable.GetValueOnGameThread() ||
+	    0 == FFFmpegEncodeScheduler::Get().GetNumActiveSessions()) {
+		NumFramesOverBudget   = 0;
+		NumFramesWithHeadroom = 0;
+		if (0 != Level) {
+			SetLevel(0);
+		}
+		return true;
+	}
+
+	// smooth the times of the last frame
+	const auto& Smooth = [](std::atomic<double>& Smoothed, const double Value) {
+		Smoothed = Smoothed + (Value - Smoothed) * Smoothing;
+	};
+	Smooth(FrameTime, FApp::GetDeltaTime());
+	Smooth(GameThreadTime, FPlatformTime::ToSeconds(GGameThreadTime));
+	Smooth(RenderThreadTime, FPlatformTime::ToSeconds(GRenderThreadTime));
+
+	// the frame time may sit at the target while vsync or a frame rate limit
+	// hides idle time, so headroom is judged by the busy times
+	const auto& Target   = GetTargetFrameTime();
+	const auto& Headroom = CVarGovernorHeadroom.GetValueOnGameThread();
+	const auto& BusyTime =
+	    FMath::Max(GameThreadTime.load(), RenderThreadTime.load());
+	const auto& bOverBudget = Target * 1.05 < FrameTime;
+	const auto& bHeadroom =
+	    !bOverBudget && BusyTime < Target * (1.0 - Headroom);
+
+	NumFramesOverBudget   = bOverBudget ? NumFramesOverBudget + 1 : 0;
+	NumFramesWithHeadroom = bHeadroom ? NumFramesWithHeadroom + 1 : 0;
+
+	// throttle a level more
+	const auto& FramesToThrottle =
+	    CVarGovernorFramesToThrottle.GetValueOnGameThread();
+	if (Level < MaxLevel && FramesToThrottle <= NumFramesOverBudget) {
+		NumFramesOverBudget = 0;
+		++NumThrottles;
+		SetLevel(Level + 1);
+	}
+
+	// or lift a level
+	const auto& FramesToRestore =
+	    CVarGovernorFramesToRestore.GetValueOnGameThread();
+	if (0 < Level && FramesToRestore <= NumFramesWithHeadroom) {
+		NumFramesWithHeadroom = 0;
+		SetLevel(Level - 1);
+	}
+
+	return true;
+}
+
+double FFFmpegEncodeGovernor::GetTargetFrameTime() {
+	return CVarGovernorTargetFrameTime.GetValueOnGameThread() / 1000.0;
+}
+
+void FFFmpegEncodeGovernor::SetLevel(const int32 NewLevel) {
+	UE_LOG(LogFFmpegEncoder, Log,
+	       TEXT("Governor: level %d -> %d. frame %.1f ms, game thread %.1f ms, ")
+	           TEXT("render thread %.1f ms, target %.1f ms."),
+	       Level.load(), NewLevel, FrameTime * 1000.0, GameThreadTime * 1000.0,
+	       RenderThreadTime * 1000.0, GetTargetFrameTime() * 1000.0);
+
+	Level = NewLevel;
+
+	// level 2 halves the workers of the shared scheduler, level 3 leaves one
+	FFFmpegEncodeScheduler::Get().SetThrottle(
+	    NewLevel < 2 ? 1.0 : NewLevel < 3 ? 0.5 : 0.0);
+
+	// level 3 defers prewarming encoders
+	FFFmpegEncoderPool::Get().SetDeferPrewarm(3 <= NewLevel);
+}
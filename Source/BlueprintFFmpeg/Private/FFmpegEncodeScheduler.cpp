@@ -0,0 +1,286 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "FFmpegEncodeScheduler.h"
+
+#include "HAL/IConsoleManager.h"
+#include "HAL/RunnableThread.h"
+
+namespace {
+TAutoConsoleVariable<int32> CVarEncodeSchedulerNumWorkers(
+    TEXT("ffmpeg.EncodeScheduler.NumWorkers"), 0,
+    TEXT("Number of threads encoding the sessions of encoders that use the ")
+        TEXT("shared scheduler. 0 runs a thread per physical core."));
+} // namespace
+
+FFFmpegEncodeScheduler& FFFmpegEncodeScheduler::Get() {
+	static FFFmpegEncodeScheduler Instance;
+	return Instance;
+}
+
+void FFFmpegEncodeScheduler::Schedule(FFFmpegScheduledSession& Session) {
+	bool bRunInline = false;
+	{
+		std::lock_guard lk(Queue_mutex);
+
+		switch (Session.ScheduleState) {
+		case Idle:
+			// no worker is left after shutdown, so the caller runs the session
+			if (bShuttingDown) {
+				Session.ScheduleState = Running;
+				bRunInline            = true;
+				break;
+			}
+
+			// a session idle for a while does not catch up on the time it
+			// has not used
+			Session.VirtualTime   = FMath::Max(Session.VirtualTime, VirtualClock);
+			Session.ScheduleState = Queued;
+			Queue.Add(&Session);
+			MaxQueuedSessions = FMath::Max(MaxQueuedSessions, Queue.Num());
+			break;
+		case Running:
+			// the work may have come after the slice checked for it
+			Session.ScheduleState = RunningRequeued;
+			return;
+		default:
+			return;
+		}
+
+		// workers are created on first use
+		if (!bRunInline && Threads.IsEmpty()) {
+			StartWorkers();
+		}
+	}
+
+	// run the session on this thread after shutdown
+	if (bRunInline) {
+		RunInline(Session);
+		return;
+	}
+
+	// wake a worker
+	Queue_cv.notify_one();
+}
+
+void FFFmpegEncodeScheduler::SetPriority(FFFmpegScheduledSession& Session,
+                                         const EFFmpegEncoderPriority Priority,
+                                         const float CPUShare) {
+	std::lock_guard lk(Queue_mutex);
+	Session.Priority = Priority;
+	Session.CPUShare = FMath::Max(0.01, static_cast<double>(CPUShare));
+}
+
+void FFFmpegEncodeScheduler::SetThrottle(const double RunningWorkerFraction) {
+	{
+		std::lock_guard lk(Queue_mutex);
+		MaxRunningWorkerFraction = FMath::Clamp(RunningWorkerFraction, 0.0, 1.0);
+	}
+
+	// workers may run more slices now
+	Queue_cv.notify_all();
+}
+
+int32 FFFmpegEncodeScheduler::GetNumActiveSessions() const noexcept {
+	int32 NumSessions = 0;
+	for (const auto& NumActive : NumActiveSessions) {
+		NumSessions += NumActive;
+	}
+	return NumSessions;
+}
+
+void FFFmpegEncodeScheduler::AddActiveSession(
+    const EFFmpegEncoderPriority Priority) noexcept {
+	++NumActiveSessions[static_cast<int32>(Priority)];
+}
+
+void FFFmpegEncodeScheduler::RemoveActiveSession(
+    const EFFmpegEncoderPriority Priority) noexcept {
+	--NumActiveSessions[static_cast<int32>(Priority)];
+}
+
+bool FFFmpegEncodeScheduler::HasActiveSessionAbove(
+    const EFFmpegEncoderPriority Priority) const noexcept {
+	for (int32 Higher = static_cast<int32>(Priority) + 1; Higher < NumPriorities;
+	     ++Higher) {
+		if (0 < NumActiveSessions[Higher]) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void FFFmpegEncodeScheduler::WaitForIdle(FFFmpegScheduledSession& Session) {
+	std::unique_lock lk(Queue_mutex);
+	Idle_cv.wait(lk, [&]() { return Idle == Session.ScheduleState; });
+}
+
+FFFmpegEncodeSchedulerStats FFFmpegEncodeScheduler::GetStats() const {
+	FFFmpegEncodeSchedulerStats Stats;
+	Stats.NumSlices = NumSlices.load();
+
+	std::lock_guard lk(Queue_mutex);
+	Stats.NumWorkers        = Threads.Num();
+	Stats.NumQueuedSessions = Queue.Num();
+	Stats.MaxQueuedSessions = MaxQueuedSessions;
+	Stats.NumRunningWorkers = NumRunningWorkers;
+
+	return Stats;
+}
+
+void FFFmpegEncodeScheduler::Shutdown() {
+	// let workers exit once the queue is empty
+	TArray<FRunnableThread*> ThreadsToJoin;
+	{
+		std::lock_guard lk(Queue_mutex);
+		bShuttingDown = true;
+		ThreadsToJoin = MoveTemp(Threads);
+		Threads.Reset();
+	}
+	Queue_cv.notify_all();
+
+	// wait for workers out of the lock
+	for (auto& Thread : ThreadsToJoin) {
+		Thread->WaitForCompletion();
+		delete Thread;
+	}
+
+	std::lock_guard lk(Queue_mutex);
+	Workers.Reset();
+}
+
+void FFFmpegEncodeScheduler::StartWorkers() {
+	const auto& NumWorkers = CVarEncodeSchedulerNumWorkers.GetValueOnAnyThread();
+	const auto& Count      = 0 < NumWorkers
+	                             ? NumWorkers
+	                             : FMath::Max(1, FPlatformMisc::NumberOfCores());
+
+	for (int32 i = 0; i < Count; ++i) {
+		auto Worker = MakeUnique<FWorker>(*this);
+		auto Thread = FRunnableThread::Create(
+		    Worker.Get(), *FString::Printf(TEXT("FFmpeg encode worker %d"), i));
+		if (nullptr == Thread) {
+			continue;
+		}
+		Workers.Add(MoveTemp(Worker));
+		Threads.Add(Thread);
+	}
+
+	// sessions would wait forever without a worker
+	checkf(!Threads.IsEmpty(), TEXT("Failed to create encode workers."));
+}
+
+bool FFFmpegEncodeScheduler::CanRunSlice() const {
+	if (Queue.IsEmpty()) {
+		return false;
+	}
+
+	// the queue is drained at full speed on shutdown
+	if (bShuttingDown) {
+		return true;
+	}
+
+	// at least one worker runs whatever the throttle is
+	const auto& MaxRunningWorkers = FMath::Max(
+	    1, FMath::CeilToInt32(Threads.Num() * MaxRunningWorkerFraction));
+	return NumRunningWorkers < MaxRunningWorkers;
+}
+
+FFFmpegScheduledSession* FFFmpegEncodeScheduler::Dequeue() {
+	std::unique_lock lk(Queue_mutex);
+	Queue_cv.wait(lk, [&]() {
+		return (bShuttingDown && Queue.IsEmpty()) || CanRunSlice();
+	});
+
+	// exit once the queue is empty
+	if (Queue.IsEmpty()) {
+		return nullptr;
+	}
+
+	// take the session of the highest priority, then of the least encode
+	// time for its share
+	int32 Best = 0;
+	for (int32 i = 1; i < Queue.Num(); ++i) {
+		const auto& Candidate = *Queue[i];
+		const auto& Current   = *Queue[Best];
+		if (Candidate.Priority != Current.Priority
+		        ? Current.Priority < Candidate.Priority
+		        : Candidate.VirtualTime < Current.VirtualTime) {
+			Best = i;
+		}
+	}
+	auto Session = Queue[Best];
+	Queue.RemoveAt(Best);
+	Session->ScheduleState = Running;
+	++NumRunningWorkers;
+
+	// sessions queued from now on start from here
+	VirtualClock = FMath::Max(VirtualClock, Session->VirtualTime);
+
+	return Session;
+}
+
+void FFFmpegEncodeScheduler::FinishSlice(FFFmpegScheduledSession& Session,
+                                         const bool               bMoreWork,
+                                         const uint64             Cycles) {
+	++NumSlices;
+
+	bool bRequeued = false;
+	{
+		std::lock_guard lk(Queue_mutex);
+
+		// the worker is free for the next slice
+		--NumRunningWorkers;
+
+		// charge the encode time to the session
+		Session.VirtualTime +=
+		    FPlatformTime::ToSeconds64(Cycles) / Session.CPUShare;
+
+		// run again after the other queued sessions
+		if (bMoreWork || RunningRequeued == Session.ScheduleState) {
+			Session.ScheduleState = Queued;
+			Queue.Add(&Session);
+			MaxQueuedSessions = FMath::Max(MaxQueuedSessions, Queue.Num());
+			bRequeued         = true;
+		} else {
+			Session.ScheduleState = Idle;
+		}
+	}
+
+	// a worker held back by the throttle may run the next slice
+	Queue_cv.notify_one();
+	if (!bRequeued) {
+		Idle_cv.notify_all();
+	}
+}
+
+void FFFmpegEncodeScheduler::RunInline(FFFmpegScheduledSession& Session) {
+	while (true) {
+		const auto& bMoreWork = Session.RunSlice(FramesPerSlice);
+		++NumSlices;
+
+		// run again if the session has more work or got it during the slice
+		std::lock_guard lk(Queue_mutex);
+		if (!bMoreWork && RunningRequeued != Session.ScheduleState) {
+			Session.ScheduleState = Idle;
+			break;
+		}
+		Session.ScheduleState = Running;
+	}
+
+	Idle_cv.notify_all();
+}
+
+FFFmpegEncodeScheduler::FWorker::FWorker(FFFmpegEncodeScheduler& InScheduler)
+    : Scheduler(InScheduler) {}
+
+uint32 FFFmpegEncodeScheduler::FWorker::Run() {
+	while (const auto Session = Scheduler.Dequeue()) {
+		const auto& BeginCycles = FPlatformTime::Cycles64();
+		const auto& bMoreWork =
+		    Session->RunSlice(FFFmpegEncodeScheduler::FramesPerSlice);
+		Scheduler.FinishSlice(*Session, bMoreWork,
+		                      FPlatformTime::Cycles64() - BeginCycles);
+	}
+
+	return 0;
+}
@@ -1,17 +1,23 @@
 // Fill out your copyright notice in the Description page of Project Settings.
 
 #include "FFmpegEncodeThread.h"
+#include "FFmpegEncodeScheduler.h"
+#include "FFmpegEncoderPool.h"
+#include "FFmpegRateControl.h"
+#include "FFmpegReadbackPoller.h"
 
+#include "HAL/RunnableThread.h"
 #include "ImageUtils.h"
+#include "Misc/ScopeExit.h"
 #include "Tasks/Task.h"
 
-#include <tuple>
-
 extern "C" {
 #include <libavcodec/avcodec.h>
 #include <libavcodec/codec.h>
 #include <libavformat/avformat.h>
 #include <libavformat/avio.h>
+#include <libavutil/dict.h>
+#include <libavutil/imgutils.h>
 }
 
 void FFFmpegEncodeThread::Open(const FFFmpegEncoderConfig& FFmpegEncoderConfig,
@@ -30,22 +36,162 @@ void FFFmpegEncodeThread::Open(const FFFmpegEncoderConfig& FFmpegEncoderConfig,
 		Result = FFmpegEncoderOpenResult::Failure;
 	};
 
-	// Open function must be called only once.
-	checkf(!bOpened, TEXT("Open function has already been called once."));
+	// Open function can be called again once Close function has been called.
+	checkf(!bOpened || bClosed,
+	       TEXT("Open function has already been called. Call Close function "
+	            "before opening again."));
+
+	// sessions on the shared scheduler need no encode thread. it is stopped
+	// once it has written its sessions, so that Open does not wait for them.
+	if (nullptr != Thread && FFmpegEncoderConfig.bSharedScheduler) {
+		bool bThreadIdle = false;
+		{
+			std::lock_guard lk(Session_mutex);
+			bThreadIdle = NumSessionsFinished == NumSessionsStarted;
+		}
+		if (bThreadIdle) {
+			Thread->Kill(true);
+			delete Thread;
+			Thread = nullptr;
+
+			std::lock_guard lk(Session_mutex);
+			bShuttingDown = false;
+		}
+	}
 
 	// Mark as opened
 	bOpened = true;
+	bClosed = false;
+
+	// reset the state of the previous session
+	FrameIndex               = 0;
+	LastFrameTask            = TTask_Frame();
+	NextConversionWindowSlot = 0;
+	PendingTickets.Reset();
+
+	// the previous session is written on by itself, so this one starts with
+	// its own frame queue
+	CurrentSession = MakeShared<FSession, ESPMode::ThreadSafe>();
+
+	// copy Config, keeping the previous one to tell what can be reused
+	const auto PreviousConfig = Config;
+	Config                    = FFmpegEncoderConfig;
+	bSharedScheduler          = Config.bSharedScheduler;
+
+	// yield to encoders of a higher priority that are recording by encoding
+	// with a faster preset, if allowed
+	auto& Scheduler = FFFmpegEncodeScheduler::Get();
+	if (Config.bDegradeWhenYielding &&
+	    Scheduler.HasActiveSessionAbove(Config.Priority)) {
+		Config.Preset = static_cast<EFFmpegX264Preset>(FMath::Max(
+		    0, static_cast<int32>(Config.Preset) - DegradedPresetSteps));
+
+		// the next recording would not use a codec of the degraded preset
+		Config.bPrewarmOnClose = false;
+		UE_LOG(LogFFmpegEncoder, Log,
+		       TEXT("Encoders of a higher priority are recording. %s is used ")
+		           TEXT("instead of the preset of the config."),
+		       *UEnum::GetValueAsString(Config.Preset));
+	}
+	Scheduler.SetPriority(*this, Config.Priority, Config.CPUShare);
+
+	// sessions on the shared scheduler run in parallel with each other, so
+	// the codec runs on the worker alone unless specified
+	if (bSharedScheduler && 0 == Config.Threads) {
+		Config.Threads = 1;
+	}
+
+	// find the encoder and the pixel format frames are converted to
+	const auto Codec = FFFmpegCodecProfile::FindEncoder(Config);
+	if (nullptr == Codec) {
+		return Failure(FString::Printf(
+		    TEXT("Codec %s is not available in this build of FFmpeg."),
+		    *UEnum::GetValueAsString(Config.Codec)));
+	}
+	FrameFormat = FFFmpegCodecProfile::NegotiatePixelFormat(
+	    *Codec, Config.EncodePixelFormat);
+
+	// options of converting images to frames
+	ConversionOptions = FFFmpegConversionOptions::FromConfig(Config);
+
+	// frame buffers are reused through this pool, also by following sessions
+	// of the same format and size
+	if (!FramePool.IsValid() ||
+	    !FramePool->Matches(FrameFormat, Config.Width, Config.Height)) {
+		FramePool = MakeShared<FFFmpegFramePool, ESPMode::ThreadSafe>(
+		    FrameFormat, Config.Width, Config.Height);
+	}
+	ConversionOptions.FramePool = FramePool;
+
+	// render targets are read back through this ring
+	if (EFFmpegCaptureMode::ReadbackRing != Config.CaptureMode) {
+		ReadbackRing.Reset();
+	} else if (!ReadbackRing.IsValid() ||
+	           PreviousConfig.ReadbackRingDepth != Config.ReadbackRingDepth) {
+		ReadbackRing =
+		    MakeShared<FFFmpegTextureReadbackRing, ESPMode::ThreadSafe>(
+		        Config.ReadbackRingDepth);
+	}
+
+	// at most this number of frames are converted at once. each slot holds
+	// the event of the last conversion started in it.
+	const auto& NumWorkers = static_cast<int32>(
+	    LowLevelTasks::FScheduler::Get().GetNumWorkers());
+	const auto& ConversionWindowSize = 0 < Config.MaxConcurrentConversions
+	                                       ? Config.MaxConcurrentConversions
+	                                       : FMath::Max(1, NumWorkers);
+	ConversionWindow.Reset();
+	for (int32 Slot = 0; Slot < ConversionWindowSize; ++Slot) {
+		ConversionWindow.Emplace(UE_SOURCE_LOCATION);
+		ConversionWindow.Last().Trigger();
+	}
+
+	// bytes held by a frame in flight in addition to its source image
+	FrameBytes =
+	    av_image_get_buffer_size(FrameFormat, Config.Width, Config.Height, 1);
 
-	// copy Config
-	Config = FFmpegEncoderConfig;
+	// images of tasks that have not completed are assumed to be BGRA until an
+	// image has been converted
+	LastImageBytes = int64(Config.Width) * Config.Height * 4;
 
-	// copy OutputFilePath
-	VideoPath = OutputFilePath;
+	// the session writes with the final config
+	CurrentSession->Config      = Config;
+	CurrentSession->VideoPath   = OutputFilePath;
+	CurrentSession->Codec       = Codec;
+	CurrentSession->FrameFormat = FrameFormat;
+	CurrentSession->FramePool   = FramePool;
 
-	// create encode thread
-	Thread = FRunnableThread::Create(this, TEXT("FFmpeg encode thread"));
-	if (nullptr == Thread) {
-		return Failure("Failed to create encode thread.");
+	// event to wake the encode thread
+	if (nullptr == EncodeThreadEvent) {
+		EncodeThreadEvent = FPlatformProcess::GetSynchEventFromPool(false);
+	}
+
+	// create encode thread, which is kept for following sessions
+	const auto& ThreadPriority =
+	    FFFmpegEncodeGovernor::Get().GetThreadPriority(Config.Priority);
+	if (!bSharedScheduler && nullptr == Thread) {
+		Thread = FRunnableThread::Create(this, TEXT("FFmpeg encode thread"), 0,
+		                                 ThreadPriority);
+		if (nullptr == Thread) {
+			return Failure("Failed to create encode thread.");
+		}
+	} else if (nullptr != Thread) {
+		Thread->SetThreadPriority(ThreadPriority);
+	}
+
+	// queue the session. the encode thread or a worker of the shared
+	// scheduler starts it once the previous sessions have been written.
+	Scheduler.AddActiveSession(Config.Priority);
+	{
+		std::lock_guard lk(Session_mutex);
+		++NumSessionsStarted;
+		(bSharedScheduler ? ScheduledSessions : ThreadSessions)
+		    .Add(CurrentSession);
+	}
+	Session_cv.notify_all();
+	if (bSharedScheduler) {
+		bUsedScheduler = true;
+		Scheduler.Schedule(*this);
 	}
 
 	// finish as success
@@ -63,8 +209,13 @@ void FFFmpegEncodeThread::Close() {
 	// Mark as closed
 	bClosed = true;
 
-	// stop background thread
-	Stop();
+	// hand captures still being read back to the GPU without waiting for them
+	FFFmpegReadbackPoller::Get().Flush();
+
+	// let the encode thread write the rest of the video
+	if (CurrentSession.IsValid()) {
+		EndSession(*CurrentSession);
+	}
 }
 
 void FFFmpegEncodeThread::AddFrame(
@@ -133,33 +284,387 @@ void FFFmpegEncodeThread::AddFrame(const FString&               ImagePath,
 	// make a task that just returns that Image
 	auto ImageTask = UE::Tasks::MakeCompletedTask<FImage>(MoveTemp(Image));
 
-	// Add Frame from Image
-	return AddFrame(MoveTemp(ImageTask), Result, ErrorMessage);
+	// Add Frame from Image. the image is loaded here, so it can be recycled
+	const auto& ImageBytes = ImageTask.GetResult().GetImageSizeBytes();
+	return AddFrame(MoveTemp(ImageTask), true, ImageBytes, Result,
+	                ErrorMessage);
 }
 
 void FFFmpegEncodeThread::AddFrame(const TTask_Image&           ImageTask,
                                    FFmpegEncoderAddFrameResult& Result,
                                    FString&                     ErrorMessage) {
+	// the size of an image that has not been created yet is estimated from
+	// the last one
+	const auto& ImageBytes = ImageTask.IsCompleted()
+	                             ? ImageTask.GetResult().GetImageSizeBytes()
+	                             : LastImageBytes.load();
+
+	// the image belongs to the caller
+	return AddFrame(ImageTask, false, ImageBytes, Result, ErrorMessage);
+}
+
+void FFFmpegEncodeThread::AddFrame(const TTask_Image&           ImageTask,
+                                   const bool                   bRecycleImage,
+                                   const int64                  ImageBytes,
+                                   FFmpegEncoderAddFrameResult& Result,
+                                   FString&                     ErrorMessage) {
 	// Open function must be called
 	checkf(bOpened, checkfMesNotOpened_AddFrame);
 
 	// and Close function must not be called.
 	checkf(!bClosed, checkfMesClosed_AddFrame);
 
+	// lets the backpressure policy drop the frame before conversion
+	const auto& Ticket = MakeShared<FFrameTicket, ESPMode::ThreadSafe>();
+
+	// conversion tasks run at the priority the governor allows now
+	ConversionOptions.TaskPriority =
+	    FFFmpegEncodeGovernor::Get().GetTaskPriority(Config.Priority);
+
+	// signaled when the conversion has finished
+	UE::Tasks::FTaskEvent Converted(UE_SOURCE_LOCATION);
+
+	// the conversion starts after the conversion of the frame a window before
+	// has finished, so that a burst of frames does not flood the task graph
+	auto& WindowSlot = ConversionWindow[NextConversionWindowSlot];
+	NextConversionWindowSlot =
+	    (NextConversionWindowSlot + 1) % ConversionWindow.Num();
+
 	// launch CreateFrame task
 	auto FrameTask = UE::Tasks::Launch(
 	    UE_SOURCE_LOCATION,
 	    [&, ImageTask = ImageTask, FrameIndex = FrameIndex, Width = Config.Width,
-	     Height = Config.Height]() mutable {
-		    return UFFmpegUtils::CreateFrame(MoveTemp(ImageTask).GetResult(),
-		                                     FrameIndex, Width, Height);
+	     Height = Config.Height, PixelFormat = FrameFormat,
+	     Options = ConversionOptions, bRecycleImage, Ticket,
+	     Converted]() mutable {
+		    // let the next conversion start
+		    ON_SCOPE_EXIT { Converted.Trigger(); };
+
+		    // the frame has been dropped
+		    if (!Ticket->TryStart()) {
+			    if (bRecycleImage) {
+				    FFFmpegImagePool::Get().Release(
+				        MoveTemp(ImageTask.GetResult()));
+			    }
+			    return FFFmpegFrameThreadSafeSharedPtr(nullptr);
+		    }
+
+		    // the image is copied into the frame unless the frame can reference
+		    // it. then the storage of the image can be reused by next readback.
+		    auto& Image    = ImageTask.GetResult();
+		    LastImageBytes = Image.GetImageSizeBytes();
+		    if (bRecycleImage &&
+		        !UFFmpegUtils::CanWrapImage(Image, Width, Height, PixelFormat)) {
+			    auto Frame = UFFmpegUtils::CreateFrame(Image, FrameIndex, Width,
+			                                           Height, PixelFormat, Options);
+			    FFFmpegImagePool::Get().Release(MoveTemp(Image));
+			    return Frame;
+		    }
+
+		    return UFFmpegUtils::CreateFrame(MoveTemp(ImageTask), FrameIndex,
+		                                     Width, Height, PixelFormat, Options);
 	    },
-	    ImageTask, LowLevelTasks::ETaskPriority::BackgroundNormal);
+	    UE::Tasks::Prerequisites(ImageTask, WindowSlot),
+	    ConversionOptions.TaskPriority);
+
+	// the frame a window after waits for this conversion
+	WindowSlot = Converted;
+
+	return EnqueueFrame(MoveTemp(FrameTask), Ticket, ImageBytes, Result,
+	                    ErrorMessage);
+}
+
+void FFFmpegEncodeThread::EnqueueFrame(TTask_Frame            FrameTask,
+                                       const FFrameTicketPtr& Ticket,
+                                       const int64            ImageBytes,
+                                       FFmpegEncoderAddFrameResult& Result,
+                                       FString& ErrorMessage) {
+	// Open function must be called
+	checkf(bOpened, checkfMesNotOpened_AddFrame);
+
+	// and Close function must not be called.
+	checkf(!bClosed, checkfMesClosed_AddFrame);
+
+	// helper function to finish with success
+	const auto& Success = [&]() {
+		Result = FFmpegEncoderAddFrameResult::Success;
+	};
+
+	// helper function to finish with failure
+	const auto& Failure = [&](const FString& Message) {
+		ErrorMessage = Message;
+		UE_LOG(LogFFmpegEncoder, Error, TEXT("%s"), *ErrorMessage);
+		Result = FFmpegEncoderAddFrameResult::Failure;
+	};
+
+	// helper function to enqueue an entry and notify the encode thread
+	const auto& Enqueue = [&](FQueuedFrame&& QueuedFrame) {
+		if (!CurrentSession->FrameTasks.Enqueue(MoveTemp(QueuedFrame))) {
+			return false;
+		}
+
+		// increment FrameIndex
+		++FrameIndex;
+
+		// let a worker of the shared scheduler encode the frame, or wake the
+		// encode thread only if it is sleeping
+		if (bSharedScheduler) {
+			FFFmpegEncodeScheduler::Get().Schedule(*this);
+		} else if (bEncodeThreadWaiting.exchange(false)) {
+			EncodeThreadEvent->Trigger();
+		}
+
+		return true;
+	};
+
+	// forget tickets whose conversion has started
+	while (!PendingTickets.IsEmpty() &&
+	       FFrameTicket::Pending != PendingTickets[0]->State) {
+		PendingTickets.RemoveAt(0);
+	}
+
+	// yield to encoders of a higher priority that are recording, if allowed
+	bYielding =
+	    Config.bDegradeWhenYielding &&
+	    FFFmpegEncodeScheduler::Get().HasActiveSessionAbove(Config.Priority);
+
+	// bytes held by this frame until it is encoded
+	const auto& Bytes = ImageBytes + FrameBytes;
+
+	// check if the frame can be added
+	auto& Session = *CurrentSession;
+	bool  bFull   = false;
+	{
+		std::lock_guard lk(Session.FramesInFlight_mutex);
+		bFull = IsFrameQueueFull(Bytes);
+	}
 
-	return AddFrame(MoveTemp(FrameTask), Result, ErrorMessage);
+	// apply the backpressure policy
+	// a yielding encoder drops frames instead of blocking
+	auto AdmitResult = FFmpegEncoderAddFrameResult::Success;
+	const auto& Policy =
+	    bYielding && EFFmpegBackpressurePolicy::Block == Config.BackpressurePolicy
+	        ? EFFmpegBackpressurePolicy::DropNewest
+	        : Config.BackpressurePolicy;
+	if (bFull) {
+		switch (Policy) {
+		case EFFmpegBackpressurePolicy::DropNewest: {
+			// skip the conversion and keep the timing of following frames
+			if (Ticket.IsValid()) {
+				Ticket->TryDrop();
+			}
+			++FrameIndex;
+			++Session.NumDroppedFrames;
+			Result = FFmpegEncoderAddFrameResult::Dropped;
+			return;
+		}
+		case EFFmpegBackpressurePolicy::DropOldest:
+			if (DropOldestPendingFrame()) {
+				AdmitResult = FFmpegEncoderAddFrameResult::Dropped;
+				break;
+			}
+			WaitForRoomInFrameQueue(Bytes);
+			break;
+		case EFFmpegBackpressurePolicy::DuplicatePrevious: {
+			if (!LastFrameTask.IsValid()) {
+				WaitForRoomInFrameQueue(Bytes);
+				break;
+			}
+
+			// skip the conversion of the added frame
+			if (Ticket.IsValid()) {
+				Ticket->TryDrop();
+			}
+
+			// the duplicate only references buffers of the previous frame, so
+			// it is not counted in flight
+			auto DuplicateTask = UE::Tasks::Launch(
+			    UE_SOURCE_LOCATION,
+			    [PreviousTask = LastFrameTask, Pts = FrameIndex]() {
+				    const auto& Previous = PreviousTask.GetResult();
+				    if (!Previous) {
+					    return FFFmpegFrameThreadSafeSharedPtr(nullptr);
+				    }
+				    FFFmpegFrameThreadSafeSharedPtr Duplicate(
+				        av_frame_clone(Previous.Get()));
+
+				    // the frame is skipped if it could not be allocated
+				    if (!Duplicate) {
+					    return FFFmpegFrameThreadSafeSharedPtr(nullptr);
+				    }
+				    Duplicate->pts = Pts;
+				    return Duplicate;
+			    },
+			    LastFrameTask, ConversionOptions.TaskPriority);
+
+			if (!Enqueue({MoveTemp(DuplicateTask), nullptr, -1})) {
+				return Failure("Failed to enqueue the frame.");
+			}
+
+			++Session.NumDuplicatedFrames;
+			Result = FFmpegEncoderAddFrameResult::Duplicated;
+			return;
+		}
+		case EFFmpegBackpressurePolicy::Block:
+		default:
+			WaitForRoomInFrameQueue(Bytes);
+			break;
+		}
+	}
+
+	// count the frame in flight
+	{
+		std::lock_guard lk(Session.FramesInFlight_mutex);
+		++Session.NumFramesInFlight;
+		Session.BytesInFlight += Bytes;
+		Session.PeakFramesInFlight = FMath::Max(
+		    Session.PeakFramesInFlight.load(), Session.NumFramesInFlight);
+	}
+
+	// remember the frame for following policies
+	LastFrameTask = FrameTask;
+	if (Ticket.IsValid()) {
+		Ticket->Bytes = Bytes;
+		PendingTickets.Add(Ticket);
+	}
+
+	// enqueue frame
+	if (!Enqueue({MoveTemp(FrameTask), Ticket, Bytes})) {
+		ReleaseFrameInFlight(Session, Bytes);
+		return Failure("Failed to enqueue the frame.");
+	}
+
+	if (FFmpegEncoderAddFrameResult::Dropped == AdmitResult) {
+		Result = AdmitResult;
+		return;
+	}
+
+	return Success();
+}
+
+bool FFFmpegEncodeThread::IsFrameQueueFull(const int64 Bytes) const {
+	// a yielding encoder keeps half the frames in flight
+	const auto& MaxFrames = bYielding ? (Config.MaxFramesInFlight + 1) / 2
+	                                  : Config.MaxFramesInFlight;
+	const auto& MaxBytes  = bYielding ? (Config.MaxBytesInFlight + 1) / 2
+	                                  : Config.MaxBytesInFlight;
+
+	// a single frame is always allowed even if it exceeds MaxBytes
+	const auto& Session = *CurrentSession;
+	return (0 < MaxFrames && MaxFrames <= Session.NumFramesInFlight) ||
+	       (0 < MaxBytes && MaxBytes < Session.BytesInFlight + Bytes &&
+	        0 < Session.NumFramesInFlight);
+}
+
+void FFFmpegEncodeThread::WaitForRoomInFrameQueue(const int64 Bytes) {
+	auto&            Session = *CurrentSession;
+	std::unique_lock lk(Session.FramesInFlight_mutex);
+	while (!Session.bSessionEnded && IsFrameQueueFull(Bytes)) {
+		// captures complete only when the readback poller polls, which no
+		// tick does while this blocks the game thread
+		lk.unlock();
+		FFFmpegReadbackPoller::Get().Flush();
+		lk.lock();
+
+		Session.Producer_cv.wait_for(lk, ReadbackPollInterval, [&]() {
+			return Session.bSessionEnded || !IsFrameQueueFull(Bytes);
+		});
+	}
+}
+
+bool FFFmpegEncodeThread::DropOldestPendingFrame() {
+	for (const auto& Ticket : PendingTickets) {
+		if (Ticket->TryDrop()) {
+			// the conversion is skipped, so the memory is released soon
+			ReleaseFrameInFlight(*CurrentSession, Ticket->Bytes);
+			++CurrentSession->NumDroppedFrames;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void FFFmpegEncodeThread::ReleaseFrameInFlight(FSession&   Session,
+                                               const int64 Bytes) {
+	{
+		std::lock_guard lk(Session.FramesInFlight_mutex);
+		--Session.NumFramesInFlight;
+		Session.BytesInFlight -= Bytes;
+	}
+
+	// notify that a frame can be added
+	Session.Producer_cv.notify_one();
+}
+
+bool FFFmpegEncodeThread::FFrameTicket::TryStart() noexcept {
+	uint8 Expected = Pending;
+	return State.compare_exchange_strong(Expected, Converting);
+}
+
+bool FFFmpegEncodeThread::FFrameTicket::TryDrop() noexcept {
+	uint8 Expected = Pending;
+	return State.compare_exchange_strong(Expected, Dropped);
+}
+
+bool FFFmpegEncodeThread::FFrameTicket::IsDropped() const noexcept {
+	return Dropped == State;
+}
+
+FFFmpegFramePoolStats FFFmpegEncodeThread::GetFramePoolStats() const {
+	return FramePool.IsValid() ? FramePool->GetStats() : FFFmpegFramePoolStats();
+}
+
+FFFmpegPipelineStats FFFmpegEncodeThread::GetPipelineStats() const {
+	return CurrentSession.IsValid() ? PipelineStatsOf(*CurrentSession)
+	                                : FFFmpegPipelineStats();
+}
+
+FFFmpegRateControlStats FFFmpegEncodeThread::GetRateControlStats() const {
+	return CurrentSession.IsValid() ? CurrentSession->RateControl.GetStats()
+	                                : FFFmpegRateControlStats();
+}
+
+AVPixelFormat FFFmpegEncodeThread::GetFrameFormat() const noexcept {
+	return FrameFormat;
+}
+
+FFFmpegFrameQueueStats FFFmpegEncodeThread::GetFrameQueueStats() const {
+	return CurrentSession.IsValid() ? FrameQueueStatsOf(*CurrentSession)
+	                                : FFFmpegFrameQueueStats();
+}
+
+FFFmpegFrameQueueStats
+    FFFmpegEncodeThread::FrameQueueStatsOf(const FSession& Session) {
+	FFFmpegFrameQueueStats Stats;
+	{
+		std::lock_guard lk(Session.FramesInFlight_mutex);
+		Stats.NumFramesInFlight = Session.NumFramesInFlight;
+		Stats.BytesInFlight     = Session.BytesInFlight;
+	}
+	Stats.MaxFramesInFlight   = Session.PeakFramesInFlight;
+	Stats.NumDroppedFrames    = Session.NumDroppedFrames;
+	Stats.NumDuplicatedFrames = Session.NumDuplicatedFrames;
+	return Stats;
+}
+
+FFFmpegPipelineStats
+    FFFmpegEncodeThread::PipelineStatsOf(const FSession& Session) {
+	FFFmpegPipelineStats Stats;
+	Stats.EncodeUtilization = Session.EncodeStageTimer.GetUtilization();
+	Stats.MuxUtilization    = Session.MuxStageTimer.GetUtilization();
+	Stats.MaxQueuedPackets  = Session.PeakQueuedPackets;
+	return Stats;
 }
 
 FFFmpegEncodeThread::~FFFmpegEncodeThread() {
+	// the session being recorded is ended, and the sessions queued before it
+	// are written
+	if (CurrentSession.IsValid()) {
+		EndSession(*CurrentSession);
+	}
+	WaitForSessionToFinish();
+
 	if (Thread) {
 		// wait to finish thread
 		Thread->Kill(true);
@@ -167,201 +672,585 @@ FFFmpegEncodeThread::~FFFmpegEncodeThread() {
 		// release memory for Thread
 		delete Thread;
 	}
+
+	// no worker of the shared scheduler may still refer to this
+	if (bUsedScheduler) {
+		WaitForScheduler();
+	}
+
+	if (nullptr != EncodeThreadEvent) {
+		FPlatformProcess::ReturnSynchEventToPool(EncodeThreadEvent);
+	}
 }
 
 #pragma region Run on the new thread functions
 
 uint32 FFFmpegEncodeThread::Run() {
+	auto Result = FFmpegEncoderThreadResult::Success;
+
+	// write the queued sessions in order until Stop is called
+	while (const auto Session = WaitForSession()) {
+		Result = RunSession(*Session);
+		FinishSession(*Session, Result);
+	}
+
+	return static_cast<uint32>(Result);
+}
+
+FFmpegEncoderThreadResult FFFmpegEncodeThread::RunSession(FSession& Session) {
 	using enum FFmpegEncoderThreadResult;
 
-#pragma region Open
-	// get Codec
-	const auto& CodecH264 = avcodec_find_encoder(AV_CODEC_ID_H264);
-	if (nullptr == CodecH264) {
-		return static_cast<uint32>(CodecH264IsNotFound);
+	// open the codec and the output
+	if (const auto Result = OpenSession(Session); Success != Result) {
+		return Result;
 	}
 
-	// get Codec Context
-	auto ContextH264 = avcodec_alloc_context3(CodecH264);
-	if (nullptr == ContextH264) {
-		return static_cast<uint32>(FailedToAllocateCodecContext);
+	// frames dequeued at once
+	TArray<FQueuedFrame> Batch;
+
+	// helper function to follow the priority the governor allows now, so that
+	// the thread is lowered while the game is over its frame time budget
+	auto        ThreadPriority       = TPri_Num;
+	const auto& UpdateThreadPriority = [&]() {
+		const auto& Governed =
+		    FFFmpegEncodeGovernor::Get().GetThreadPriority(
+		        Session.Config.Priority);
+		if (Governed != ThreadPriority) {
+			ThreadPriority = Governed;
+			FRunnableThread::GetRunnableThread()->SetThreadPriority(Governed);
+		}
+	};
+
+	// Loop while the status is in running or FrameTasks is not empty.
+	while (true) {
+		// read the status before draining, so that frames enqueued before Stop
+		// are never left behind
+		const bool bStopped = !Session.bRunning;
+
+		// drain all frames enqueued so far
+		FQueuedFrame QueuedFrame;
+		while (Session.FrameTasks.Dequeue(QueuedFrame)) {
+			Batch.Add(MoveTemp(QueuedFrame));
+		}
+
+		// if FrameTasks is empty
+		if (Batch.IsEmpty()) {
+			// finish once stopped
+			if (bStopped) {
+				break;
+			}
+
+			// sleep until a frame is enqueued or Stop is called
+			WaitForFrameTasks(Session);
+			continue;
+		}
+
+		UpdateThreadPriority();
+
+		// encode the batch in order, waiting for each conversion. each frame is
+		// released as soon as it is encoded, not with the whole batch.
+		for (auto& BatchedFrame : Batch) {
+			if (const auto Result = EncodeFrame(Session, BatchedFrame);
+			    Success != Result) {
+				return Result;
+			}
+			BatchedFrame = FQueuedFrame();
+		}
+		Batch.Reset();
 	}
 
-	// get from Config
-	const auto& [Width, Height, FrameRate, BitRate] =
-	    std::tie(Config.Width, Config.Height, Config.FrameRate, Config.BitRate);
+	// flush the codec and write the trailer
+	return CloseSession(Session);
+}
 
-	// FrameRate as Rational
-	const auto FrameRateAsRational = av_d2q(FrameRate, INT_MAX);
+#pragma endregion
 
-	// set Codec Context settings
-	ContextH264->width     = Width;
-	ContextH264->height    = Height;
-	ContextH264->bit_rate  = BitRate;
-	ContextH264->time_base = av_inv_q(FrameRateAsRational);
-	ContextH264->framerate = FrameRateAsRational;
+#pragma region Run on the workers of the shared scheduler
+
+bool FFFmpegEncodeThread::RunSlice(const int32 MaxFrames) {
+	using enum FFmpegEncoderThreadResult;
 
-	ContextH264->gop_size     = 300;
-	ContextH264->max_b_frames = 12;
-	ContextH264->pix_fmt      = AV_PIX_FMT_YUV420P;
+	// helper function to end the session. the next queued session is run
+	// after the other sessions.
+	const auto& Finish = [&](const FFmpegEncoderThreadResult Result) {
+		const auto Session = MoveTemp(ScheduledSession);
+		ScheduledSession.Reset();
+		FinishSession(*Session, Result);
 
-	// set CRF quality value
-	AVDictionary* EncodeOptions = nullptr;
-	av_dict_set(&EncodeOptions, "crf", "18", 0);
-	if (avcodec_open2(ContextH264, CodecH264, &EncodeOptions) != 0) {
-		return static_cast<uint32>(FailedToInitializeCodecContext);
+		std::lock_guard lk(Session_mutex);
+		return !ScheduledSessions.IsEmpty();
+	};
+
+	// open the codec and the output on the first slice of a session
+	if (!ScheduledSession.IsValid()) {
+		ScheduledSession = TakeScheduledSession();
+		if (!ScheduledSession.IsValid()) {
+			return false;
+		}
+		if (const auto Result = OpenSession(*ScheduledSession);
+		    Success != Result) {
+			return Finish(Result);
+		}
 	}
-	av_dict_free(&EncodeOptions);
+	auto& Session = *ScheduledSession;
+
+	// read the status before draining, so that frames enqueued before Close
+	// are never left behind
+	const bool bStopped = !Session.bRunning;
+
+	// encode frames whose conversion has finished, without waiting for others
+	for (int32 NumEncoded = 0; NumEncoded < MaxFrames; ++NumEncoded) {
+		const auto QueuedFrame = Session.FrameTasks.Peek();
+
+		// once FrameTasks is empty, the producer schedules this again with the
+		// next frame or Close
+		if (nullptr == QueuedFrame) {
+			return bStopped ? Finish(CloseSession(Session)) : false;
+		}
+
+		// run again once the conversion has finished
+		if (!QueuedFrame->Task.IsCompleted()) {
+			LaunchWakeTask(QueuedFrame->Task, Session.Config.Priority);
+			return false;
+		}
+
+		// encode the frame
+		FQueuedFrame ReadyFrame;
+		Session.FrameTasks.Dequeue(ReadyFrame);
+		if (const auto Result = EncodeFrame(Session, ReadyFrame);
+		    Success != Result) {
+			return Finish(Result);
+		}
+	}
+
+	// yield to the other sessions
+	return true;
+}
+
+#pragma endregion
+
+#pragma region Session functions
+
+FFmpegEncoderThreadResult FFFmpegEncodeThread::OpenSession(FSession& Session) {
+	using enum FFmpegEncoderThreadResult;
+
+	// Codec is found by Open function
+	if (nullptr == Session.Codec) {
+		return CodecIsNotFound;
+	}
+
+	// take a context prewarmed with the codec settings, or open a new one
+	Session.CodecContext =
+	    FFFmpegEncoderPool::Get().Acquire(Session.Config).Context;
+	if (nullptr == Session.CodecContext) {
+		Session.CodecContext = FFFmpegCodecProfile::OpenCodecContext(
+		    Session.Config, *Session.Codec, Session.FrameFormat);
+	}
+	if (nullptr == Session.CodecContext) {
+		return FailedToInitializeCodecContext;
+	}
+	const auto& CodecContext = Session.CodecContext;
+
+	// model the VBV buffer of the opened codec
+	Session.RateControl.Reset(*CodecContext);
 
 	// open output file
-	auto         OutputFilePathInUTF8 = StringCast<UTF8CHAR>(*VideoPath);
-	AVIOContext* IOContext            = nullptr;
-	if (avio_open(&IOContext,
-	              reinterpret_cast<const char*>(OutputFilePathInUTF8.Get()),
-	              AVIO_FLAG_WRITE) < 0) {
-		return static_cast<uint32>(FailedToInitializeIOContext);
+	// space for the expected duration is reserved up front; the file is
+	// trimmed to the written size when it is closed
+	FFFmpegBufferedOutputOptions OutputOptions;
+	OutputOptions.BufferSize      = Session.Config.OutputBufferSize;
+	OutputOptions.PreallocateSize =
+	    static_cast<int64>(static_cast<double>(Session.Config.BitRate) / 8.0 *
+	                       Session.Config.ExpectedDuration);
+	OutputOptions.bDirectIO       = Session.Config.bDirectIO;
+	Session.Output                = MakeUnique<FFFmpegBufferedOutput>();
+	if (!Session.Output->Open(Session.VideoPath, OutputOptions)) {
+		return FailedToInitializeIOContext;
 	}
+	AVIOContext* IOContext = Session.Output->GetIOContext();
 
 	// allocate memory to FormatContext
-	AVFormatContext* FormatContext = nullptr;
+	auto OutputFilePathInUTF8 = StringCast<UTF8CHAR>(*Session.VideoPath);
 	if (avformat_alloc_output_context2(
-	        &FormatContext, nullptr, nullptr,
+	        &Session.FormatContext, nullptr, nullptr,
 	        reinterpret_cast<const char*>(OutputFilePathInUTF8.Get())) < 0) {
-		return static_cast<uint32>(FailedToAllocateFormatContext);
+		return FailedToAllocateFormatContext;
 	}
+	const auto& FormatContext = Session.FormatContext;
 
 	// set FormatContext to output to specified output file
 	FormatContext->pb = IOContext;
 
 	// add new stream to file
-	const auto& Stream = avformat_new_stream(FormatContext, CodecH264);
-	if (nullptr == Stream) {
-		return static_cast<uint32>(FailedToAddANewStream);
+	Session.Stream = avformat_new_stream(FormatContext, Session.Codec);
+	if (nullptr == Session.Stream) {
+		return FailedToAddANewStream;
 	}
+	const auto& Stream = Session.Stream;
 
 	// set Stream information
-	Stream->sample_aspect_ratio = ContextH264->sample_aspect_ratio;
-	Stream->time_base           = ContextH264->time_base;
+	Stream->sample_aspect_ratio = CodecContext->sample_aspect_ratio;
+	Stream->time_base           = CodecContext->time_base;
 
 	// set parameter from codec context h264
-	if (avcodec_parameters_from_context(Stream->codecpar, ContextH264) != 0) {
-		return static_cast<uint32>(FailedToSetCodecParameters);
+	if (avcodec_parameters_from_context(Stream->codecpar, CodecContext) != 0) {
+		return FailedToSetCodecParameters;
 	}
 
 	// write header to output file
 	if (avformat_write_header(FormatContext, nullptr) != 0) {
-		return static_cast<uint32>(FailedToWriteHeader);
+		return FailedToWriteHeader;
 	}
-#pragma endregion
 
-#pragma region AddFrame
-	auto ReceiveAllPendingPackets = [&]() {
-		// allocate Packet
-		AVPacket* Packet = av_packet_alloc();
-		if (nullptr == Packet) {
-			return FailedToAllocatePacket;
-		}
+	// packets are written on the mux thread, so that IO does not stall
+	// encoding. a worker of the shared scheduler writes them itself, so that
+	// a session holds no thread.
+	Session.MuxThread = MakeUnique<FFFmpegMuxThread>(
+	    FormatContext, Session.Config.MaxQueuedPackets, Session.MuxStageTimer);
+	if (Session.Config.bSharedScheduler) {
+		Session.MuxThread->StartInline();
+	} else if (!Session.MuxThread->Start()) {
+		return FailedToStartMuxThread;
+	}
 
-		// receive a Packet
-		while (avcodec_receive_packet(ContextH264, Packet) == 0) {
-			check(Packet->size != 0);
+	// start measuring the encode stage
+	Session.EncodeStageTimer.Begin();
 
-			// set stream index of this packet from stream
-			Packet->stream_index = Stream->index;
+	return Success;
+}
 
-			// rescale
-			av_packet_rescale_ts(Packet, ContextH264->time_base, Stream->time_base);
+FFmpegEncoderThreadResult
+    FFFmpegEncodeThread::EncodeFrame(FSession&     Session,
+                                     FQueuedFrame& QueuedFrame) {
+	using enum FFmpegEncoderThreadResult;
 
-			// write Packet to output media file
-			if (av_interleaved_write_frame(FormatContext, Packet) != 0) {
-				return FailedToWritePacket;
-			}
+	// get a frame pending encoding
+	const auto& Frame = QueuedFrame.Task.GetResult();
 
-			// un reference the buffer of Packet
-			av_packet_unref(Packet);
-		}
+	// a dropped frame was released when it was dropped
+	const auto& bDropped =
+	    QueuedFrame.Ticket.IsValid() && QueuedFrame.Ticket->IsDropped();
 
-		// free Packet resource
-		av_packet_free(&Packet);
+	// send a frame unless it has been dropped
+	const auto& BeginCycles = FPlatformTime::Cycles64();
+	const auto& SendResult =
+	    Frame ? avcodec_send_frame(Session.CodecContext, Frame.Get()) : 0;
+	Session.EncodeStageTimer.AddBusyCycles(FPlatformTime::Cycles64() -
+	                                       BeginCycles);
 
-		// success
-		return Success;
-	};
+	// the frame is no longer in flight
+	if (0 <= QueuedFrame.Bytes && !bDropped) {
+		ReleaseFrameInFlight(Session, QueuedFrame.Bytes);
+	}
 
-	// Loop while the status is in running or FrameTasks is not empty.
-	while (true) {
-		{
-			// Wait for finish or enqueue to FrameTasks
-			std::unique_lock lk(FrameTasks_mutex);
-			EncodeThread_cv.wait(
-			    lk, [&]() { return !bRunning || !FrameTasks.IsEmpty(); });
-		}
+	if (SendResult != 0) {
+		return FailedToSendFrame;
+	}
 
-		// if FrameTasks is empty
-		if (FrameTasks.IsEmpty()) {
-			// should be in the finish state.
-			check(!bRunning);
+	// Receive all packets
+	return ReceiveAllPendingPackets(Session);
+}
+
+FFmpegEncoderThreadResult
+    FFFmpegEncodeThread::ReceiveAllPendingPackets(FSession& Session) {
+	using enum FFmpegEncoderThreadResult;
 
-			// finish
+	const auto& CodecContext = Session.CodecContext;
+
+	// allocate Packet
+	AVPacket* Packet = av_packet_alloc();
+	if (nullptr == Packet) {
+		return FailedToAllocatePacket;
+	}
+
+	// receive a Packet
+	while (true) {
+		const auto& BeginCycles   = FPlatformTime::Cycles64();
+		const auto& ReceiveResult = avcodec_receive_packet(CodecContext, Packet);
+		Session.EncodeStageTimer.AddBusyCycles(FPlatformTime::Cycles64() -
+		                                       BeginCycles);
+		if (ReceiveResult != 0) {
 			break;
 		}
 
-		// dequeue next frame task
-		TTask_Frame FrameTask;
-		FrameTasks.Dequeue(FrameTask);
+		check(Packet->size != 0);
 
-		// get a frame pending encoding
-		const auto& Frame = FrameTask.GetResult();
+		// account the frame in the VBV model
+		const auto& BufferFill = Session.RateControl.AddFrame(Packet->size);
+		UE_LOG(LogFFmpegEncoder, VeryVerbose,
+		       TEXT("Frame %lld: %d bytes, VBV buffer %.0f%% full."),
+		       Packet->pts, Packet->size, BufferFill * 100.0);
 
-		// send a frame
-		if (avcodec_send_frame(ContextH264, Frame.Get()) != 0) {
-			return static_cast<uint32>(FailedToSendFrame);
-		}
+		// set stream index of this packet from stream
+		Packet->stream_index = Session.Stream->index;
 
-		// Receive all packets
-		const auto& ReceiveResult = ReceiveAllPendingPackets();
+		// rescale
+		av_packet_rescale_ts(Packet, CodecContext->time_base,
+		                     Session.Stream->time_base);
 
-		// failed to receive packets
-		if (ReceiveResult != Success) {
-			return static_cast<uint32>(ReceiveResult);
+		// hand Packet to the mux thread. this un references Packet.
+		if (!Session.MuxThread->Push(*Packet)) {
+			av_packet_free(&Packet);
+			return FailedToWritePacket;
 		}
 	}
-#pragma endregion
 
-#pragma region Close
+	// free Packet resource
+	av_packet_free(&Packet);
+
+	// success
+	return Success;
+}
+
+FFmpegEncoderThreadResult FFFmpegEncodeThread::CloseSession(FSession& Session) {
+	using enum FFmpegEncoderThreadResult;
+
 	// notify that encoding is finished
-	if (avcodec_send_frame(ContextH264, nullptr) != 0) {
-		return static_cast<int32>(FailedToFlushSendFrame);
+	if (avcodec_send_frame(Session.CodecContext, nullptr) != 0) {
+		return FailedToFlushSendFrame;
 	}
 
 	// Receive all packets
-	const auto& ReceiveResult = ReceiveAllPendingPackets();
+	if (const auto Result = ReceiveAllPendingPackets(Session);
+	    Success != Result) {
+		return Result;
+	}
+
+	// encoding has finished
+	Session.EncodeStageTimer.End();
 
-	// failed to receive packets
-	if (ReceiveResult != Success) {
-		return static_cast<uint32>(ReceiveResult);
+	// wait for the mux thread to write all packets
+	const auto& SuccessToMux  = Session.MuxThread->Finish();
+	Session.PeakQueuedPackets = Session.MuxThread->GetMaxQueuedPackets();
+	Session.MuxThread.Reset();
+	if (!SuccessToMux) {
+		return FailedToWritePacket;
 	}
 
 	// write trailer to output file
-	if (av_write_trailer(FormatContext) != 0) {
-		return static_cast<int32>(FailedToWriteTrailer);
+	if (av_write_trailer(Session.FormatContext) != 0) {
+		return FailedToWriteTrailer;
+	}
+
+	// a codec that has been sent the end of stream can not encode another.
+	// one is opened in the background for the next recording instead, unless
+	// the pool already has one.
+	avcodec_free_context(&Session.CodecContext);
+	if (Session.Config.bPrewarmOnClose) {
+		FFFmpegEncoderPool::Get().PrewarmIfMissing(Session.Config);
 	}
 
 	// free resources
-	avcodec_free_context(&ContextH264);
-	avformat_free_context(FormatContext);
-	avio_closep(&IOContext);
-#pragma endregion
+	avformat_free_context(Session.FormatContext);
+	Session.FormatContext      = nullptr;
+	Session.Stream             = nullptr;
+	const auto& SuccessToClose = Session.Output->Close();
+	Session.Output.Reset();
+	if (!SuccessToClose) {
+		return FailedToCloseOutput;
+	}
 
-	return static_cast<uint32>(Success);
+	// report how many frame buffers were needed
+	const auto& FramePoolStats = Session.FramePool.IsValid()
+	                                 ? Session.FramePool->GetStats()
+	                                 : FFFmpegFramePoolStats();
+	UE_LOG(LogFFmpegEncoder, Log,
+	       TEXT("Frame pool: %d buffers of %lld bytes, at most %d in use."),
+	       FramePoolStats.NumBuffers, FramePoolStats.BufferSize,
+	       FramePoolStats.MaxBuffersInUse);
+
+	// report how the backpressure policy worked
+	const auto& FrameQueueStats = FrameQueueStatsOf(Session);
+	UE_LOG(LogFFmpegEncoder, Log,
+	       TEXT("Frame queue: at most %d frames in flight, %d dropped, %d ")
+	           TEXT("duplicated."),
+	       FrameQueueStats.MaxFramesInFlight, FrameQueueStats.NumDroppedFrames,
+	       FrameQueueStats.NumDuplicatedFrames);
+
+	// report which stage bounded the capture
+	const auto& PipelineStats = PipelineStatsOf(Session);
+	UE_LOG(LogFFmpegEncoder, Log,
+	       TEXT("Pipeline: encode stage %.0f%% busy, mux stage %.0f%% busy, at ")
+	           TEXT("most %d packets queued."),
+	       PipelineStats.EncodeUtilization * 100.0,
+	       PipelineStats.MuxUtilization * 100.0, PipelineStats.MaxQueuedPackets);
+
+	// report the bitrate and how close the output came to the VBV limit
+	const auto& RateControlStats = Session.RateControl.GetStats();
+	UE_LOG(LogFFmpegEncoder, Log,
+	       TEXT("Rate control: %.0f bits/s on average, VBV buffer at least ")
+	           TEXT("%.0f%% full, %d underflows."),
+	       RateControlStats.AverageBitRate,
+	       RateControlStats.MinBufferFill * 100.0,
+	       RateControlStats.NumUnderflows);
+
+	return Success;
+}
+
+void FFFmpegEncodeThread::AbortSession(FSession& Session) {
+	// stop writing packets
+	if (Session.MuxThread.IsValid()) {
+		Session.MuxThread->Finish();
+		Session.MuxThread.Reset();
+	}
+
+	// free the output left open
+	if (nullptr != Session.FormatContext) {
+		avformat_free_context(Session.FormatContext);
+		Session.FormatContext = nullptr;
+	}
+	Session.Stream = nullptr;
+	if (Session.Output.IsValid()) {
+		Session.Output->Close();
+		Session.Output.Reset();
+	}
+
+	// the codec context may be in any state
+	avcodec_free_context(&Session.CodecContext);
 }
 
 #pragma endregion
 
 void FFFmpegEncodeThread::Stop() {
+	// the thread exits once the queued sessions have been written
+	{
+		std::lock_guard lk(Session_mutex);
+		bShuttingDown = true;
+	}
+	Session_cv.notify_all();
+
+	// finish the session being recorded
+	if (CurrentSession.IsValid()) {
+		EndSession(*CurrentSession);
+	}
+}
+
+void FFFmpegEncodeThread::EndSession(FSession& Session) {
 	// stop running
-	bRunning = false;
+	Session.bRunning = false;
+
+	// a worker of the shared scheduler finishes the session
+	if (Session.Config.bSharedScheduler) {
+		FFFmpegEncodeScheduler::Get().Schedule(*this);
+		return;
+	}
 
 	// notify the encode thread to finish
-	EncodeThread_cv.notify_one();
+	if (nullptr != EncodeThreadEvent) {
+		bEncodeThreadWaiting = false;
+		EncodeThreadEvent->Trigger();
+	}
+}
+
+void FFFmpegEncodeThread::WaitForSessionToFinish() {
+	std::unique_lock lk(Session_mutex);
+	while (NumSessionsFinished != NumSessionsStarted) {
+		// the sessions may wait for captures, which complete only when the
+		// readback poller polls
+		lk.unlock();
+		FFFmpegReadbackPoller::Get().Flush();
+		lk.lock();
+
+		Session_cv.wait_for(lk, ReadbackPollInterval, [&]() {
+			return NumSessionsFinished == NumSessionsStarted;
+		});
+	}
+}
+
+void FFFmpegEncodeThread::WaitForScheduler() {
+	// a wake task may schedule this after a slice has finished
+	auto& Scheduler = FFFmpegEncodeScheduler::Get();
+	Scheduler.WaitForIdle(*this);
+	{
+		std::unique_lock lk(Session_mutex);
+		Session_cv.wait(lk, [&]() { return 0 == NumPendingWakeTasks; });
+	}
+	Scheduler.WaitForIdle(*this);
+}
+
+void FFFmpegEncodeThread::LaunchWakeTask(
+    const TTask_Frame& FrameTask, const EFFmpegEncoderPriority Priority) {
+	// count the task before it may run, so that the destructor waits for it
+	{
+		std::lock_guard lk(Session_mutex);
+		++NumPendingWakeTasks;
+	}
+
+	UE::Tasks::Launch(
+	    UE_SOURCE_LOCATION,
+	    [this]() {
+		    FFFmpegEncodeScheduler::Get().Schedule(*this);
+
+		    // notify under the lock, as the destructor may run as soon as
+		    // the count drops
+		    std::lock_guard lk(Session_mutex);
+		    --NumPendingWakeTasks;
+		    Session_cv.notify_all();
+	    },
+	    FrameTask, UFFmpegUtils::TaskPriorityOf(Priority));
+}
+
+FFFmpegEncodeThread::FSessionPtr FFFmpegEncodeThread::WaitForSession() {
+	std::unique_lock lk(Session_mutex);
+	Session_cv.wait(
+	    lk, [&]() { return bShuttingDown || !ThreadSessions.IsEmpty(); });
+
+	// sessions queued before Stop are still written
+	if (ThreadSessions.IsEmpty()) {
+		return nullptr;
+	}
+
+	auto Session = ThreadSessions[0];
+	ThreadSessions.RemoveAt(0);
+	return Session;
+}
+
+FFFmpegEncodeThread::FSessionPtr FFFmpegEncodeThread::TakeScheduledSession() {
+	std::lock_guard lk(Session_mutex);
+	if (ScheduledSessions.IsEmpty()) {
+		return nullptr;
+	}
+
+	auto Session = ScheduledSessions[0];
+	ScheduledSessions.RemoveAt(0);
+	return Session;
+}
+
+void FFFmpegEncodeThread::FinishSession(
+    FSession& Session, const FFmpegEncoderThreadResult Result) {
+	// free what a failed session has left
+	if (FFmpegEncoderThreadResult::Success != Result) {
+		AbortSession(Session);
+	}
+
+	// frames are no longer consumed, so the producer must not wait for them
+	{
+		std::lock_guard lk(Session.FramesInFlight_mutex);
+		Session.bSessionEnded = true;
+	}
+	Session.Producer_cv.notify_all();
+
+	// encoders of a lower priority no longer yield to this
+	FFFmpegEncodeScheduler::Get().RemoveActiveSession(Session.Config.Priority);
+
+	// let the destructor know every session has been written
+	{
+		std::lock_guard lk(Session_mutex);
+		++NumSessionsFinished;
+	}
+	Session_cv.notify_all();
+}
+
+void FFFmpegEncodeThread::WaitForFrameTasks(FSession& Session) {
+	// tell the producer that this thread is going to sleep
+	bEncodeThreadWaiting = true;
+
+	// a frame or Stop may have come before the flag was set
+	if (!Session.FrameTasks.IsEmpty() || !Session.bRunning) {
+		bEncodeThreadWaiting = false;
+		return;
+	}
+
+	// the producer triggers the event after it clears the flag
+	EncodeThreadEvent->Wait();
 }
@@ -33,3 +33,19 @@ void UFFmpegEncoder::AddFrame(const TTask_Image&           ImageTask,
                               FString&                     ErrorMessage) {
 	return FFmpegEncodeThread.AddFrame(ImageTask, Result, ErrorMessage);
 }
+
+FFFmpegFramePoolStats UFFmpegEncoder::GetFramePoolStats() const {
+	return FFmpegEncodeThread.GetFramePoolStats();
+}
+
+FFFmpegFrameQueueStats UFFmpegEncoder::GetFrameQueueStats() const {
+	return FFmpegEncodeThread.GetFrameQueueStats();
+}
+
+FFFmpegPipelineStats UFFmpegEncoder::GetPipelineStats() const {
+	return FFmpegEncodeThread.GetPipelineStats();
+}
+
+FFFmpegRateControlStats UFFmpegEncoder::GetRateControlStats() const {
+	return FFmpegEncodeThread.GetRateControlStats();
+}
@@ -0,0 +1,231 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "FFmpegEncoderPool.h"
+#include "FFmpegCodecProfile.h"
+#include "HAL/IConsoleManager.h"
+#include "LogFFmpegEncoder.h"
+
+namespace {
+TAutoConsoleVariable<float> CVarEncoderPoolIdleTimeout(
+    TEXT("ffmpeg.EncoderPool.IdleTimeout"), 60.0f,
+    TEXT("Seconds an opened codec context is kept in the pool without being ")
+        TEXT("used before it is freed. 0 keeps it until shutdown."));
+} // namespace
+
+FFFmpegEncoderPool& FFFmpegEncoderPool::Get() {
+	static FFFmpegEncoderPool Instance;
+	return Instance;
+}
+
+void FFFmpegEncoderPool::Start() {
+	if (TickerHandle.IsValid()) {
+		return;
+	}
+
+	TickerHandle = FTSTicker::GetCoreTicker().AddTicker(
+	    FTickerDelegate::CreateRaw(this, &FFFmpegEncoderPool::Tick), 1.0f);
+}
+
+void FFFmpegEncoderPool::Stop() {
+	if (TickerHandle.IsValid()) {
+		FTSTicker::GetCoreTicker().RemoveTicker(TickerHandle);
+		TickerHandle.Reset();
+	}
+}
+
+void FFFmpegEncoderPool::Prewarm(const FFFmpegEncoderConfig& Config,
+                                 const int32                 Count) {
+	const auto Codec = FFFmpegCodecProfile::FindEncoder(Config);
+	if (nullptr == Codec) {
+		UE_LOG(LogFFmpegEncoder, Error, TEXT("Codec is not found."));
+		return;
+	}
+
+	const auto PixelFormat = FFFmpegCodecProfile::NegotiatePixelFormat(
+	    *Codec, Config.EncodePixelFormat);
+
+	FScopeLock Lock(&IdleContexts_Mutex);
+
+	// run later if deferred
+	if (bDeferPrewarm) {
+		DeferredPrewarms.Add({Config, Count});
+		UE_LOG(LogFFmpegEncoder, Log, TEXT("Prewarming %d encoders is deferred."),
+		       Count);
+		return;
+	}
+
+	// forget tasks that have finished
+	PrewarmTasks.RemoveAll([](const FPrewarmTask& PrewarmTask) {
+		return PrewarmTask.Task.IsCompleted();
+	});
+
+	// open each context on a worker thread
+	for (int32 i = 0; i < Count; ++i) {
+		auto Task = UE::Tasks::Launch(
+		    UE_SOURCE_LOCATION, [this, Config, Codec, PixelFormat] {
+			    FFFmpegPooledCodecContext Context;
+			    Context.Context = FFFmpegCodecProfile::OpenCodecContext(
+			        Config, *Codec, PixelFormat);
+			    if (nullptr != Context.Context) {
+				    Release(Config, Context);
+			    }
+		    });
+		PrewarmTasks.Add({Config, MoveTemp(Task)});
+	}
+}
+
+void FFFmpegEncoderPool::PrewarmIfMissing(const FFFmpegEncoderConfig& Config) {
+	{
+		FScopeLock Lock(&IdleContexts_Mutex);
+		if (HasContextFor(Config)) {
+			return;
+		}
+	}
+
+	Prewarm(Config);
+}
+
+void FFFmpegEncoderPool::SetDeferPrewarm(const bool bDefer) {
+	// take the requests held so far if deferring ends
+	TArray<FDeferredPrewarm> PrewarmsToRun;
+	{
+		FScopeLock Lock(&IdleContexts_Mutex);
+		bDeferPrewarm = bDefer;
+		if (!bDefer) {
+			PrewarmsToRun = MoveTemp(DeferredPrewarms);
+			DeferredPrewarms.Reset();
+		}
+	}
+
+	// run them out of the lock
+	for (const auto& [Config, Count] : PrewarmsToRun) {
+		Prewarm(Config, Count);
+	}
+}
+
+void FFFmpegEncoderPool::ClearDeferredPrewarms() {
+	FScopeLock Lock(&IdleContexts_Mutex);
+	DeferredPrewarms.Reset();
+}
+
+FFFmpegPooledCodecContext
+    FFFmpegEncoderPool::Acquire(const FFFmpegEncoderConfig& Config) {
+	FScopeLock Lock(&IdleContexts_Mutex);
+
+	// take an idle context of the same settings if exists
+	const auto Index = IdleContexts.IndexOfByPredicate(
+	    [&Config](const FIdleContext& IdleContext) {
+		    return FFFmpegCodecProfile::HasSameCodecSettings(IdleContext.Config,
+		                                                     Config);
+	    });
+	if (INDEX_NONE == Index) {
+		++Misses;
+		return {};
+	}
+
+	++Hits;
+	const auto Context = IdleContexts[Index].Context;
+	IdleContexts.RemoveAt(Index);
+	return Context;
+}
+
+void FFFmpegEncoderPool::Release(const FFFmpegEncoderConfig& Config,
+                                 FFFmpegPooledCodecContext   Context) {
+	// keep the context for the next Acquire
+	FFFmpegPooledCodecContext Evicted;
+	{
+		FScopeLock Lock(&IdleContexts_Mutex);
+
+		// the context released least recently makes room
+		if (MaxIdleContexts <= IdleContexts.Num()) {
+			Evicted = IdleContexts[0].Context;
+			IdleContexts.RemoveAt(0);
+		}
+		IdleContexts.Add({Config, Context, FPlatformTime::Seconds()});
+	}
+
+	// free the evicted context out of the lock
+	if (nullptr != Evicted.Context) {
+		avcodec_free_context(&Evicted.Context);
+	}
+}
+
+FFFmpegEncoderPoolStats FFFmpegEncoderPool::GetStats() const {
+	FFFmpegEncoderPoolStats Stats;
+	Stats.Hits   = Hits.load();
+	Stats.Misses = Misses.load();
+
+	FScopeLock Lock(&IdleContexts_Mutex);
+	Stats.NumIdleContexts = IdleContexts.Num();
+
+	return Stats;
+}
+
+void FFFmpegEncoderPool::Empty() {
+	// wait for prewarming contexts, which release into the pool
+	TArray<UE::Tasks::FTask> TasksToWait;
+	{
+		FScopeLock Lock(&IdleContexts_Mutex);
+		for (const auto& PrewarmTask : PrewarmTasks) {
+			TasksToWait.Add(PrewarmTask.Task);
+		}
+		PrewarmTasks.Reset();
+		DeferredPrewarms.Reset();
+	}
+	UE::Tasks::Wait(TasksToWait);
+
+	// take all idle contexts
+	TArray<FIdleContext> ContextsToFree;
+	{
+		FScopeLock Lock(&IdleContexts_Mutex);
+		ContextsToFree = MoveTemp(IdleContexts);
+		IdleContexts.Reset();
+	}
+
+	// free them out of the lock
+	for (auto& IdleContext : ContextsToFree) {
+		avcodec_free_context(&IdleContext.Context.Context);
+	}
+}
+
+bool FFFmpegEncoderPool::Tick(float DeltaTime) {
+	const auto& IdleTimeout = CVarEncoderPoolIdleTimeout.GetValueOnGameThread();
+	if (IdleTimeout <= 0.0f) {
+		return true;
+	}
+
+	// take the contexts idle for too long
+	TArray<FIdleContext> ContextsToFree;
+	{
+		FScopeLock  Lock(&IdleContexts_Mutex);
+		const auto& ExpireTime = FPlatformTime::Seconds() - IdleTimeout;
+		for (int32 Index = 0; Index < IdleContexts.Num();) {
+			if (ExpireTime < IdleContexts[Index].ReleaseTime) {
+				++Index;
+				continue;
+			}
+			ContextsToFree.Add(IdleContexts[Index]);
+			IdleContexts.RemoveAt(Index);
+		}
+	}
+
+	// free them out of the lock
+	for (auto& IdleContext : ContextsToFree) {
+		avcodec_free_context(&IdleContext.Context.Context);
+	}
+
+	return true;
+}
+
+bool FFFmpegEncoderPool::HasContextFor(
+    const FFFmpegEncoderConfig& Config) const {
+	const auto& HasSameSettings = [&Config](const auto& Entry) {
+		return FFFmpegCodecProfile::HasSameCodecSettings(Entry.Config, Config);
+	};
+	const auto& IsOpening = [&](const FPrewarmTask& PrewarmTask) {
+		return !PrewarmTask.Task.IsCompleted() && HasSameSettings(PrewarmTask);
+	};
+	return IdleContexts.ContainsByPredicate(HasSameSettings) ||
+	       PrewarmTasks.ContainsByPredicate(IsOpening) ||
+	       DeferredPrewarms.ContainsByPredicate(HasSameSettings);
+}
@@ -0,0 +1,127 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "FFmpegFramePool.h"
+
+extern "C" {
+#include <libavutil/imgutils.h>
+}
+
+struct FFFmpegFramePool::FBufferHolder {
+	// reference to the buffer of AVBufferPool
+	AVBufferRef* PoolBuffer = nullptr;
+
+	// keeps the pool alive while frames reference the buffer
+	TSharedRef<FFFmpegFramePool, ESPMode::ThreadSafe> Pool;
+};
+
+FFFmpegFramePool::FFFmpegFramePool(const AVPixelFormat InFormat,
+                                   const int32         InWidth,
+                                   const int32         InHeight)
+    : Format(InFormat), Width(InWidth), Height(InHeight) {
+	// rows are aligned same as av_frame_get_buffer
+	if (av_image_fill_linesizes(LineSizes, Format, FFALIGN(Width, Alignment)) <
+	    0) {
+		return;
+	}
+	ptrdiff_t AlignedLineSizes[4];
+	for (int32 Plane = 0; Plane < 4; ++Plane) {
+		LineSizes[Plane]        = FFALIGN(LineSizes[Plane], Alignment);
+		AlignedLineSizes[Plane] = LineSizes[Plane];
+	}
+
+	// size of each plane
+	size_t PlaneSizes[4];
+	if (av_image_fill_plane_sizes(PlaneSizes, Format, Height, AlignedLineSizes) <
+	    0) {
+		return;
+	}
+
+	// planes are placed in a single buffer
+	for (int32 Plane = 0; Plane < 4; ++Plane) {
+		PlaneOffsets[Plane] = BufferSize;
+		BufferSize += FFALIGN(PlaneSizes[Plane], Alignment);
+	}
+
+	// padding for readers that overread the last row
+	BufferSize += Alignment;
+
+	Pool = av_buffer_pool_init2(BufferSize, this, &AllocateBuffer, nullptr);
+}
+
+FFFmpegFramePool::~FFFmpegFramePool() {
+	// every buffer has been returned because they keep this pool alive
+	av_buffer_pool_uninit(&Pool);
+}
+
+bool FFFmpegFramePool::Matches(const AVPixelFormat InFormat,
+                               const int32         InWidth,
+                               const int32 InHeight) const noexcept {
+	return Format == InFormat && Width == InWidth && Height == InHeight;
+}
+
+bool FFFmpegFramePool::GetBuffer(AVFrame& Frame) {
+	check(nullptr == Frame.buf[0]);
+
+	if (nullptr == Pool) {
+		return false;
+	}
+
+	// take a buffer from the pool
+	AVBufferRef* PoolBuffer = av_buffer_pool_get(Pool);
+	if (nullptr == PoolBuffer) {
+		return false;
+	}
+
+	// wrap it to know when frames release it
+	const auto& Holder = new FBufferHolder{PoolBuffer, AsShared()};
+	Frame.buf[0] = av_buffer_create(PoolBuffer->data, PoolBuffer->size,
+	                                &ReleaseBuffer, Holder, 0);
+	if (nullptr == Frame.buf[0]) {
+		av_buffer_unref(&Holder->PoolBuffer);
+		delete Holder;
+		return false;
+	}
+
+	// update counters
+	const auto& InUse    = ++NumBuffersInUse;
+	auto        MaxInUse = MaxBuffersInUse.load();
+	while (InUse > MaxInUse &&
+	       !MaxBuffersInUse.compare_exchange_weak(MaxInUse, InUse)) {
+	}
+
+	// set planes
+	Frame.format = Format;
+	Frame.width  = Width;
+	Frame.height = Height;
+	for (int32 Plane = 0; Plane < 4 && LineSizes[Plane] > 0; ++Plane) {
+		Frame.data[Plane]     = Frame.buf[0]->data + PlaneOffsets[Plane];
+		Frame.linesize[Plane] = LineSizes[Plane];
+	}
+
+	return true;
+}
+
+FFFmpegFramePoolStats FFFmpegFramePool::GetStats() const {
+	FFFmpegFramePoolStats Stats;
+	Stats.NumBuffers      = NumBuffers.load();
+	Stats.NumBuffersInUse = NumBuffersInUse.load();
+	Stats.MaxBuffersInUse = MaxBuffersInUse.load();
+	Stats.BufferSize      = BufferSize;
+	return Stats;
+}
+
+AVBufferRef* FFFmpegFramePool::AllocateBuffer(void* Opaque, const size_t Size) {
+	const auto& Self = static_cast<FFFmpegFramePool*>(Opaque);
+	++Self->NumBuffers;
+	return av_buffer_alloc(Size);
+}
+
+void FFFmpegFramePool::ReleaseBuffer(void* Opaque, uint8_t*) {
+	const auto& Holder = static_cast<FBufferHolder*>(Opaque);
+	--Holder->Pool->NumBuffersInUse;
+
+	// return the buffer to AVBufferPool. the pool may be destroyed by deleting
+	// Holder.
+	av_buffer_unref(&Holder->PoolBuffer);
+	delete Holder;
+}
@@ -0,0 +1,299 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "FFmpegGPUConversion.h"
+
+#include "FFmpegPixelConversion.h"
+#include "FFmpegReadbackPoller.h"
+#include "GlobalShader.h"
+#include "LogFFmpegEncoder.h"
+#include "RHIGPUReadback.h"
+#include "RenderGraphBuilder.h"
+#include "RenderGraphUtils.h"
+#include "ShaderParameterStruct.h"
+
+namespace {
+TAutoConsoleVariable<bool> CVarGPUConversionValidate(
+    TEXT("ffmpeg.GPUConversion.Validate"), false,
+    TEXT("If true, the source of every frame converted by the compute shader ")
+        TEXT("is also read back and converted on the CPU, and the results are ")
+        TEXT("compared and logged."));
+
+/**
+ * Compute shader that writes Y, U and V planes of an 8-bit RGB texture
+ */
+class FFFmpegRGBToYUV420CS: public FGlobalShader {
+public:
+	DECLARE_GLOBAL_SHADER(FFFmpegRGBToYUV420CS);
+	SHADER_USE_PARAMETER_STRUCT(FFFmpegRGBToYUV420CS, FGlobalShader);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+	SHADER_PARAMETER_RDG_TEXTURE(Texture2D<float4>, SourceTexture)
+	SHADER_PARAMETER_RDG_TEXTURE_UAV(RWTexture2D<uint>, OutputY)
+	SHADER_PARAMETER_RDG_TEXTURE_UAV(RWTexture2D<uint>, OutputU)
+	SHADER_PARAMETER_RDG_TEXTURE_UAV(RWTexture2D<uint>, OutputV)
+	SHADER_PARAMETER(FIntPoint, SourceSize)
+	END_SHADER_PARAMETER_STRUCT()
+
+	// chroma samples per side of a thread group
+	static constexpr int32 ThreadGroupSize = 8;
+
+	static void ModifyCompilationEnvironment(
+	    const FGlobalShaderPermutationParameters& Parameters,
+	    FShaderCompilerEnvironment&               OutEnvironment) {
+		FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+		OutEnvironment.SetDefine(TEXT("THREADGROUP_SIZE"), ThreadGroupSize);
+	}
+};
+
+IMPLEMENT_GLOBAL_SHADER(FFFmpegRGBToYUV420CS,
+                        "/Plugin/BlueprintFFmpeg/Private/FFmpegRGBToYUV420.usf",
+                        "MainCS", SF_Compute);
+
+/**
+ * @return   format of the pixels of PixelFormat as read back, or
+ *           AV_PIX_FMT_NONE if the compute shader does not support it.
+ */
+AVPixelFormat FFmpegFormatOf(const EPixelFormat PixelFormat) {
+	switch (PixelFormat) {
+	case PF_B8G8R8A8:
+		return AV_PIX_FMT_BGRA;
+	case PF_R8G8B8A8:
+		return AV_PIX_FMT_RGBA;
+	default:
+		return AV_PIX_FMT_NONE;
+	}
+}
+
+/**
+ * Readbacks of a frame converted by the compute shader
+ */
+struct FPlaneReadbacks {
+	FRHIGPUTextureReadback Y{TEXT("FFmpegGPUConversionY")};
+	FRHIGPUTextureReadback U{TEXT("FFmpegGPUConversionU")};
+	FRHIGPUTextureReadback V{TEXT("FFmpegGPUConversionV")};
+	FRHIGPUTextureReadback Source{TEXT("FFmpegGPUConversionSource")};
+};
+
+/**
+ * Copy the mapped staging buffer of a plane into a plane of a frame.
+ */
+void CopyReadbackToPlane(FRHIGPUTextureReadback& Readback, uint8* Dst,
+                         const int32 DstLineSize, const int32 Width,
+                         const int32 Height) {
+	// map staging buffer. 1 byte per pixel.
+	int32       RowPitch = 0;
+	const auto& Src = static_cast<const uint8*>(Readback.Lock(RowPitch));
+
+	for (int32 Row = 0; Row < Height; ++Row) {
+		FMemory::Memcpy(Dst + int64(Row) * DstLineSize,
+		                Src + int64(Row) * RowPitch, Width);
+	}
+
+	Readback.Unlock();
+}
+
+/**
+ * Convert the source pixels on the CPU and compare them with Frame.
+ */
+void ValidateAgainstCPU(FRHIGPUTextureReadback& SourceReadback,
+                        const AVPixelFormat SourceFormat, const AVFrame& Frame) {
+	// map source pixels. 4 bytes per pixel.
+	int32       RowPitchInPixels = 0;
+	const auto& SrcData =
+	    static_cast<const uint8*>(SourceReadback.Lock(RowPitchInPixels));
+
+	// convert on the CPU
+	auto* ExpectedFrame   = av_frame_alloc();
+	ExpectedFrame->format = Frame.format;
+	ExpectedFrame->width  = Frame.width;
+	ExpectedFrame->height = Frame.height;
+	if (av_frame_get_buffer(ExpectedFrame, 0) < 0 ||
+	    !FFFmpegPixelConversion::Convert(SrcData, int64(RowPitchInPixels) * 4,
+	                                     SourceFormat, *ExpectedFrame)) {
+		SourceReadback.Unlock();
+		av_frame_free(&ExpectedFrame);
+		UE_LOG(LogFFmpegEncoder, Warning,
+		       TEXT("GPU conversion validation: failed to convert on the CPU."));
+		return;
+	}
+
+	SourceReadback.Unlock();
+
+	// count samples that differ
+	int64 NumMismatches = 0;
+	for (int32 Plane = 0; Plane < 3; ++Plane) {
+		const auto& Width  = 0 == Plane ? Frame.width : (Frame.width + 1) / 2;
+		const auto& Height = 0 == Plane ? Frame.height : (Frame.height + 1) / 2;
+		for (int32 Row = 0; Row < Height; ++Row) {
+			const auto& Actual =
+			    Frame.data[Plane] + int64(Row) * Frame.linesize[Plane];
+			const auto& Expected = ExpectedFrame->data[Plane] +
+			                       int64(Row) * ExpectedFrame->linesize[Plane];
+			for (int32 X = 0; X < Width; ++X) {
+				NumMismatches += Actual[X] != Expected[X];
+			}
+		}
+	}
+
+	av_frame_free(&ExpectedFrame);
+
+	if (0 < NumMismatches) {
+		UE_LOG(LogFFmpegEncoder, Warning,
+		       TEXT("GPU conversion validation: %lld samples differ from the CPU ")
+		           TEXT("conversion."),
+		       NumMismatches);
+	} else {
+		UE_LOG(LogFFmpegEncoder, Verbose,
+		       TEXT("GPU conversion validation: identical to the CPU conversion."));
+	}
+}
+} // namespace
+
+bool FFFmpegGPUConversion::IsSupported(const FTextureRHIRef& TextureRHI,
+                                       const AVPixelFormat   PixelFormat,
+                                       const int32           FrameWidth,
+                                       const int32           FrameHeight) {
+	// get description of source texture RHI
+	const auto& Desc = TextureRHI->GetDesc();
+
+	// the shader does not scale, and sRGB views would return linear values
+	return AV_PIX_FMT_YUV420P == PixelFormat &&
+	       AV_PIX_FMT_NONE != FFmpegFormatOf(Desc.Format) &&
+	       !EnumHasAnyFlags(Desc.Flags, TexCreate_SRGB) &&
+	       Desc.Extent == FIntPoint(FrameWidth, FrameHeight);
+}
+
+UE::Tasks::TTask<FFFmpegFrameThreadSafeSharedPtr>
+    FFFmpegGPUConversion::ConvertAsync(FTextureRHIRef TextureRHI,
+                                       const int      FrameIndex,
+                                       const FFFmpegConversionOptions& Options) {
+	namespace Tasks = UE::Tasks;
+
+	// get description of source texture RHI
+	const auto& Desc   = TextureRHI->GetDesc();
+	const auto& Extent = Desc.Extent;
+
+	// initialize frame
+	FFFmpegFrameThreadSafeSharedPtr FFmpegFrame;
+	const auto&                     RawFrame = FFmpegFrame.Get();
+	RawFrame->pts    = FrameIndex;
+	RawFrame->format = AV_PIX_FMT_YUV420P;
+	RawFrame->width  = Extent.X;
+	RawFrame->height = Extent.Y;
+
+	// initialize frame buffer, from the pool if possible. without a buffer
+	// the frame is not encoded.
+	if (const auto& FramePool = Options.FramePool;
+	    FramePool.IsValid() &&
+	    FramePool->Matches(AV_PIX_FMT_YUV420P, Extent.X, Extent.Y)) {
+		if (!FramePool->GetBuffer(*RawFrame)) {
+			UE_LOG(LogFFmpegEncoder, Error,
+			       TEXT("Failed to get AVFrame buffer from pool"));
+			return Tasks::MakeCompletedTask<FFFmpegFrameThreadSafeSharedPtr>(
+			    nullptr);
+		}
+	} else if (av_frame_get_buffer(RawFrame, 0) < 0) {
+		UE_LOG(LogFFmpegEncoder, Error,
+		       TEXT("Failed to allocate AVFrame buffer"));
+		return Tasks::MakeCompletedTask<FFFmpegFrameThreadSafeSharedPtr>(nullptr);
+	}
+
+	// signaled when the frame is filled
+	Tasks::FTaskEvent Converted(UE_SOURCE_LOCATION);
+
+	// On Render Thread
+	ENQUEUE_RENDER_COMMAND(FFmpegGPUConversion)
+	([TextureRHI = MoveTemp(TextureRHI), FFmpegFrame, Converted,
+	  bValidate = CVarGPUConversionValidate.GetValueOnGameThread()](
+	     FRHICommandListImmediate& RHICmdList) mutable {
+		const auto& Extent       = TextureRHI->GetDesc().Extent;
+		const auto& ChromaSize   = FIntPoint::DivideAndRoundUp(Extent, 2);
+		const auto& SourceFormat = FFmpegFormatOf(TextureRHI->GetDesc().Format);
+
+		// kept until the planes are copied to the frame
+		const auto& Readbacks = MakeShared<FPlaneReadbacks>();
+
+		// build the graph: convert, then copy each plane to staging buffers
+		{
+			FRDGBuilder GraphBuilder(RHICmdList);
+
+			const auto& Source = GraphBuilder.RegisterExternalTexture(
+			    CreateRenderTarget(TextureRHI, TEXT("FFmpegGPUConversionSource")));
+
+			const auto& CreatePlane = [&](const FIntPoint& Size,
+			                              const TCHAR*     Name) {
+				return GraphBuilder.CreateTexture(
+				    FRDGTextureDesc::Create2D(Size, PF_R8_UINT,
+				                              FClearValueBinding::None,
+				                              TexCreate_ShaderResource |
+				                                  TexCreate_UAV),
+				    Name);
+			};
+			const auto& PlaneY = CreatePlane(Extent, TEXT("FFmpegPlaneY"));
+			const auto& PlaneU = CreatePlane(ChromaSize, TEXT("FFmpegPlaneU"));
+			const auto& PlaneV = CreatePlane(ChromaSize, TEXT("FFmpegPlaneV"));
+
+			auto* const Parameters =
+			    GraphBuilder.AllocParameters<FFFmpegRGBToYUV420CS::FParameters>();
+			Parameters->SourceTexture = Source;
+			Parameters->OutputY       = GraphBuilder.CreateUAV(PlaneY);
+			Parameters->OutputU       = GraphBuilder.CreateUAV(PlaneU);
+			Parameters->OutputV       = GraphBuilder.CreateUAV(PlaneV);
+			Parameters->SourceSize    = Extent;
+
+			const TShaderMapRef<FFFmpegRGBToYUV420CS> ComputeShader(
+			    GetGlobalShaderMap(GMaxRHIFeatureLevel));
+			FComputeShaderUtils::AddPass(
+			    GraphBuilder, RDG_EVENT_NAME("FFmpegRGBToYUV420"), ComputeShader,
+			    Parameters,
+			    FComputeShaderUtils::GetGroupCount(
+			        ChromaSize, FFFmpegRGBToYUV420CS::ThreadGroupSize));
+
+			AddEnqueueCopyPass(GraphBuilder, &Readbacks->Y, PlaneY);
+			AddEnqueueCopyPass(GraphBuilder, &Readbacks->U, PlaneU);
+			AddEnqueueCopyPass(GraphBuilder, &Readbacks->V, PlaneV);
+			if (bValidate) {
+				AddEnqueueCopyPass(GraphBuilder, &Readbacks->Source, Source);
+			}
+
+			GraphBuilder.Execute();
+		}
+
+		// copy the planes to the frame once the copies have completed,
+		// without waiting for them here
+		TArray<FRHIGPUReadback*, TInlineAllocator<4>> PendingReadbacks = {
+		    &Readbacks->Y, &Readbacks->U, &Readbacks->V};
+		if (bValidate) {
+			PendingReadbacks.Add(&Readbacks->Source);
+		}
+		FFFmpegReadbackPoller::Get().Add(
+		    PendingReadbacks,
+		    [Readbacks, FFmpegFrame, Converted, Extent, ChromaSize, bValidate,
+		     SourceFormat]() mutable {
+			    const auto& RawFrame = FFmpegFrame.Get();
+
+			    // copy planes to the frame
+			    CopyReadbackToPlane(Readbacks->Y, RawFrame->data[0],
+			                        RawFrame->linesize[0], Extent.X, Extent.Y);
+			    CopyReadbackToPlane(Readbacks->U, RawFrame->data[1],
+			                        RawFrame->linesize[1], ChromaSize.X,
+			                        ChromaSize.Y);
+			    CopyReadbackToPlane(Readbacks->V, RawFrame->data[2],
+			                        RawFrame->linesize[2], ChromaSize.X,
+			                        ChromaSize.Y);
+
+			    // compare with the CPU conversion
+			    if (bValidate) {
+				    ValidateAgainstCPU(Readbacks->Source, SourceFormat, *RawFrame);
+			    }
+
+			    // the frame is ready
+			    Converted.Trigger();
+		    });
+	});
+
+	// the task runs only after the frame is filled, so it never waits
+	return Tasks::Launch(
+	    UE_SOURCE_LOCATION, [FFmpegFrame]() { return FFmpegFrame; }, Converted,
+	    Options.TaskPriority);
+}
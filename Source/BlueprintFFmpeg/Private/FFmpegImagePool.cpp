@@ -0,0 +1,75 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "FFmpegImagePool.h"
+
+FFFmpegImagePool& FFFmpegImagePool::Get() {
+	static FFFmpegImagePool Instance;
+	return Instance;
+}
+
+FImage FFFmpegImagePool::Acquire(const int32                 Width,
+                                 const int32                 Height,
+                                 const ERawImageFormat::Type Format,
+                                 const EGammaSpace           GammaSpace) {
+	const FFFmpegImagePoolKey Key{Width, Height, Format};
+
+	// take an idle image if exists
+	{
+		FScopeLock Lock(&IdleImages_Mutex);
+
+		if (const auto& Images = IdleImages.Find(Key);
+		    nullptr != Images && !Images->IsEmpty()) {
+			++Hits;
+			FImage Image     = Images->Pop();
+			Image.GammaSpace = GammaSpace;
+			return Image;
+		}
+	}
+
+	// otherwise allocate a new image out of the lock
+	++Misses;
+	return FImage(Width, Height, Format, GammaSpace);
+}
+
+void FFFmpegImagePool::Release(FImage&& Image) {
+	const FFFmpegImagePoolKey Key{Image.GetWidth(), Image.GetHeight(),
+	                              Image.Format};
+
+	// the storage must still match its size and format
+	if (Image.RawData.Num() != Image.GetImageSizeBytes()) {
+		return;
+	}
+
+	FScopeLock Lock(&IdleImages_Mutex);
+
+	// keep the image for the next Acquire
+	auto& Images = IdleImages.FindOrAdd(Key);
+	if (Images.Num() < MaxIdleImagesPerKey) {
+		Images.Push(MoveTemp(Image));
+	}
+}
+
+FFFmpegImagePoolStats FFFmpegImagePool::GetStats() const {
+	FFFmpegImagePoolStats Stats;
+	Stats.Hits   = Hits.load();
+	Stats.Misses = Misses.load();
+
+	FScopeLock Lock(&IdleImages_Mutex);
+	for (const auto& [Key, Images] : IdleImages) {
+		Stats.NumIdleImages += Images.Num();
+	}
+
+	return Stats;
+}
+
+void FFFmpegImagePool::Empty() {
+	// take all idle images
+	TMap<FFFmpegImagePoolKey, TArray<FImage>> ImagesToFree;
+	{
+		FScopeLock Lock(&IdleImages_Mutex);
+		ImagesToFree = MoveTemp(IdleImages);
+		IdleImages.Reset();
+	}
+
+	// free them out of the lock
+}
@@ -0,0 +1,263 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "FFmpegMultiRenditionEncoder.h"
+
+#include "CreateImageFromTextureRHI.h"
+#include "FFmpegEncodeGovernor.h"
+#include "HAL/FileManager.h"
+#include "ImageUtils.h"
+
+namespace {
+/**
+ * @return   how bad Result is. The result of adding a frame to several
+ *           renditions is the worst one.
+ */
+int32 SeverityOf(const FFmpegEncoderAddFrameResult Result) {
+	switch (Result) {
+	case FFmpegEncoderAddFrameResult::Failure:
+		return 3;
+	case FFmpegEncoderAddFrameResult::Dropped:
+		return 2;
+	case FFmpegEncoderAddFrameResult::Duplicated:
+		return 1;
+	default:
+		return 0;
+	}
+}
+} // namespace
+
+void UFFmpegMultiRenditionEncoder::Open(
+    const TArray<FFFmpegRendition>& Renditions,
+    FFmpegEncoderOpenResult& Result, FString& ErrorMessage) {
+	// helper function to finish with failure
+	const auto& Failure = [&](const FString& Message) {
+		ErrorMessage = Message;
+		UE_LOG(LogFFmpegEncoder, Error, TEXT("%s"), *ErrorMessage);
+		Result = FFmpegEncoderOpenResult::Failure;
+	};
+
+	// Open function must be called only once.
+	checkf(!bOpened, TEXT("Open function has already been called once."));
+
+	// Mark as opened
+	bOpened = true;
+
+	if (Renditions.IsEmpty()) {
+		return Failure("No renditions are specified.");
+	}
+
+	// the conversion shared by all renditions runs at the highest priority
+	// among them
+	Priority = EFFmpegEncoderPriority::Low;
+	for (const auto& Rendition : Renditions) {
+		Priority = FMath::Max(Priority, Rendition.Config.Priority);
+	}
+
+	// larger renditions first, so that every rendition can be scaled from one
+	// opened before it
+	TArray<int32> Order;
+	for (int32 Index = 0; Index < Renditions.Num(); ++Index) {
+		Order.Add(Index);
+	}
+	Order.StableSort([&](const int32 A, const int32 B) {
+		const auto& ConfigA = Renditions[A].Config;
+		const auto& ConfigB = Renditions[B].Config;
+		return int64(ConfigA.Width) * ConfigA.Height >
+		       int64(ConfigB.Width) * ConfigB.Height;
+	});
+
+	// helper function to close the renditions already opened and remove
+	// their outputs, so that a failed Open leaves no partial set behind
+	TArray<FString> OpenedPaths;
+	const auto&     Rollback = [&]() {
+		for (auto& Node : Nodes) {
+			Node.Encoder->Close();
+
+			// the output is written until the encoder is destroyed
+			Node.Encoder.Reset();
+		}
+		Nodes.Empty();
+
+		for (const auto& Path : OpenedPaths) {
+			IFileManager::Get().Delete(*Path);
+		}
+	};
+
+	for (const auto& Index : Order) {
+		const auto& Rendition = Renditions[Index];
+
+		// open the encoder of this rendition
+		FRenditionNode Node;
+		Node.Encoder = MakeUnique<FFFmpegEncodeThread>();
+		Node.Encoder->Open(Rendition.Config, Rendition.OutputFilePath, Result,
+		                   ErrorMessage);
+		if (FFmpegEncoderOpenResult::Success != Result) {
+			return Rollback();
+		}
+		OpenedPaths.Add(Rendition.OutputFilePath);
+		Node.Width       = Rendition.Config.Width;
+		Node.Height      = Rendition.Config.Height;
+		Node.FrameFormat = Node.Encoder->GetFrameFormat();
+
+		// frames of this rendition are converted into its own pool
+		Node.ConversionOptions =
+		    FFFmpegConversionOptions::FromConfig(Rendition.Config);
+		Node.ConversionOptions.FramePool =
+		    MakeShared<FFFmpegFramePool, ESPMode::ThreadSafe>(
+		        Node.FrameFormat, Node.Width, Node.Height);
+
+		// scale from the smallest rendition that covers this one
+		for (int32 Parent = 0; Parent < Nodes.Num(); ++Parent) {
+			const auto& Candidate = Nodes[Parent];
+			if (Candidate.Width < Node.Width || Candidate.Height < Node.Height) {
+				continue;
+			}
+			if (INDEX_NONE == Node.Parent ||
+			    int64(Candidate.Width) * Candidate.Height <=
+			        int64(Nodes[Node.Parent].Width) * Nodes[Node.Parent].Height) {
+				Node.Parent = Parent;
+			}
+		}
+
+		// every rendition other than the largest has a parent
+		if (!Nodes.IsEmpty() && INDEX_NONE == Node.Parent) {
+			Node.Parent = 0;
+		}
+
+		Nodes.Add(MoveTemp(Node));
+	}
+
+	// finish as success
+	Result = FFmpegEncoderOpenResult::Success;
+}
+
+void UFFmpegMultiRenditionEncoder::Close() {
+	// Open function must be called
+	ensureMsgf(bOpened, TEXT("You called Close function even though you didn't "
+	                         "call Open function."));
+
+	// and Close function must not be called.
+	checkf(!bClosed, TEXT("Close function has already been called once."));
+
+	// Mark as closed
+	bClosed = true;
+
+	for (auto& Node : Nodes) {
+		Node.Encoder->Close();
+	}
+}
+
+void UFFmpegMultiRenditionEncoder::AddFrameFromRenderTarget(
+    const UTextureRenderTarget2D* TextureRenderTarget,
+    FFmpegEncoderAddFrameResult& Result, FString& ErrorMessage) {
+	// helper function to finish with failure
+	const auto& Failure = [&](const FString& Message) {
+		ErrorMessage = Message;
+		UE_LOG(LogFFmpegEncoder, Error, TEXT("%s"), *ErrorMessage);
+		Result = FFmpegEncoderAddFrameResult::Failure;
+	};
+
+	// check TextureRenderTarget
+	check(nullptr != TextureRenderTarget);
+
+	// get TextureResource
+	const auto& TextureResource = TextureRenderTarget->GetResource();
+	if (nullptr == TextureResource) {
+		return Failure("TextureResource is nullptr");
+	}
+
+	// get RHITexture
+	const auto& RHITexture = TextureResource->GetTexture2DRHI();
+	if (nullptr == RHITexture) {
+		return Failure("RHITexture is nullptr");
+	}
+
+	// read back once for every rendition
+	return AddFrame(CreateImageFromTextureRHIAsync(FTextureRHIRef(RHITexture)),
+	                Result, ErrorMessage);
+}
+
+void UFFmpegMultiRenditionEncoder::AddFrameFromImagePath(
+    const FString& ImagePath, FFmpegEncoderAddFrameResult& Result,
+    FString& ErrorMessage) {
+	// Load image from ImagePath
+	FImage Image;
+	if (!FImageUtils::LoadImage(*ImagePath, Image)) {
+		ErrorMessage = TEXT("Failed to load image.");
+		UE_LOG(LogFFmpegEncoder, Error, TEXT("%s"), *ErrorMessage);
+		Result = FFmpegEncoderAddFrameResult::Failure;
+		return;
+	}
+
+	return AddFrame(UE::Tasks::MakeCompletedTask<FImage>(MoveTemp(Image)),
+	                Result, ErrorMessage);
+}
+
+void UFFmpegMultiRenditionEncoder::AddFrame(
+    const TTask_Image& ImageTask, FFmpegEncoderAddFrameResult& Result,
+    FString& ErrorMessage) {
+	// Open function must be called
+	checkf(bOpened && !Nodes.IsEmpty(),
+	       TEXT("Before calling this function, Open function must be called."));
+
+	// and Close function must not be called.
+	checkf(!bClosed, TEXT("Once Close function is called, this function can "
+	                      "no longer be called."));
+
+	// conversion tasks run at the priority the governor allows now
+	const auto& TaskPriority =
+	    FFFmpegEncodeGovernor::Get().GetTaskPriority(Priority);
+	for (auto& Node : Nodes) {
+		Node.ConversionOptions.TaskPriority = TaskPriority;
+	}
+
+	// launch a task per rendition. the largest rendition is converted from
+	// the image, the others are scaled from their parents.
+	TArray<TTask_Frame> FrameTasks;
+	for (const auto& Node : Nodes) {
+		if (INDEX_NONE == Node.Parent) {
+			FrameTasks.Add(UE::Tasks::Launch(
+			    UE_SOURCE_LOCATION,
+			    [ImageTask, FrameIndex = FrameIndex, Width = Node.Width,
+			     Height = Node.Height, PixelFormat = Node.FrameFormat,
+			     Options = Node.ConversionOptions]() {
+				    return UFFmpegUtils::CreateFrame<ESPMode::ThreadSafe>(
+				        ImageTask, FrameIndex, Width, Height, PixelFormat,
+				        Options);
+			    },
+			    UE::Tasks::Prerequisites(ImageTask),
+			    TaskPriority));
+		} else {
+			FrameTasks.Add(UE::Tasks::Launch(
+			    UE_SOURCE_LOCATION,
+			    [ParentTask = FrameTasks[Node.Parent], Width = Node.Width,
+			     Height = Node.Height, PixelFormat = Node.FrameFormat,
+			     Options = Node.ConversionOptions]() {
+				    const auto& Parent = ParentTask.GetResult();
+				    if (!Parent) {
+					    return FFFmpegFrameThreadSafeSharedPtr(nullptr);
+				    }
+				    return UFFmpegUtils::ScaleFrame<ESPMode::ThreadSafe>(
+				        *Parent, Width, Height, PixelFormat, Options);
+			    },
+			    UE::Tasks::Prerequisites(FrameTasks[Node.Parent]),
+			    TaskPriority));
+		}
+	}
+
+	// next frame index
+	++FrameIndex;
+
+	// hand the frames to the encoders and keep the worst result
+	Result = FFmpegEncoderAddFrameResult::Success;
+	for (int32 Index = 0; Index < Nodes.Num(); ++Index) {
+		FFmpegEncoderAddFrameResult NodeResult;
+		FString                     NodeErrorMessage;
+		Nodes[Index].Encoder->AddFrame(TTask_Frame(FrameTasks[Index]), NodeResult,
+		                               NodeErrorMessage);
+		if (SeverityOf(Result) < SeverityOf(NodeResult)) {
+			Result       = NodeResult;
+			ErrorMessage = NodeErrorMessage;
+		}
+	}
+}
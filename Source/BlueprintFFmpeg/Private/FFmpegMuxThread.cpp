@@ -0,0 +1,197 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "FFmpegMuxThread.h"
+
+#include "HAL/RunnableThread.h"
+
+void FFFmpegStageTimer::Begin() noexcept {
+	BeginCycles = FPlatformTime::Cycles64();
+	EndCycles   = 0;
+	BusyCycles  = 0;
+}
+
+void FFFmpegStageTimer::End() noexcept {
+	EndCycles = FPlatformTime::Cycles64();
+}
+
+void FFFmpegStageTimer::AddBusyCycles(const uint64 Cycles) noexcept {
+	BusyCycles += Cycles;
+}
+
+double FFFmpegStageTimer::GetUtilization() const noexcept {
+	const uint64 Begin = BeginCycles;
+	if (0 == Begin) {
+		return 0.0;
+	}
+
+	// the stage may still be running
+	const uint64 End =
+	    0 != EndCycles ? EndCycles.load() : FPlatformTime::Cycles64();
+	if (End <= Begin) {
+		return 0.0;
+	}
+
+	return FMath::Min(1.0, double(BusyCycles) / double(End - Begin));
+}
+
+FFFmpegMuxThread::FFFmpegMuxThread(AVFormatContext*   InFormatContext,
+                                   const int32        InMaxQueuedPackets,
+                                   FFFmpegStageTimer& InStageTimer)
+    : FormatContext(InFormatContext),
+      MaxQueuedPackets(FMath::Max(1, InMaxQueuedPackets)),
+      StageTimer(InStageTimer) {}
+
+FFFmpegMuxThread::~FFFmpegMuxThread() {
+	if (Thread) {
+		// wait to finish thread
+		Thread->Kill(true);
+
+		// release memory for Thread
+		delete Thread;
+	}
+
+	// free packets that were never written
+	for (auto& Packet : Packets) {
+		av_packet_free(&Packet);
+	}
+}
+
+bool FFFmpegMuxThread::Start() {
+	Thread = FRunnableThread::Create(this, TEXT("FFmpeg mux thread"));
+	return nullptr != Thread;
+}
+
+void FFFmpegMuxThread::StartInline() {
+	bInline = true;
+	StageTimer.Begin();
+}
+
+bool FFFmpegMuxThread::Push(AVPacket& Packet) {
+	// packets after a failed write are discarded
+	if (bFailed) {
+		av_packet_unref(&Packet);
+		return false;
+	}
+
+	// write on the calling thread. this un references Packet.
+	if (bInline) {
+		const auto& BeginCycles = FPlatformTime::Cycles64();
+		if (av_interleaved_write_frame(FormatContext, &Packet) != 0) {
+			bFailed = true;
+		}
+		StageTimer.AddBusyCycles(FPlatformTime::Cycles64() - BeginCycles);
+		av_packet_unref(&Packet);
+		return !bFailed;
+	}
+
+	// take the reference of Packet
+	auto QueuedPacket = av_packet_alloc();
+	if (nullptr == QueuedPacket) {
+		return false;
+	}
+	av_packet_move_ref(QueuedPacket, &Packet);
+
+	{
+		// wait while the queue is full
+		std::unique_lock lk(Packets_mutex);
+		Packets_cv.wait(lk, [&]() {
+			return Packets.Num() < MaxQueuedPackets || bFailed;
+		});
+
+		// the write failed while waiting
+		if (bFailed) {
+			lk.unlock();
+			av_packet_free(&QueuedPacket);
+			return false;
+		}
+
+		// enqueue
+		Packets.Add(QueuedPacket);
+		PeakQueuedPackets = FMath::Max(PeakQueuedPackets.load(), Packets.Num());
+	}
+
+	// notify the mux thread
+	Packets_cv.notify_all();
+
+	return !bFailed;
+}
+
+bool FFFmpegMuxThread::Finish() {
+	// every packet has already been written
+	if (bInline) {
+		StageTimer.End();
+		return !bFailed;
+	}
+
+	// stop after writing all packets
+	Stop();
+
+	if (Thread) {
+		// wait to finish thread
+		Thread->WaitForCompletion();
+
+		// release memory for Thread
+		delete Thread;
+		Thread = nullptr;
+	}
+
+	return !bFailed;
+}
+
+int32 FFFmpegMuxThread::GetMaxQueuedPackets() const noexcept {
+	return PeakQueuedPackets;
+}
+
+uint32 FFFmpegMuxThread::Run() {
+	StageTimer.Begin();
+
+	// packets taken from the queue at once
+	TArray<AVPacket*> Batch;
+
+	while (true) {
+		{
+			// Wait for finish or push to Packets
+			std::unique_lock lk(Packets_mutex);
+			Packets_cv.wait(lk,
+			                [&]() { return bFinishing || !Packets.IsEmpty(); });
+
+			// finish once all packets are written
+			if (Packets.IsEmpty()) {
+				break;
+			}
+
+			// take all queued packets
+			Swap(Batch, Packets);
+		}
+
+		// the queue has room again
+		Packets_cv.notify_all();
+
+		// write packets in order
+		for (auto& Packet : Batch) {
+			if (!bFailed) {
+				const auto& BeginCycles = FPlatformTime::Cycles64();
+				if (av_interleaved_write_frame(FormatContext, Packet) != 0) {
+					bFailed = true;
+				}
+				StageTimer.AddBusyCycles(FPlatformTime::Cycles64() - BeginCycles);
+			}
+			av_packet_free(&Packet);
+		}
+		Batch.Reset();
+	}
+
+	StageTimer.End();
+
+	return bFailed ? 1 : 0;
+}
+
+void FFFmpegMuxThread::Stop() {
+	{
+		std::lock_guard lk(Packets_mutex);
+		bFinishing = true;
+	}
+
+	// notify the mux thread to finish
+	Packets_cv.notify_all();
+}
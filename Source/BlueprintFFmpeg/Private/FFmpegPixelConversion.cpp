@@ -0,0 +1,1287 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "FFmpegPixelConversion.h"
+
+#if PLATFORM_CPU_X86_FAMILY
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// enable an instruction set for a single function on compilers that need it
+#if defined(__clang__) || defined(__GNUC__)
+#define FFMPEG_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define FFMPEG_TARGET_AVX2  __attribute__((target("avx2")))
+#define FFMPEG_TARGET_AVX2_F16C __attribute__((target("avx2,f16c")))
+#else
+#define FFMPEG_TARGET_SSE41
+#define FFMPEG_TARGET_AVX2
+#define FFMPEG_TARGET_AVX2_F16C
+#endif
+
+namespace {
+#pragma region coefficients
+// BT.601 limited range coefficients in 1.15 fixed point.
+// The coefficients of U and V sum to 0 so that gray stays exactly at 128.
+constexpr int16 CoefYR = 8414;
+constexpr int16 CoefYG = 16519;
+constexpr int16 CoefYB = 3208;
+constexpr int16 CoefUR = -4857;
+constexpr int16 CoefUG = -9535;
+constexpr int16 CoefUB = 14392;
+constexpr int16 CoefVR = 14392;
+constexpr int16 CoefVG = -12052;
+constexpr int16 CoefVB = -2340;
+
+/**
+ * Coefficients arranged in the channel order of the source format.
+ * The coefficient of an unused channel (alpha or padding) is 0.
+ */
+struct FCoefficients {
+	int16 Y[4] = {};
+	int16 U[4] = {};
+	int16 V[4] = {};
+};
+
+constexpr FCoefficients MakeCoefficients(const int32 RIndex,
+                                         const int32 GIndex,
+                                         const int32 BIndex) {
+	FCoefficients Coefficients;
+	Coefficients.Y[RIndex] = CoefYR;
+	Coefficients.Y[GIndex] = CoefYG;
+	Coefficients.Y[BIndex] = CoefYB;
+	Coefficients.U[RIndex] = CoefUR;
+	Coefficients.U[GIndex] = CoefUG;
+	Coefficients.U[BIndex] = CoefUB;
+	Coefficients.V[RIndex] = CoefVR;
+	Coefficients.V[GIndex] = CoefVG;
+	Coefficients.V[BIndex] = CoefVB;
+	return Coefficients;
+}
+
+constexpr FCoefficients CoefficientsBGRA = MakeCoefficients(2, 1, 0);
+constexpr FCoefficients CoefficientsRGBA = MakeCoefficients(0, 1, 2);
+#pragma endregion
+
+#pragma region kernel types
+/**
+ * Pointers to a pair of rows. Two source rows produce two luma rows and one
+ * chroma row.
+ */
+struct FRowPairArgs {
+	const uint8* Src0 = nullptr;
+	const uint8* Src1 = nullptr; // same as Src0 for the last row of odd height
+	uint8*       Y0   = nullptr;
+	uint8*       Y1   = nullptr; // nullptr for the last row of odd height
+	uint8*       U    = nullptr; // interleaved UV for NV12
+	uint8*       V    = nullptr; // nullptr for NV12
+};
+
+/**
+ * Vectorized kernel. Converts columns from 0 and returns how many columns are
+ * converted. The count is always even. Requires Y1.
+ */
+using FRowPairKernel = int32 (*)(const FRowPairArgs& Args,
+                                 const FCoefficients& Coefficients,
+                                 int32                Width);
+
+/**
+ * Scalar kernel. Converts columns [XBegin, Width). XBegin must be even.
+ */
+using FRowPairTailKernel = void (*)(const FRowPairArgs& Args,
+                                    const FCoefficients& Coefficients,
+                                    int32 XBegin, int32 Width);
+
+FORCEINLINE void StoreChroma(const FRowPairArgs& Args, const int32 Index,
+                             const uint8 U, const uint8 V) {
+	if (nullptr != Args.V) {
+		Args.U[Index] = U;
+		Args.V[Index] = V;
+	} else {
+		Args.U[Index * 2]     = U;
+		Args.U[Index * 2 + 1] = V;
+	}
+}
+#pragma endregion
+
+#pragma region scalar kernels
+FORCEINLINE uint8 LumaOfPacked8(const uint8*         Pixel,
+                                const FCoefficients& Coefficients) {
+	const auto& C = Coefficients.Y;
+	return static_cast<uint8>(((C[0] * Pixel[0] + C[1] * Pixel[1] +
+	                            C[2] * Pixel[2] + C[3] * Pixel[3] + (1 << 14)) >>
+	                           15) +
+	                          16);
+}
+
+FORCEINLINE uint8 ChromaOfPacked8Sum(const int32 (&Sum)[4], const int16 (&C)[4]) {
+	// Sum is the sum of 4 pixels, so shift 2 more bits
+	return static_cast<uint8>(
+	    ((C[0] * Sum[0] + C[1] * Sum[1] + C[2] * Sum[2] + C[3] * Sum[3] +
+	      (1 << 16)) >>
+	     17) +
+	    128);
+}
+
+void ConvertRowPairTail_Packed8(const FRowPairArgs&  Args,
+                                const FCoefficients& Coefficients,
+                                const int32 XBegin, const int32 Width) {
+	for (int32 X = XBegin; X < Width; X += 2) {
+		// the last column of odd width is duplicated
+		const int32 X1 = FMath::Min(X + 1, Width - 1);
+
+		const uint8* P00 = Args.Src0 + X * 4;
+		const uint8* P01 = Args.Src0 + X1 * 4;
+		const uint8* P10 = Args.Src1 + X * 4;
+		const uint8* P11 = Args.Src1 + X1 * 4;
+
+		// luma
+		Args.Y0[X]  = LumaOfPacked8(P00, Coefficients);
+		Args.Y0[X1] = LumaOfPacked8(P01, Coefficients);
+		if (nullptr != Args.Y1) {
+			Args.Y1[X]  = LumaOfPacked8(P10, Coefficients);
+			Args.Y1[X1] = LumaOfPacked8(P11, Coefficients);
+		}
+
+		// chroma from the average of 2x2 pixels
+		int32 Sum[4];
+		for (int32 Channel = 0; Channel < 4; ++Channel) {
+			Sum[Channel] = P00[Channel] + P01[Channel] + P10[Channel] + P11[Channel];
+		}
+		StoreChroma(Args, X / 2, ChromaOfPacked8Sum(Sum, Coefficients.U),
+		            ChromaOfPacked8Sum(Sum, Coefficients.V));
+	}
+}
+
+FORCEINLINE uint8 LumaOfPacked16(const uint16*        Pixel,
+                                 const FCoefficients& Coefficients) {
+	const auto& C = Coefficients.Y;
+	return static_cast<uint8>(((C[0] * Pixel[0] + C[1] * Pixel[1] +
+	                            C[2] * Pixel[2] + C[3] * Pixel[3] + (1 << 22)) >>
+	                           23) +
+	                          16);
+}
+
+FORCEINLINE uint8 ChromaOfPacked16Average(const int32 (&Average)[4],
+                                          const int16 (&C)[4]) {
+	return static_cast<uint8>(((C[0] * Average[0] + C[1] * Average[1] +
+	                            C[2] * Average[2] + C[3] * Average[3] +
+	                            (1 << 22)) >>
+	                           23) +
+	                          128);
+}
+
+void ConvertRowPairTail_Packed16(const FRowPairArgs&  Args,
+                                 const FCoefficients& Coefficients,
+                                 const int32 XBegin, const int32 Width) {
+	const auto& Src0 = reinterpret_cast<const uint16*>(Args.Src0);
+	const auto& Src1 = reinterpret_cast<const uint16*>(Args.Src1);
+
+	for (int32 X = XBegin; X < Width; X += 2) {
+		// the last column of odd width is duplicated
+		const int32 X1 = FMath::Min(X + 1, Width - 1);
+
+		const uint16* P00 = Src0 + X * 4;
+		const uint16* P01 = Src0 + X1 * 4;
+		const uint16* P10 = Src1 + X * 4;
+		const uint16* P11 = Src1 + X1 * 4;
+
+		// luma
+		Args.Y0[X]  = LumaOfPacked16(P00, Coefficients);
+		Args.Y0[X1] = LumaOfPacked16(P01, Coefficients);
+		if (nullptr != Args.Y1) {
+			Args.Y1[X]  = LumaOfPacked16(P10, Coefficients);
+			Args.Y1[X1] = LumaOfPacked16(P11, Coefficients);
+		}
+
+		// chroma from the average of 2x2 pixels
+		int32 Average[4];
+		for (int32 Channel = 0; Channel < 4; ++Channel) {
+			Average[Channel] = (P00[Channel] + P01[Channel] + P10[Channel] +
+			                    P11[Channel] + 2) >>
+			                   2;
+		}
+		StoreChroma(Args, X / 2, ChromaOfPacked16Average(Average, Coefficients.U),
+		            ChromaOfPacked16Average(Average, Coefficients.V));
+	}
+}
+
+/**
+ * Luma of every gray level. Same as LumaOfPacked8 with R = G = B.
+ */
+struct FGrayLumaTable {
+	uint8 Values[256];
+
+	FGrayLumaTable() {
+		for (int32 Gray = 0; Gray < 256; ++Gray) {
+			Values[Gray] = static_cast<uint8>(
+			    (((CoefYR + CoefYG + CoefYB) * Gray + (1 << 14)) >> 15) + 16);
+		}
+	}
+};
+
+void ConvertRowPairTail_Gray8(const FRowPairArgs& Args, const FCoefficients&,
+                              const int32 XBegin, const int32 Width) {
+	static const FGrayLumaTable Table;
+
+	// luma
+	for (int32 X = XBegin; X < Width; ++X) {
+		Args.Y0[X] = Table.Values[Args.Src0[X]];
+	}
+	if (nullptr != Args.Y1) {
+		for (int32 X = XBegin; X < Width; ++X) {
+			Args.Y1[X] = Table.Values[Args.Src1[X]];
+		}
+	}
+
+	// chroma of gray is always 128 because the coefficients sum to 0
+	const int32 ChromaBegin = XBegin / 2;
+	const int32 ChromaCount = (Width + 1) / 2 - ChromaBegin;
+	if (nullptr != Args.V) {
+		FMemory::Memset(Args.U + ChromaBegin, 128, ChromaCount);
+		FMemory::Memset(Args.V + ChromaBegin, 128, ChromaCount);
+	} else {
+		FMemory::Memset(Args.U + ChromaBegin * 2, 128, ChromaCount * 2);
+	}
+}
+#pragma endregion
+
+#pragma region float kernels
+// BT.601 coefficients of the float kernels. Same matrix as the fixed point
+// coefficients above.
+constexpr float CoefFloatY[3] = {0.299f, 0.587f, 0.114f};
+constexpr float CoefFloatU[3] = {-0.168736f, -0.331264f, 0.5f};
+constexpr float CoefFloatV[3] = {0.5f, -0.418688f, -0.081312f};
+
+// 4x4 Bayer matrix for ordered dithering
+constexpr uint8 BayerMatrix[4][4] = {
+    {0, 8, 2, 10}, {12, 4, 14, 6}, {3, 11, 1, 9}, {15, 7, 13, 5}};
+
+// the largest finite half. larger values are clamped before tone mapping.
+constexpr float MaxFloatValue = 65504.0f;
+
+/**
+ * sRGB transfer function sampled at Size + 1 points. Values between samples
+ * are interpolated linearly.
+ */
+struct FEncodeTable {
+	static constexpr int32 Size = 4096;
+
+	float Values[Size + 1];
+
+	FEncodeTable() {
+		for (int32 Index = 0; Index <= Size; ++Index) {
+			const float Linear = static_cast<float>(Index) / Size;
+			Values[Index] =
+			    Linear <= 0.0031308f
+			        ? Linear * 12.92f
+			        : 1.055f * FMath::Pow(Linear, 1.0f / 2.4f) - 0.055f;
+		}
+	}
+};
+
+const FEncodeTable& GetEncodeTable() {
+	static const FEncodeTable EncodeTable;
+	return EncodeTable;
+}
+
+/**
+ * Parameters of float kernels for a pair of rows
+ */
+struct FFloatKernelParams {
+	EFFmpegToneMapping ToneMapping = EFFmpegToneMapping::None;
+
+	// nullptr if the source is already encoded
+	const float* EncodeTable = nullptr;
+
+	// true if samples of the destination are 16-bit
+	bool b16Bit = false;
+
+	// sample = floor(value * Scale + Offset + Threshold)
+	float LumaScale    = 0.0f;
+	float LumaOffset   = 0.0f;
+	float ChromaScale  = 0.0f;
+	float ChromaOffset = 0.0f;
+
+	// threshold of column X % 4 of each row. 0.5 rounds to nearest.
+	float LumaThresholds[2][4]  = {};
+	float ChromaThresholds[4]   = {};
+};
+
+/**
+ * Vectorized float kernel. Same contract as FRowPairKernel.
+ */
+using FFloatRowPairKernel = int32 (*)(const FRowPairArgs&       Args,
+                                      const FFloatKernelParams& Params,
+                                      int32                     Width);
+
+/**
+ * Scalar float kernel. Same contract as FRowPairTailKernel.
+ */
+using FFloatRowPairTailKernel = void (*)(const FRowPairArgs&       Args,
+                                         const FFloatKernelParams& Params,
+                                         int32 XBegin, int32 Width);
+
+FORCEINLINE float ToneMapAndEncode(float Value, const FFloatKernelParams& Params) {
+	// NaN and negative values become 0
+	Value = Value > 0.0f ? FMath::Min(Value, MaxFloatValue) : 0.0f;
+
+	// tone mapping
+	switch (Params.ToneMapping) {
+	case EFFmpegToneMapping::Reinhard:
+		Value = Value / (1.0f + Value);
+		break;
+	case EFFmpegToneMapping::ACES:
+		Value = (Value * (2.51f * Value + 0.03f)) /
+		        (Value * (2.43f * Value + 0.59f) + 0.14f);
+		break;
+	default:
+		break;
+	}
+	Value = FMath::Min(Value, 1.0f);
+
+	// transfer function
+	if (nullptr == Params.EncodeTable) {
+		return Value;
+	}
+	const float Position = Value * FEncodeTable::Size;
+	const int32 Index =
+	    FMath::Min(static_cast<int32>(Position), FEncodeTable::Size - 1);
+	const float Fraction = Position - static_cast<float>(Index);
+	const float Lower    = Params.EncodeTable[Index];
+	const float Upper    = Params.EncodeTable[Index + 1];
+	return Lower + Fraction * (Upper - Lower);
+}
+
+FORCEINLINE int32 Quantize(const float Value, const float Scale,
+                           const float Offset, const float Threshold) {
+	return FMath::FloorToInt32(Value * Scale + Offset + Threshold);
+}
+
+FORCEINLINE float Dot(const float (&Coefficients)[3], const float (&Pixel)[3]) {
+	return Coefficients[0] * Pixel[0] + Coefficients[1] * Pixel[1] +
+	       Coefficients[2] * Pixel[2];
+}
+
+FORCEINLINE void StoreSample(uint8* Plane, const int32 Index, const int32 Value,
+                             const bool b16Bit) {
+	if (b16Bit) {
+		reinterpret_cast<uint16*>(Plane)[Index] = static_cast<uint16>(Value);
+	} else {
+		Plane[Index] = static_cast<uint8>(Value);
+	}
+}
+
+template <typename TChannel>
+void ConvertRowPairTail_Float(const FRowPairArgs&       Args,
+                              const FFloatKernelParams& Params,
+                              const int32 XBegin, const int32 Width) {
+	const auto& Src0 = reinterpret_cast<const TChannel*>(Args.Src0);
+	const auto& Src1 = reinterpret_cast<const TChannel*>(Args.Src1);
+
+	for (int32 X = XBegin; X < Width; X += 2) {
+		// the last column of odd width is duplicated
+		const int32 X1 = FMath::Min(X + 1, Width - 1);
+
+		// tone mapped and encoded RGB of 2x2 pixels: 00, 01, 10, 11
+		const TChannel* Sources[4] = {Src0 + X * 4, Src0 + X1 * 4, Src1 + X * 4,
+		                              Src1 + X1 * 4};
+		float           Pixels[4][3];
+		for (int32 Pixel = 0; Pixel < 4; ++Pixel) {
+			for (int32 Channel = 0; Channel < 3; ++Channel) {
+				Pixels[Pixel][Channel] = ToneMapAndEncode(
+				    static_cast<float>(Sources[Pixel][Channel]), Params);
+			}
+		}
+
+		// luma
+		const auto& StoreLuma = [&](uint8* Plane, const int32 Column,
+		                            const float (&Pixel)[3],
+		                            const float (&Thresholds)[4]) {
+			StoreSample(Plane, Column,
+			            Quantize(Dot(CoefFloatY, Pixel), Params.LumaScale,
+			                     Params.LumaOffset, Thresholds[Column & 3]),
+			            Params.b16Bit);
+		};
+		StoreLuma(Args.Y0, X, Pixels[0], Params.LumaThresholds[0]);
+		StoreLuma(Args.Y0, X1, Pixels[1], Params.LumaThresholds[0]);
+		if (nullptr != Args.Y1) {
+			StoreLuma(Args.Y1, X, Pixels[2], Params.LumaThresholds[1]);
+			StoreLuma(Args.Y1, X1, Pixels[3], Params.LumaThresholds[1]);
+		}
+
+		// chroma from the average of 2x2 pixels
+		float Average[3];
+		for (int32 Channel = 0; Channel < 3; ++Channel) {
+			Average[Channel] = ((Pixels[0][Channel] + Pixels[2][Channel]) +
+			                    (Pixels[1][Channel] + Pixels[3][Channel])) *
+			                   0.25f;
+		}
+		const auto& Threshold = Params.ChromaThresholds[(X / 2) & 3];
+		const auto& U = Quantize(Dot(CoefFloatU, Average), Params.ChromaScale,
+		                         Params.ChromaOffset, Threshold);
+		const auto& V = Quantize(Dot(CoefFloatV, Average), Params.ChromaScale,
+		                         Params.ChromaOffset, Threshold);
+		if (Params.b16Bit) {
+			StoreSample(Args.U, X / 2, U, true);
+			StoreSample(Args.V, X / 2, V, true);
+		} else {
+			StoreChroma(Args, X / 2, static_cast<uint8>(U), static_cast<uint8>(V));
+		}
+	}
+}
+#pragma endregion
+
+#if PLATFORM_CPU_X86_FAMILY
+#pragma region SSE4.1 kernels
+// Lambdas do not inherit the target attribute, so helpers are functions.
+
+// store luma of 16 pixels from 4 vectors of weighted sums
+FFMPEG_TARGET_SSE41 FORCEINLINE void StoreLuma16_SSE41(__m128i (&Luma)[4],
+                                                       uint8* Dst) {
+	const __m128i RoundY  = _mm_set1_epi32(1 << 14);
+	const __m128i OffsetY = _mm_set1_epi16(16);
+
+	for (auto& Value : Luma) {
+		Value = _mm_srai_epi32(_mm_add_epi32(Value, RoundY), 15);
+	}
+	const __m128i Luma01 =
+	    _mm_add_epi16(_mm_packs_epi32(Luma[0], Luma[1]), OffsetY);
+	const __m128i Luma23 =
+	    _mm_add_epi16(_mm_packs_epi32(Luma[2], Luma[3]), OffsetY);
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(Dst),
+	                 _mm_packus_epi16(Luma01, Luma23));
+}
+
+// 8 chroma samples as 8-bit from 4 vectors of partial weighted sums
+FFMPEG_TARGET_SSE41 FORCEINLINE __m128i
+    Chroma8_SSE41(const __m128i (&Sums)[4]) {
+	const __m128i RoundC  = _mm_set1_epi32(1 << 16);
+	const __m128i OffsetC = _mm_set1_epi16(128);
+
+	const __m128i Chroma03 = _mm_srai_epi32(
+	    _mm_add_epi32(_mm_hadd_epi32(Sums[0], Sums[1]), RoundC), 17);
+	const __m128i Chroma47 = _mm_srai_epi32(
+	    _mm_add_epi32(_mm_hadd_epi32(Sums[2], Sums[3]), RoundC), 17);
+	const __m128i Chroma =
+	    _mm_add_epi16(_mm_packs_epi32(Chroma03, Chroma47), OffsetC);
+	return _mm_packus_epi16(Chroma, Chroma);
+}
+
+FFMPEG_TARGET_SSE41 int32
+    ConvertRowPair_Packed8_SSE41(const FRowPairArgs&  Args,
+                                 const FCoefficients& Coefficients,
+                                 const int32          Width) {
+	const auto& [CY, CU, CV] = Coefficients;
+
+	const __m128i Zero  = _mm_setzero_si128();
+	const __m128i CoefY = _mm_setr_epi16(CY[0], CY[1], CY[2], CY[3], CY[0],
+	                                     CY[1], CY[2], CY[3]);
+	const __m128i CoefU = _mm_setr_epi16(CU[0], CU[1], CU[2], CU[3], CU[0],
+	                                     CU[1], CU[2], CU[3]);
+	const __m128i CoefV = _mm_setr_epi16(CV[0], CV[1], CV[2], CV[3], CV[0],
+	                                     CV[1], CV[2], CV[3]);
+
+	// 16 pixels per iteration
+	const int32 End = Width & ~15;
+	for (int32 X = 0; X < End; X += 16) {
+		__m128i Luma0[4], Luma1[4], SumU[4], SumV[4];
+
+		// 4 pixels per group
+		for (int32 Group = 0; Group < 4; ++Group) {
+			const auto& Offset = (X + Group * 4) * 4;
+			const __m128i Pixels0 =
+			    _mm_loadu_si128(reinterpret_cast<const __m128i*>(Args.Src0 + Offset));
+			const __m128i Pixels1 =
+			    _mm_loadu_si128(reinterpret_cast<const __m128i*>(Args.Src1 + Offset));
+
+			// widen to 16 bits: Lo = pixel 0, 1 / Hi = pixel 2, 3
+			const __m128i Lo0 = _mm_unpacklo_epi8(Pixels0, Zero);
+			const __m128i Hi0 = _mm_unpackhi_epi8(Pixels0, Zero);
+			const __m128i Lo1 = _mm_unpacklo_epi8(Pixels1, Zero);
+			const __m128i Hi1 = _mm_unpackhi_epi8(Pixels1, Zero);
+
+			// weighted sum of channels of pixel 0, 1, 2, 3
+			Luma0[Group] = _mm_hadd_epi32(_mm_madd_epi16(Lo0, CoefY),
+			                              _mm_madd_epi16(Hi0, CoefY));
+			Luma1[Group] = _mm_hadd_epi32(_mm_madd_epi16(Lo1, CoefY),
+			                              _mm_madd_epi16(Hi1, CoefY));
+
+			// sum of 2x2 pixels: pixel 0+1 and pixel 2+3 of both rows
+			const __m128i VerticalLo = _mm_add_epi16(Lo0, Lo1);
+			const __m128i VerticalHi = _mm_add_epi16(Hi0, Hi1);
+			const __m128i Sum =
+			    _mm_add_epi16(_mm_unpacklo_epi64(VerticalLo, VerticalHi),
+			                  _mm_unpackhi_epi64(VerticalLo, VerticalHi));
+
+			// partial weighted sums of 2 chroma samples
+			SumU[Group] = _mm_madd_epi16(Sum, CoefU);
+			SumV[Group] = _mm_madd_epi16(Sum, CoefV);
+		}
+
+		// store luma of 16 pixels
+		StoreLuma16_SSE41(Luma0, Args.Y0 + X);
+		StoreLuma16_SSE41(Luma1, Args.Y1 + X);
+
+		// 8 chroma samples
+		const __m128i U = Chroma8_SSE41(SumU);
+		const __m128i V = Chroma8_SSE41(SumV);
+
+		// store chroma of 16 pixels
+		if (nullptr != Args.V) {
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(Args.U + X / 2), U);
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(Args.V + X / 2), V);
+		} else {
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(Args.U + X),
+			                 _mm_unpacklo_epi8(U, V));
+		}
+	}
+
+	return End;
+}
+
+// 4 values from 2 vectors of partial weighted sums of 16-bit pixels
+FFMPEG_TARGET_SSE41 FORCEINLINE __m128i Reduce16_SSE41(const __m128i& Sums0,
+                                                       const __m128i& Sums1) {
+	const __m128i Round = _mm_set1_epi32(1 << 22);
+	return _mm_srai_epi32(_mm_add_epi32(_mm_hadd_epi32(Sums0, Sums1), Round),
+	                      23);
+}
+
+FFMPEG_TARGET_SSE41 int32
+    ConvertRowPair_Packed16_SSE41(const FRowPairArgs&  Args,
+                                  const FCoefficients& Coefficients,
+                                  const int32          Width) {
+	const auto& [CY, CU, CV] = Coefficients;
+
+	const __m128i CoefY   = _mm_setr_epi32(CY[0], CY[1], CY[2], CY[3]);
+	const __m128i CoefU   = _mm_setr_epi32(CU[0], CU[1], CU[2], CU[3]);
+	const __m128i CoefV   = _mm_setr_epi32(CV[0], CV[1], CV[2], CV[3]);
+	const __m128i Two     = _mm_set1_epi32(2);
+	const __m128i Zero    = _mm_setzero_si128();
+	const __m128i OffsetY = _mm_set1_epi16(16);
+	const __m128i OffsetC = _mm_set1_epi16(128);
+
+	const auto& Src0 = reinterpret_cast<const uint16*>(Args.Src0);
+	const auto& Src1 = reinterpret_cast<const uint16*>(Args.Src1);
+
+	// 8 pixels per iteration
+	const int32 End = Width & ~7;
+	for (int32 X = 0; X < End; X += 8) {
+		__m128i Luma0[4], Luma1[4], SumU[4], SumV[4];
+
+		// 2 pixels per group
+		for (int32 Group = 0; Group < 4; ++Group) {
+			const auto& Offset = (X + Group * 2) * 4;
+			const __m128i Pixels0 =
+			    _mm_loadu_si128(reinterpret_cast<const __m128i*>(Src0 + Offset));
+			const __m128i Pixels1 =
+			    _mm_loadu_si128(reinterpret_cast<const __m128i*>(Src1 + Offset));
+
+			// widen to 32 bits
+			const __m128i P00 = _mm_cvtepu16_epi32(Pixels0);
+			const __m128i P01 = _mm_cvtepu16_epi32(_mm_srli_si128(Pixels0, 8));
+			const __m128i P10 = _mm_cvtepu16_epi32(Pixels1);
+			const __m128i P11 = _mm_cvtepu16_epi32(_mm_srli_si128(Pixels1, 8));
+
+			// partial weighted sums of luma of 2 pixels
+			Luma0[Group] = _mm_hadd_epi32(_mm_mullo_epi32(P00, CoefY),
+			                              _mm_mullo_epi32(P01, CoefY));
+			Luma1[Group] = _mm_hadd_epi32(_mm_mullo_epi32(P10, CoefY),
+			                              _mm_mullo_epi32(P11, CoefY));
+
+			// average of 2x2 pixels
+			const __m128i Average = _mm_srli_epi32(
+			    _mm_add_epi32(_mm_add_epi32(_mm_add_epi32(P00, P01),
+			                                _mm_add_epi32(P10, P11)),
+			                  Two),
+			    2);
+
+			// partial weighted sums of 1 chroma sample
+			SumU[Group] = _mm_mullo_epi32(Average, CoefU);
+			SumV[Group] = _mm_mullo_epi32(Average, CoefV);
+		}
+
+		// store luma of 8 pixels
+		const __m128i LumaValues0 = _mm_add_epi16(
+		    _mm_packs_epi32(Reduce16_SSE41(Luma0[0], Luma0[1]),
+		                    Reduce16_SSE41(Luma0[2], Luma0[3])),
+		    OffsetY);
+		const __m128i LumaValues1 = _mm_add_epi16(
+		    _mm_packs_epi32(Reduce16_SSE41(Luma1[0], Luma1[1]),
+		                    Reduce16_SSE41(Luma1[2], Luma1[3])),
+		    OffsetY);
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(Args.Y0 + X),
+		                 _mm_packus_epi16(LumaValues0, LumaValues0));
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(Args.Y1 + X),
+		                 _mm_packus_epi16(LumaValues1, LumaValues1));
+
+		// 4 chroma samples
+		const __m128i UValues = _mm_add_epi16(
+		    _mm_packs_epi32(Reduce16_SSE41(_mm_hadd_epi32(SumU[0], SumU[1]),
+		                                   _mm_hadd_epi32(SumU[2], SumU[3])),
+		                    Zero),
+		    OffsetC);
+		const __m128i VValues = _mm_add_epi16(
+		    _mm_packs_epi32(Reduce16_SSE41(_mm_hadd_epi32(SumV[0], SumV[1]),
+		                                   _mm_hadd_epi32(SumV[2], SumV[3])),
+		                    Zero),
+		    OffsetC);
+		const __m128i U = _mm_packus_epi16(UValues, UValues);
+		const __m128i V = _mm_packus_epi16(VValues, VValues);
+
+		// store chroma of 8 pixels
+		if (nullptr != Args.V) {
+			const int32 UValue = _mm_cvtsi128_si32(U);
+			const int32 VValue = _mm_cvtsi128_si32(V);
+			FMemory::Memcpy(Args.U + X / 2, &UValue, sizeof(UValue));
+			FMemory::Memcpy(Args.V + X / 2, &VValue, sizeof(VValue));
+		} else {
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(Args.U + X),
+			                 _mm_unpacklo_epi8(U, V));
+		}
+	}
+
+	return End;
+}
+#pragma endregion
+
+#pragma region AVX2 kernels
+// store luma of 32 pixels from 4 vectors of weighted sums
+FFMPEG_TARGET_AVX2 FORCEINLINE void StoreLuma32_AVX2(__m256i (&Luma)[4],
+                                                     uint8* Dst) {
+	const __m256i RoundY  = _mm256_set1_epi32(1 << 14);
+	const __m256i OffsetY = _mm256_set1_epi16(16);
+
+	// restore pixel order after in-lane packing
+	const __m256i LumaOrder = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+	for (auto& Value : Luma) {
+		Value = _mm256_srai_epi32(_mm256_add_epi32(Value, RoundY), 15);
+	}
+	const __m256i Luma01 =
+	    _mm256_add_epi16(_mm256_packs_epi32(Luma[0], Luma[1]), OffsetY);
+	const __m256i Luma23 =
+	    _mm256_add_epi16(_mm256_packs_epi32(Luma[2], Luma[3]), OffsetY);
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(Dst),
+	                    _mm256_permutevar8x32_epi32(
+	                        _mm256_packus_epi16(Luma01, Luma23), LumaOrder));
+}
+
+// 16 chroma samples as 8-bit from 4 vectors of partial weighted sums
+FFMPEG_TARGET_AVX2 FORCEINLINE __m128i
+    Chroma16_AVX2(const __m256i (&Sums)[4]) {
+	const __m256i RoundC  = _mm256_set1_epi32(1 << 16);
+	const __m256i OffsetC = _mm256_set1_epi16(128);
+
+	// restore sample order after in-lane horizontal add
+	const __m256i ChromaOrder = _mm256_setr_epi32(0, 1, 4, 5, 2, 3, 6, 7);
+
+	const __m256i Chroma07 = _mm256_srai_epi32(
+	    _mm256_add_epi32(_mm256_permutevar8x32_epi32(
+	                         _mm256_hadd_epi32(Sums[0], Sums[1]), ChromaOrder),
+	                     RoundC),
+	    17);
+	const __m256i Chroma815 = _mm256_srai_epi32(
+	    _mm256_add_epi32(_mm256_permutevar8x32_epi32(
+	                         _mm256_hadd_epi32(Sums[2], Sums[3]), ChromaOrder),
+	                     RoundC),
+	    17);
+	const __m256i Chroma = _mm256_add_epi16(
+	    _mm256_permute4x64_epi64(_mm256_packs_epi32(Chroma07, Chroma815),
+	                             _MM_SHUFFLE(3, 1, 2, 0)),
+	    OffsetC);
+	return _mm256_castsi256_si128(_mm256_permute4x64_epi64(
+	    _mm256_packus_epi16(Chroma, Chroma), _MM_SHUFFLE(3, 1, 2, 0)));
+}
+
+FFMPEG_TARGET_AVX2 int32
+    ConvertRowPair_Packed8_AVX2(const FRowPairArgs&  Args,
+                                const FCoefficients& Coefficients,
+                                const int32          Width) {
+	const auto& [CY, CU, CV] = Coefficients;
+
+	const __m256i Zero  = _mm256_setzero_si256();
+	const __m256i CoefY = _mm256_setr_epi16(
+	    CY[0], CY[1], CY[2], CY[3], CY[0], CY[1], CY[2], CY[3], CY[0], CY[1],
+	    CY[2], CY[3], CY[0], CY[1], CY[2], CY[3]);
+	const __m256i CoefU = _mm256_setr_epi16(
+	    CU[0], CU[1], CU[2], CU[3], CU[0], CU[1], CU[2], CU[3], CU[0], CU[1],
+	    CU[2], CU[3], CU[0], CU[1], CU[2], CU[3]);
+	const __m256i CoefV = _mm256_setr_epi16(
+	    CV[0], CV[1], CV[2], CV[3], CV[0], CV[1], CV[2], CV[3], CV[0], CV[1],
+	    CV[2], CV[3], CV[0], CV[1], CV[2], CV[3]);
+
+	// 32 pixels per iteration
+	const int32 End = Width & ~31;
+	for (int32 X = 0; X < End; X += 32) {
+		__m256i Luma0[4], Luma1[4], SumU[4], SumV[4];
+
+		// 8 pixels per group
+		for (int32 Group = 0; Group < 4; ++Group) {
+			const auto& Offset = (X + Group * 8) * 4;
+			const __m256i Pixels0 = _mm256_loadu_si256(
+			    reinterpret_cast<const __m256i*>(Args.Src0 + Offset));
+			const __m256i Pixels1 = _mm256_loadu_si256(
+			    reinterpret_cast<const __m256i*>(Args.Src1 + Offset));
+
+			// widen to 16 bits: Lo = pixel 0, 1 | 4, 5 / Hi = pixel 2, 3 | 6, 7
+			const __m256i Lo0 = _mm256_unpacklo_epi8(Pixels0, Zero);
+			const __m256i Hi0 = _mm256_unpackhi_epi8(Pixels0, Zero);
+			const __m256i Lo1 = _mm256_unpacklo_epi8(Pixels1, Zero);
+			const __m256i Hi1 = _mm256_unpackhi_epi8(Pixels1, Zero);
+
+			// weighted sum of channels of pixel 0 to 7 in order
+			Luma0[Group] = _mm256_hadd_epi32(_mm256_madd_epi16(Lo0, CoefY),
+			                                 _mm256_madd_epi16(Hi0, CoefY));
+			Luma1[Group] = _mm256_hadd_epi32(_mm256_madd_epi16(Lo1, CoefY),
+			                                 _mm256_madd_epi16(Hi1, CoefY));
+
+			// sum of 2x2 pixels: chroma sample 0, 1 | 2, 3
+			const __m256i VerticalLo = _mm256_add_epi16(Lo0, Lo1);
+			const __m256i VerticalHi = _mm256_add_epi16(Hi0, Hi1);
+			const __m256i Sum =
+			    _mm256_add_epi16(_mm256_unpacklo_epi64(VerticalLo, VerticalHi),
+			                     _mm256_unpackhi_epi64(VerticalLo, VerticalHi));
+
+			// partial weighted sums of 4 chroma samples
+			SumU[Group] = _mm256_madd_epi16(Sum, CoefU);
+			SumV[Group] = _mm256_madd_epi16(Sum, CoefV);
+		}
+
+		// store luma of 32 pixels
+		StoreLuma32_AVX2(Luma0, Args.Y0 + X);
+		StoreLuma32_AVX2(Luma1, Args.Y1 + X);
+
+		// 16 chroma samples
+		const __m128i U = Chroma16_AVX2(SumU);
+		const __m128i V = Chroma16_AVX2(SumV);
+
+		// store chroma of 32 pixels
+		if (nullptr != Args.V) {
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(Args.U + X / 2), U);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(Args.V + X / 2), V);
+		} else {
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(Args.U + X),
+			                 _mm_unpacklo_epi8(U, V));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(Args.U + X + 16),
+			                 _mm_unpackhi_epi8(U, V));
+		}
+	}
+
+	return End;
+}
+#pragma endregion
+
+#pragma region AVX2 float kernels
+FFMPEG_TARGET_AVX2_F16C FORCEINLINE void LoadPixels8_AVX2(const float* Src,
+                                                          __m256 (&Vectors)[4]) {
+	for (int32 Index = 0; Index < 4; ++Index) {
+		Vectors[Index] = _mm256_loadu_ps(Src + Index * 8);
+	}
+}
+
+FFMPEG_TARGET_AVX2_F16C FORCEINLINE void LoadPixels8_AVX2(const FFloat16* Src,
+                                                          __m256 (&Vectors)[4]) {
+	for (int32 Index = 0; Index < 4; ++Index) {
+		Vectors[Index] = _mm256_cvtph_ps(
+		    _mm_loadu_si128(reinterpret_cast<const __m128i*>(Src + Index * 8)));
+	}
+}
+
+// split 8 RGBA pixels into R, G and B.
+// pixel order in each channel is 0, 2, 4, 6 | 1, 3, 5, 7.
+FFMPEG_TARGET_AVX2_F16C FORCEINLINE void
+    DeinterleaveRGB_AVX2(const __m256 (&Vectors)[4], __m256 (&Channels)[3]) {
+	const __m256 RG01 = _mm256_unpacklo_ps(Vectors[0], Vectors[1]);
+	const __m256 BA01 = _mm256_unpackhi_ps(Vectors[0], Vectors[1]);
+	const __m256 RG23 = _mm256_unpacklo_ps(Vectors[2], Vectors[3]);
+	const __m256 BA23 = _mm256_unpackhi_ps(Vectors[2], Vectors[3]);
+	Channels[0] = _mm256_shuffle_ps(RG01, RG23, _MM_SHUFFLE(1, 0, 1, 0));
+	Channels[1] = _mm256_shuffle_ps(RG01, RG23, _MM_SHUFFLE(3, 2, 3, 2));
+	Channels[2] = _mm256_shuffle_ps(BA01, BA23, _MM_SHUFFLE(1, 0, 1, 0));
+}
+
+// same as ToneMapAndEncode
+FFMPEG_TARGET_AVX2_F16C FORCEINLINE __m256
+    ToneMapAndEncode_AVX2(__m256 Value, const FFloatKernelParams& Params) {
+	const __m256 One = _mm256_set1_ps(1.0f);
+
+	// NaN and negative values become 0
+	Value = _mm256_min_ps(_mm256_max_ps(Value, _mm256_setzero_ps()),
+	                      _mm256_set1_ps(MaxFloatValue));
+
+	// tone mapping
+	switch (Params.ToneMapping) {
+	case EFFmpegToneMapping::Reinhard:
+		Value = _mm256_div_ps(Value, _mm256_add_ps(One, Value));
+		break;
+	case EFFmpegToneMapping::ACES: {
+		const __m256 Numerator = _mm256_mul_ps(
+		    Value, _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(2.51f), Value),
+		                         _mm256_set1_ps(0.03f)));
+		const __m256 Denominator = _mm256_add_ps(
+		    _mm256_mul_ps(Value, _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(2.43f),
+		                                                     Value),
+		                                       _mm256_set1_ps(0.59f))),
+		    _mm256_set1_ps(0.14f));
+		Value = _mm256_div_ps(Numerator, Denominator);
+		break;
+	}
+	default:
+		break;
+	}
+	Value = _mm256_min_ps(Value, One);
+
+	// transfer function
+	if (nullptr == Params.EncodeTable) {
+		return Value;
+	}
+	const __m256  Position = _mm256_mul_ps(Value, _mm256_set1_ps(FEncodeTable::Size));
+	const __m256i Index    = _mm256_min_epi32(_mm256_cvttps_epi32(Position),
+	                                          _mm256_set1_epi32(FEncodeTable::Size - 1));
+	const __m256  Fraction = _mm256_sub_ps(Position, _mm256_cvtepi32_ps(Index));
+	const __m256  Lower    = _mm256_i32gather_ps(Params.EncodeTable, Index, 4);
+	const __m256  Upper    = _mm256_i32gather_ps(Params.EncodeTable + 1, Index, 4);
+	return _mm256_add_ps(Lower,
+	                     _mm256_mul_ps(Fraction, _mm256_sub_ps(Upper, Lower)));
+}
+
+// store 8 samples
+FFMPEG_TARGET_AVX2_F16C FORCEINLINE void StoreSamples8_AVX2(const __m256i& Values,
+                                                            uint8* Plane,
+                                                            const int32 Index,
+                                                            const bool b16Bit) {
+	const __m128i Packed = _mm256_castsi256_si128(_mm256_permute4x64_epi64(
+	    _mm256_packus_epi32(Values, Values), _MM_SHUFFLE(3, 1, 2, 0)));
+	if (b16Bit) {
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(Plane + Index * 2), Packed);
+	} else {
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(Plane + Index),
+		                 _mm_packus_epi16(Packed, Packed));
+	}
+}
+
+// store 4 chroma samples
+FFMPEG_TARGET_AVX2_F16C FORCEINLINE void
+    StoreChroma4_AVX2(const FRowPairArgs& Args, const int32 Index,
+                      const __m128i& U, const __m128i& V, const bool b16Bit) {
+	const __m128i U16 = _mm_packus_epi32(U, U);
+	const __m128i V16 = _mm_packus_epi32(V, V);
+	if (b16Bit) {
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(Args.U + Index * 2), U16);
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(Args.V + Index * 2), V16);
+		return;
+	}
+
+	const __m128i U8 = _mm_packus_epi16(U16, U16);
+	const __m128i V8 = _mm_packus_epi16(V16, V16);
+	if (nullptr != Args.V) {
+		const int32 UValue = _mm_cvtsi128_si32(U8);
+		const int32 VValue = _mm_cvtsi128_si32(V8);
+		FMemory::Memcpy(Args.U + Index, &UValue, sizeof(UValue));
+		FMemory::Memcpy(Args.V + Index, &VValue, sizeof(VValue));
+	} else {
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(Args.U + Index * 2),
+		                 _mm_unpacklo_epi8(U8, V8));
+	}
+}
+
+// quantize 4 chroma samples from the average RGB
+FFMPEG_TARGET_AVX2_F16C FORCEINLINE __m128i QuantizeChroma4_AVX2(
+    const float (&Coefficients)[3], const __m128 (&Average)[3],
+    const __m128& Scale, const __m128& Offset, const __m128& Thresholds) {
+	const __m128 Value = _mm_add_ps(
+	    _mm_add_ps(_mm_mul_ps(_mm_set1_ps(Coefficients[0]), Average[0]),
+	               _mm_mul_ps(_mm_set1_ps(Coefficients[1]), Average[1])),
+	    _mm_mul_ps(_mm_set1_ps(Coefficients[2]), Average[2]));
+	return _mm_cvtps_epi32(_mm_floor_ps(
+	    _mm_add_ps(_mm_add_ps(_mm_mul_ps(Value, Scale), Offset), Thresholds)));
+}
+
+template <typename TChannel>
+FFMPEG_TARGET_AVX2_F16C int32
+    ConvertRowPair_Float_AVX2(const FRowPairArgs&       Args,
+                              const FFloatKernelParams& Params,
+                              const int32               Width) {
+	const auto& Src0 = reinterpret_cast<const TChannel*>(Args.Src0);
+	const auto& Src1 = reinterpret_cast<const TChannel*>(Args.Src1);
+
+	// restore pixel order after deinterleaving
+	const __m256i PixelOrder = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+	const __m256 LumaScale    = _mm256_set1_ps(Params.LumaScale);
+	const __m256 LumaOffset   = _mm256_set1_ps(Params.LumaOffset);
+	const __m128 ChromaScale  = _mm_set1_ps(Params.ChromaScale);
+	const __m128 ChromaOffset = _mm_set1_ps(Params.ChromaOffset);
+	const __m128 Quarter      = _mm_set1_ps(0.25f);
+
+	// thresholds repeat every 4 columns
+	const auto&  T = Params.LumaThresholds;
+	const __m256 LumaThresholds[2] = {
+	    _mm256_setr_ps(T[0][0], T[0][1], T[0][2], T[0][3], T[0][0], T[0][1],
+	                   T[0][2], T[0][3]),
+	    _mm256_setr_ps(T[1][0], T[1][1], T[1][2], T[1][3], T[1][0], T[1][1],
+	                   T[1][2], T[1][3])};
+	const __m128 ChromaThresholds = _mm_loadu_ps(Params.ChromaThresholds);
+
+	// 8 pixels per iteration
+	const int32 End = Width & ~7;
+	for (int32 X = 0; X < End; X += 8) {
+		// tone mapped and encoded R, G and B of both rows
+		__m256 Channels[2][3];
+		for (int32 Row = 0; Row < 2; ++Row) {
+			__m256 Vectors[4];
+			LoadPixels8_AVX2((Row == 0 ? Src0 : Src1) + X * 4, Vectors);
+			DeinterleaveRGB_AVX2(Vectors, Channels[Row]);
+			for (auto& Channel : Channels[Row]) {
+				Channel = ToneMapAndEncode_AVX2(Channel, Params);
+			}
+		}
+
+		// luma of 8 pixels of both rows
+		for (int32 Row = 0; Row < 2; ++Row) {
+			const auto& [R, G, B] = Channels[Row];
+			const __m256 Luma     = _mm256_permutevar8x32_ps(
+			    _mm256_add_ps(
+			        _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(CoefFloatY[0]), R),
+			                      _mm256_mul_ps(_mm256_set1_ps(CoefFloatY[1]), G)),
+			        _mm256_mul_ps(_mm256_set1_ps(CoefFloatY[2]), B)),
+			    PixelOrder);
+			const __m256i Samples = _mm256_cvtps_epi32(_mm256_floor_ps(
+			    _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(Luma, LumaScale),
+			                                LumaOffset),
+			                  LumaThresholds[Row])));
+			StoreSamples8_AVX2(Samples, Row == 0 ? Args.Y0 : Args.Y1, X,
+			                   Params.b16Bit);
+		}
+
+		// average of 2x2 pixels. the lower and upper lanes hold the even and
+		// odd columns.
+		__m128 Average[3];
+		for (int32 Channel = 0; Channel < 3; ++Channel) {
+			const __m256 Vertical =
+			    _mm256_add_ps(Channels[0][Channel], Channels[1][Channel]);
+			Average[Channel] =
+			    _mm_mul_ps(_mm_add_ps(_mm256_castps256_ps128(Vertical),
+			                          _mm256_extractf128_ps(Vertical, 1)),
+			               Quarter);
+		}
+
+		// 4 chroma samples
+		const __m128i U = QuantizeChroma4_AVX2(CoefFloatU, Average, ChromaScale,
+		                                       ChromaOffset, ChromaThresholds);
+		const __m128i V = QuantizeChroma4_AVX2(CoefFloatV, Average, ChromaScale,
+		                                       ChromaOffset, ChromaThresholds);
+		StoreChroma4_AVX2(Args, X / 2, U, V, Params.b16Bit);
+	}
+
+	return End;
+}
+#pragma endregion
+
+#pragma region CPU detection
+void CpuId(int32 (&Info)[4], const int32 Leaf, const int32 SubLeaf) {
+#if defined(_MSC_VER)
+	__cpuidex(Info, Leaf, SubLeaf);
+#else
+	uint32 Eax, Ebx, Ecx, Edx;
+	__cpuid_count(Leaf, SubLeaf, Eax, Ebx, Ecx, Edx);
+	Info[0] = static_cast<int32>(Eax);
+	Info[1] = static_cast<int32>(Ebx);
+	Info[2] = static_cast<int32>(Ecx);
+	Info[3] = static_cast<int32>(Edx);
+#endif
+}
+
+uint64 XGetBV0() {
+#if defined(_MSC_VER)
+	return _xgetbv(0);
+#else
+	uint32 Eax, Edx;
+	__asm__ volatile("xgetbv" : "=a"(Eax), "=d"(Edx) : "c"(0));
+	return (static_cast<uint64>(Edx) << 32) | Eax;
+#endif
+}
+
+bool HasF16C() {
+	int32 Info[4];
+	CpuId(Info, 1, 0);
+	return (Info[2] & (1 << 29)) != 0;
+}
+#pragma endregion
+#endif
+
+EFFmpegPixelConversionISA DetectISA() {
+	using enum EFFmpegPixelConversionISA;
+
+#if PLATFORM_CPU_X86_FAMILY
+	int32 Info[4];
+
+	// highest leaf
+	CpuId(Info, 0, 0);
+	const auto& MaxLeaf = Info[0];
+
+	// leaf 1: SSE4.1, OSXSAVE and AVX
+	CpuId(Info, 1, 0);
+	const bool bSSE41   = (Info[2] & (1 << 19)) != 0;
+	const bool bOSXSAVE = (Info[2] & (1 << 27)) != 0;
+	const bool bAVX     = (Info[2] & (1 << 28)) != 0;
+
+	// AVX2 requires the OS to save YMM registers
+	bool bAVX2 = false;
+	if (MaxLeaf >= 7 && bOSXSAVE && bAVX && (XGetBV0() & 0x6) == 0x6) {
+		CpuId(Info, 7, 0);
+		bAVX2 = (Info[1] & (1 << 5)) != 0;
+	}
+
+	if (bAVX2) {
+		return AVX2;
+	}
+	if (bSSE41) {
+		return SSE41;
+	}
+#endif
+
+	return Scalar;
+}
+
+/**
+ * Kernels of a source format
+ */
+struct FKernels {
+	FRowPairKernel     Vector = nullptr;
+	FRowPairTailKernel Tail   = nullptr;
+	FCoefficients      Coefficients;
+};
+
+/**
+ * Kernels of a float source format
+ */
+struct FFloatKernels {
+	FFloatRowPairKernel     Vector = nullptr;
+	FFloatRowPairTailKernel Tail   = nullptr;
+};
+
+/**
+ * Vectorized kernels selected for this CPU
+ */
+struct FDispatchTable {
+	EFFmpegPixelConversionISA ISA      = EFFmpegPixelConversionISA::Scalar;
+	FRowPairKernel            Packed8  = nullptr;
+	FRowPairKernel            Packed16 = nullptr;
+	FFloatRowPairKernel       Float16  = nullptr;
+	FFloatRowPairKernel       Float32  = nullptr;
+
+	FDispatchTable() : ISA(DetectISA()) {
+#if PLATFORM_CPU_X86_FAMILY
+		using enum EFFmpegPixelConversionISA;
+
+		switch (ISA) {
+		case AVX2:
+			Packed8  = &ConvertRowPair_Packed8_AVX2;
+			Packed16 = &ConvertRowPair_Packed16_SSE41;
+
+			// float kernels gather from the table and need F16C for halves
+			if (HasF16C()) {
+				Float16 = &ConvertRowPair_Float_AVX2<FFloat16>;
+				Float32 = &ConvertRowPair_Float_AVX2<float>;
+			}
+			break;
+		case SSE41:
+			Packed8  = &ConvertRowPair_Packed8_SSE41;
+			Packed16 = &ConvertRowPair_Packed16_SSE41;
+			break;
+		default:
+			break;
+		}
+#endif
+	}
+};
+
+const FDispatchTable& GetDispatchTable() {
+	static const FDispatchTable DispatchTable;
+	return DispatchTable;
+}
+
+/**
+ * @return   kernels for SrcFormat. Tail is nullptr if not supported.
+ */
+FKernels KernelsOf(const AVPixelFormat SrcFormat) {
+	const auto& DispatchTable = GetDispatchTable();
+
+	switch (SrcFormat) {
+	case AV_PIX_FMT_BGRA:
+	case AV_PIX_FMT_BGR0:
+		return {DispatchTable.Packed8, &ConvertRowPairTail_Packed8,
+		        CoefficientsBGRA};
+	case AV_PIX_FMT_RGBA:
+	case AV_PIX_FMT_RGB0:
+		return {DispatchTable.Packed8, &ConvertRowPairTail_Packed8,
+		        CoefficientsRGBA};
+	case AV_PIX_FMT_RGBA64LE:
+		return {DispatchTable.Packed16, &ConvertRowPairTail_Packed16,
+		        CoefficientsRGBA};
+	case AV_PIX_FMT_GRAY8:
+		// a lookup table is already as fast as the memory bandwidth
+		return {nullptr, &ConvertRowPairTail_Gray8, {}};
+	default:
+		return {};
+	}
+}
+
+/**
+ * @return   kernels for float SrcFormat. Tail is nullptr if not supported.
+ */
+FFloatKernels FloatKernelsOf(const AVPixelFormat SrcFormat) {
+	const auto& DispatchTable = GetDispatchTable();
+
+	switch (SrcFormat) {
+	case AV_PIX_FMT_RGBAF16LE:
+		return {DispatchTable.Float16, &ConvertRowPairTail_Float<FFloat16>};
+	case AV_PIX_FMT_RGBAF32LE:
+		return {DispatchTable.Float32, &ConvertRowPairTail_Float<float>};
+	default:
+		return {};
+	}
+}
+
+/**
+ * Convert rows of a float image. Same contract as
+ * FFFmpegPixelConversion::ConvertRows.
+ */
+void ConvertFloatRows(const uint8* SrcData, const int64 SrcLineSize,
+                      const FFloatKernels&                 Kernels,
+                      const FFFmpegFloatConversionOptions& Options,
+                      AVFrame& Frame, const int32 RowBegin, const int32 RowEnd) {
+	const auto& DstFormat = static_cast<AVPixelFormat>(Frame.format);
+	const auto& Width     = Frame.width;
+	const auto& Height    = Frame.height;
+	const bool  bNV12     = AV_PIX_FMT_NV12 == DstFormat;
+
+	// 10-bit samples are 8-bit samples shifted by 2 bits
+	const bool  b16Bit = AV_PIX_FMT_YUV420P10LE == DstFormat;
+	const float Scale  = b16Bit ? 4.0f : 1.0f;
+
+	FFloatKernelParams Params;
+	Params.ToneMapping  = Options.ToneMapping;
+	Params.EncodeTable  = Options.bLinear ? GetEncodeTable().Values : nullptr;
+	Params.b16Bit       = b16Bit;
+	Params.LumaScale    = 219.0f * Scale;
+	Params.LumaOffset   = 16.0f * Scale;
+	Params.ChromaScale  = 224.0f * Scale;
+	Params.ChromaOffset = 128.0f * Scale;
+
+	// threshold of quantization at Row and Column
+	const auto& ThresholdAt = [&](const int32 Row, const int32 Column) {
+		return Options.bDither ? (BayerMatrix[Row & 3][Column] + 0.5f) / 16.0f
+		                       : 0.5f;
+	};
+
+	for (int32 Row = RowBegin; Row < RowEnd; Row += 2) {
+		// the last row of odd height is duplicated for chroma
+		const bool bHasSecondRow = Row + 1 < Height;
+
+		FRowPairArgs Args;
+		Args.Src0 = SrcData + Row * SrcLineSize;
+		Args.Src1 = bHasSecondRow ? Args.Src0 + SrcLineSize : Args.Src0;
+		Args.Y0   = Frame.data[0] + Row * Frame.linesize[0];
+		Args.Y1   = bHasSecondRow ? Args.Y0 + Frame.linesize[0] : nullptr;
+		Args.U    = Frame.data[1] + (Row / 2) * Frame.linesize[1];
+		Args.V = bNV12 ? nullptr : Frame.data[2] + (Row / 2) * Frame.linesize[2];
+
+		// dithering pattern of this pair of rows
+		for (int32 Column = 0; Column < 4; ++Column) {
+			Params.LumaThresholds[0][Column] = ThresholdAt(Row, Column);
+			Params.LumaThresholds[1][Column] = ThresholdAt(Row + 1, Column);
+			Params.ChromaThresholds[Column]  = ThresholdAt(Row / 2, Column);
+		}
+
+		// vectorized kernel first, then the scalar kernel for the remainder
+		const int32 Converted = (bHasSecondRow && nullptr != Kernels.Vector)
+		                            ? Kernels.Vector(Args, Params, Width)
+		                            : 0;
+		Kernels.Tail(Args, Params, Converted, Width);
+	}
+}
+} // namespace
+
+bool FFFmpegPixelConversion::IsSupported(
+    const AVPixelFormat SrcFormat, const AVPixelFormat DstFormat) noexcept {
+	const bool bSupportedDst =
+	    AV_PIX_FMT_YUV420P == DstFormat || AV_PIX_FMT_NV12 == DstFormat;
+
+	// float sources can also be converted to 10-bit
+	if (IsFloatFormat(SrcFormat)) {
+		return bSupportedDst || AV_PIX_FMT_YUV420P10LE == DstFormat;
+	}
+
+	return bSupportedDst && nullptr != KernelsOf(SrcFormat).Tail;
+}
+
+bool FFFmpegPixelConversion::IsFloatFormat(const AVPixelFormat Format) noexcept {
+	return nullptr != FloatKernelsOf(Format).Tail;
+}
+
+bool FFFmpegPixelConversion::Convert(
+    const uint8* SrcData, const int64 SrcLineSize,
+    const AVPixelFormat SrcFormat, AVFrame& Frame,
+    const FFFmpegFloatConversionOptions& FloatOptions) {
+	return ConvertRows(SrcData, SrcLineSize, SrcFormat, Frame, 0, Frame.height,
+	                   FloatOptions);
+}
+
+bool FFFmpegPixelConversion::ConvertRows(
+    const uint8* SrcData, const int64 SrcLineSize,
+    const AVPixelFormat SrcFormat, AVFrame& Frame, const int32 RowBegin,
+    const int32 RowEnd, const FFFmpegFloatConversionOptions& FloatOptions) {
+	const auto& DstFormat = static_cast<AVPixelFormat>(Frame.format);
+	if (!IsSupported(SrcFormat, DstFormat)) {
+		return false;
+	}
+
+	// a pair of rows shares a chroma row
+	check(RowBegin % 2 == 0);
+	check(RowEnd % 2 == 0 || RowEnd == Frame.height);
+
+	// float sources have their own kernels
+	if (const auto& FloatKernels = FloatKernelsOf(SrcFormat);
+	    nullptr != FloatKernels.Tail) {
+		ConvertFloatRows(SrcData, SrcLineSize, FloatKernels, FloatOptions, Frame,
+		                 RowBegin, RowEnd);
+		return true;
+	}
+
+	const auto& Kernels = KernelsOf(SrcFormat);
+	const auto& Width   = Frame.width;
+	const auto& Height  = Frame.height;
+	const bool  bNV12   = AV_PIX_FMT_NV12 == DstFormat;
+
+	for (int32 Row = RowBegin; Row < RowEnd; Row += 2) {
+		// the last row of odd height is duplicated for chroma
+		const bool bHasSecondRow = Row + 1 < Height;
+
+		FRowPairArgs Args;
+		Args.Src0 = SrcData + Row * SrcLineSize;
+		Args.Src1 = bHasSecondRow ? Args.Src0 + SrcLineSize : Args.Src0;
+		Args.Y0   = Frame.data[0] + Row * Frame.linesize[0];
+		Args.Y1   = bHasSecondRow ? Args.Y0 + Frame.linesize[0] : nullptr;
+		Args.U    = Frame.data[1] + (Row / 2) * Frame.linesize[1];
+		Args.V = bNV12 ? nullptr : Frame.data[2] + (Row / 2) * Frame.linesize[2];
+
+		// vectorized kernel first, then the scalar kernel for the remainder
+		const int32 Converted = (bHasSecondRow && nullptr != Kernels.Vector)
+		                            ? Kernels.Vector(Args, Kernels.Coefficients, Width)
+		                            : 0;
+		Kernels.Tail(Args, Kernels.Coefficients, Converted, Width);
+	}
+
+	return true;
+}
+
+EFFmpegPixelConversionISA FFFmpegPixelConversion::GetActiveISA() noexcept {
+	return GetDispatchTable().ISA;
+}
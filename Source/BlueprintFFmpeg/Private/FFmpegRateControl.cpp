@@ -0,0 +1,111 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "FFmpegRateControl.h"
+#include "FFmpegCodecProfile.h"
+
+void FFFmpegRateControl::Configure(const FFFmpegEncoderConfig& Config,
+                                   const AVCodec&              Codec,
+                                   AVCodecContext&             Context,
+                                   AVDictionary*&              Options) {
+	// maximum rate the output is constrained to. 0 means unconstrained.
+	int64 MaxBitRate = Config.MaxBitRate;
+
+	// helper function to set a constant quality. codecs without the option,
+	// such as MJPEG, take it as a fixed quantizer scale.
+	const auto& SetQuality = [&](const char* Name, double Quality) {
+		if (FFFmpegCodecProfile::HasOption(Codec, Name)) {
+			av_dict_set(&Options, Name,
+			            TCHAR_TO_UTF8(*FString::SanitizeFloat(Quality)), 0);
+		} else {
+			Context.flags          |= AV_CODEC_FLAG_QSCALE;
+			Context.global_quality  = FMath::RoundToInt(FF_QP2LAMBDA * Quality);
+		}
+	};
+
+	switch (Config.RateControl) {
+	case EFFmpegRateControl::CQP:
+		// every frame is quantized with the same QP
+		Context.bit_rate = 0;
+		SetQuality("qp", Config.QP);
+		MaxBitRate = 0;
+		break;
+	case EFFmpegRateControl::ABR:
+		// the average over the whole video approaches BitRate
+		Context.bit_rate = Config.BitRate;
+		break;
+	case EFFmpegRateControl::CBR:
+		// every second is filled up to BitRate
+		Context.bit_rate    = Config.BitRate;
+		Context.rc_min_rate = Config.BitRate;
+		MaxBitRate          = Config.BitRate;
+		if (FFFmpegCodecProfile::HasOption(Codec, "nal-hrd")) {
+			av_dict_set(&Options, "nal-hrd", "cbr", 0);
+		}
+		break;
+	default:
+		// constant quality
+		Context.bit_rate = 0;
+		SetQuality("crf", Config.CRF);
+		break;
+	}
+
+	// set VBV. the buffer holds one second at the maximum rate by default.
+	if (0 < MaxBitRate) {
+		Context.rc_max_rate    = MaxBitRate;
+		Context.rc_buffer_size = 0 < Config.VBVBufferSize
+		                             ? Config.VBVBufferSize
+		                             : static_cast<int>(MaxBitRate);
+	}
+}
+
+void FFFmpegRateControl::Reset(const AVCodecContext& Context) {
+	// duration of a frame in seconds
+	FrameDuration = 0 < Context.framerate.num
+	                    ? av_q2d(av_inv_q(Context.framerate))
+	                    : av_q2d(Context.time_base);
+
+	// the buffer is modeled only if the output is constrained
+	const auto& bVBV = 0 < Context.rc_max_rate && 0 < Context.rc_buffer_size;
+	BufferSize   = bVBV ? static_cast<double>(Context.rc_buffer_size) : 0.0;
+	BitsPerFrame = bVBV ? Context.rc_max_rate * FrameDuration : 0.0;
+	Fullness     = BufferSize * InitialBufferFill;
+
+	std::lock_guard lk(Stats_mutex);
+	Stats               = {};
+	Stats.bVBV          = bVBV;
+	Stats.BufferFill    = bVBV ? InitialBufferFill : 0.0;
+	Stats.MinBufferFill = Stats.BufferFill;
+}
+
+double FFFmpegRateControl::AddFrame(int64 Bytes) {
+	// the decoder removes the frame from the buffer
+	bool bUnderflow = false;
+	if (0.0 < BufferSize) {
+		Fullness -= Bytes * 8.0;
+		if (Fullness < 0.0) {
+			bUnderflow = true;
+			Fullness   = 0.0;
+		}
+	}
+	const auto& BufferFill = 0.0 < BufferSize ? Fullness / BufferSize : 0.0;
+
+	// and the buffer refills until the next frame
+	Fullness = FMath::Min(Fullness + BitsPerFrame, BufferSize);
+
+	std::lock_guard lk(Stats_mutex);
+	Stats.BufferFill    = BufferFill;
+	Stats.MinBufferFill = FMath::Min(Stats.MinBufferFill, BufferFill);
+	Stats.NumUnderflows += bUnderflow ? 1 : 0;
+	Stats.NumFrames     += 1;
+	Stats.TotalBytes    += Bytes;
+	Stats.AverageBitRate =
+	    0.0 < FrameDuration
+	        ? Stats.TotalBytes * 8.0 / (Stats.NumFrames * FrameDuration)
+	        : 0.0;
+	return BufferFill;
+}
+
+FFFmpegRateControlStats FFFmpegRateControl::GetStats() const {
+	std::lock_guard lk(Stats_mutex);
+	return Stats;
+}
@@ -0,0 +1,94 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "FFmpegReadbackPoller.h"
+
+#include "Algo/AllOf.h"
+#include "RenderingThread.h"
+
+FFFmpegReadbackPoller& FFFmpegReadbackPoller::Get() {
+	static FFFmpegReadbackPoller Instance;
+	return Instance;
+}
+
+void FFFmpegReadbackPoller::Start() {
+	if (TickerHandle.IsValid()) {
+		return;
+	}
+
+	TickerHandle = FTSTicker::GetCoreTicker().AddTicker(
+	    FTickerDelegate::CreateRaw(this, &FFFmpegReadbackPoller::Tick));
+}
+
+void FFFmpegReadbackPoller::Stop() {
+	if (TickerHandle.IsValid()) {
+		FTSTicker::GetCoreTicker().RemoveTicker(TickerHandle);
+		TickerHandle.Reset();
+	}
+
+	// no tick polls the readbacks left
+	Flush();
+}
+
+void FFFmpegReadbackPoller::Add(
+    const TArrayView<FRHIGPUReadback* const> Readbacks,
+    TUniqueFunction<void()>                  OnReady) {
+	check(IsInRenderingThread());
+
+	// complete earlier captures whose copies have finished
+	Poll();
+
+	auto& Capture = Pending.AddDefaulted_GetRef();
+	Capture.Readbacks.Append(Readbacks.GetData(), Readbacks.Num());
+	Capture.OnReady = MoveTemp(OnReady);
+	++NumPending;
+}
+
+void FFFmpegReadbackPoller::Flush() { QueuePoll(true); }
+
+bool FFFmpegReadbackPoller::Tick(float DeltaTime) {
+	QueuePoll(false);
+	return true;
+}
+
+void FFFmpegReadbackPoller::QueuePoll(const bool bSubmit) {
+	// poll once at a time, even if the render thread is frames behind
+	if (0 == NumPending || bPollQueued.exchange(true)) {
+		return;
+	}
+
+	// On Render Thread
+	ENQUEUE_RENDER_COMMAND(PollFFmpegReadbacks)
+	([this, bSubmit](FRHICommandListImmediate& RHICmdList) {
+		bPollQueued = false;
+
+		// the copies may still be in the command list while the game thread
+		// is blocked, so hand them to the GPU without waiting for it
+		if (bSubmit) {
+			RHICmdList.ImmediateFlush(EImmediateFlushType::DispatchToRHIThread);
+		}
+
+		Poll();
+	});
+}
+
+void FFFmpegReadbackPoller::Poll() {
+	for (int32 Index = 0; Index < Pending.Num();) {
+		auto& Capture = Pending[Index];
+
+		// helper function to tell if a readback has completed
+		const auto& IsReady = [](FRHIGPUReadback* Readback) {
+			return Readback->IsReady();
+		};
+
+		if (!Algo::AllOf(Capture.Readbacks, IsReady)) {
+			++Index;
+			continue;
+		}
+
+		// complete the capture
+		auto OnReady = MoveTemp(Capture.OnReady);
+		Pending.RemoveAt(Index);
+		--NumPending;
+		OnReady();
+	}
+}
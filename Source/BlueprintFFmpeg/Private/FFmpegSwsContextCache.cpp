@@ -0,0 +1,123 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "FFmpegSwsContextCache.h"
+
+#pragma region FScopedContext
+FFFmpegSwsContextCache::FScopedContext::FScopedContext(
+    FFFmpegSwsContextCache& InCache, const FFFmpegSwsContextKey& InKey,
+    SwsContext* InContext)
+    : Cache(&InCache), Key(InKey), Context(InContext) {}
+
+FFFmpegSwsContextCache::FScopedContext::FScopedContext(
+    FScopedContext&& Other) noexcept
+    : Cache(Other.Cache), Key(Other.Key), Context(Other.Context) {
+	Other.Cache   = nullptr;
+	Other.Context = nullptr;
+}
+
+FFFmpegSwsContextCache::FScopedContext&
+    FFFmpegSwsContextCache::FScopedContext::operator=(
+        FScopedContext&& Other) noexcept {
+	if (this != &Other) {
+		// return the context currently held
+		Reset();
+
+		// take over Other
+		Cache         = Other.Cache;
+		Key           = Other.Key;
+		Context       = Other.Context;
+		Other.Cache   = nullptr;
+		Other.Context = nullptr;
+	}
+	return *this;
+}
+
+FFFmpegSwsContextCache::FScopedContext::~FScopedContext() { Reset(); }
+
+void FFFmpegSwsContextCache::FScopedContext::Reset() {
+	if (nullptr != Cache && nullptr != Context) {
+		Cache->Release(Key, Context);
+	}
+	Cache   = nullptr;
+	Context = nullptr;
+}
+#pragma endregion
+
+FFFmpegSwsContextCache& FFFmpegSwsContextCache::Get() {
+	static FFFmpegSwsContextCache Instance;
+	return Instance;
+}
+
+FFFmpegSwsContextCache::FScopedContext
+    FFFmpegSwsContextCache::Acquire(const FFFmpegSwsContextKey& Key) {
+	// take an idle context if exists
+	{
+		FScopeLock Lock(&IdleContexts_Mutex);
+
+		if (const auto& Contexts = IdleContexts.Find(Key);
+		    nullptr != Contexts && !Contexts->IsEmpty()) {
+			++Hits;
+			return FScopedContext(*this, Key, Contexts->Pop());
+		}
+	}
+
+	// otherwise create a new context out of the lock
+	++Misses;
+	const auto& Context = sws_getContext(
+	    Key.SrcWidth, Key.SrcHeight, Key.SrcFormat, Key.DstWidth, Key.DstHeight,
+	    Key.DstFormat, Key.Flags, nullptr, nullptr, nullptr);
+	if (nullptr == Context) {
+		return FScopedContext();
+	}
+
+	return FScopedContext(*this, Key, Context);
+}
+
+FFFmpegSwsContextCacheStats FFFmpegSwsContextCache::GetStats() const {
+	FFFmpegSwsContextCacheStats Stats;
+	Stats.Hits   = Hits.load();
+	Stats.Misses = Misses.load();
+
+	FScopeLock Lock(&IdleContexts_Mutex);
+	for (const auto& [Key, Contexts] : IdleContexts) {
+		Stats.NumIdleContexts += Contexts.Num();
+	}
+
+	return Stats;
+}
+
+void FFFmpegSwsContextCache::Empty() {
+	// take all idle contexts
+	TMap<FFFmpegSwsContextKey, TArray<SwsContext*>> ContextsToFree;
+	{
+		FScopeLock Lock(&IdleContexts_Mutex);
+		ContextsToFree = MoveTemp(IdleContexts);
+		IdleContexts.Reset();
+	}
+
+	// free them out of the lock
+	for (const auto& [Key, Contexts] : ContextsToFree) {
+		for (const auto& Context : Contexts) {
+			sws_freeContext(Context);
+		}
+	}
+}
+
+FFFmpegSwsContextCache::~FFFmpegSwsContextCache() { Empty(); }
+
+void FFFmpegSwsContextCache::Release(const FFFmpegSwsContextKey& Key,
+                                     SwsContext*                 Context) {
+	{
+		FScopeLock Lock(&IdleContexts_Mutex);
+
+		// keep the context for the next Acquire
+		auto& Contexts = IdleContexts.FindOrAdd(Key);
+		if (Contexts.Num() < MaxIdleContextsPerKey) {
+			Contexts.Push(Context);
+			return;
+		}
+	}
+
+	// too many idle contexts
+	sws_freeContext(Context);
+}
@@ -0,0 +1,91 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "FFmpegTextureReadbackRing.h"
+
+#include "CreateImageFromTextureRHI.h"
+#include "FFmpegImagePool.h"
+#include "FFmpegReadbackPoller.h"
+
+FFFmpegTextureReadbackRing::FFFmpegTextureReadbackRing(const int32 InDepth) {
+	// at least one slot
+	Slots.SetNum(FMath::Max(1, InDepth));
+}
+
+bool FFFmpegTextureReadbackRing::IsSupported(
+    const EPixelFormat PixelFormat) noexcept {
+	ERawImageFormat::Type ImageFormat;
+	EGammaSpace           GammaSpace;
+	return CreateImageFromTextureRHI_Private::ImageFormatOf(
+	    PixelFormat, ImageFormat, GammaSpace);
+}
+
+UE::Tasks::TTask<FImage>
+    FFFmpegTextureReadbackRing::Enqueue(FTextureRHIRef TextureRHI) {
+	namespace Tasks = UE::Tasks;
+
+	// get description of source texture RHI
+	const auto& Desc = TextureRHI->GetDesc();
+
+	// get format of the image
+	ERawImageFormat::Type ImageFormat;
+	EGammaSpace           GammaSpace;
+	verify(CreateImageFromTextureRHI_Private::ImageFormatOf(
+	    Desc.Format, ImageFormat, GammaSpace));
+
+	// the image is filled on the render thread
+	auto Image = MakeShared<FImage, ESPMode::ThreadSafe>(
+	    FFFmpegImagePool::Get().Acquire(Desc.Extent.X, Desc.Extent.Y,
+	                                    ImageFormat, GammaSpace));
+
+	// signaled when the image is filled
+	Tasks::FTaskEvent Mapped(UE_SOURCE_LOCATION);
+
+	// On Render Thread
+	ENQUEUE_RENDER_COMMAND(EnqueueTextureReadback)
+	([This = AsShared(), TextureRHI = MoveTemp(TextureRHI), Image,
+	  Mapped](FRHICommandListImmediate& RHICmdList) mutable {
+		// every slot is in flight, so read back into a staging buffer of its
+		// own instead of waiting for a slot
+		const auto Index = This->Slots.IndexOfByPredicate(
+		    [](const FSlot& Slot) { return !Slot.bInFlight; });
+		if (INDEX_NONE == Index) {
+			CreateImageFromTextureRHI_Private::EnqueueReadbackToImage(
+			    RHICmdList, TextureRHI, MoveTemp(Image), MoveTemp(Mapped));
+			return;
+		}
+		auto& Slot = This->Slots[Index];
+
+		// create readback on first use
+		if (!Slot.Readback.IsValid()) {
+			Slot.Readback = MakeUnique<FRHIGPUTextureReadback>(
+			    TEXT("FFmpegTextureReadbackRing"));
+		}
+
+		// copy texture to staging buffer without waiting
+		Slot.Readback->EnqueueCopy(RHICmdList, TextureRHI);
+		Slot.Image     = MoveTemp(Image);
+		Slot.Mapped    = MoveTemp(Mapped);
+		Slot.bInFlight = true;
+
+		// map it once the copy has completed
+		FRHIGPUReadback* const Readbacks[] = {Slot.Readback.Get()};
+		FFFmpegReadbackPoller::Get().Add(
+		    Readbacks, [This, Index]() { This->Resolve(This->Slots[Index]); });
+	});
+
+	// the task runs only after the image is filled, so it never waits
+	return Tasks::Launch(
+	    UE_SOURCE_LOCATION, [Image]() { return MoveTemp(*Image); }, Mapped,
+	    LowLevelTasks::ETaskPriority::BackgroundNormal);
+}
+
+void FFFmpegTextureReadbackRing::Resolve(FSlot& Slot) {
+	// copy staging buffer to the image
+	CreateImageFromTextureRHI_Private::CopyReadbackToImage(*Slot.Readback,
+	                                                      *Slot.Image);
+
+	// complete the capture
+	Slot.Image.Reset();
+	Slot.Mapped.Trigger();
+	Slot.bInFlight = false;
+}
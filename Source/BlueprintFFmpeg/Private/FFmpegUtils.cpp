@@ -2,11 +2,678 @@
 
 #include "FFmpegUtils.h"
 
+#include "Async/ParallelFor.h"
 #include "FFmpegEncoder.h"
+#include "FFmpegEncoderPool.h"
+#include "FFmpegPixelConversion.h"
+#include "FFmpegSwsContextCache.h"
+#include "HAL/FileManager.h"
+#include "HAL/IConsoleManager.h"
+#include "LogFFmpegEncoder.h"
+#include "Misc/Paths.h"
+#include "Misc/ScopeExit.h"
+
+#include <atomic>
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+}
+
+namespace {
+TAutoConsoleVariable<bool> CVarPixelConversionEnable(
+    TEXT("ffmpeg.PixelConversion.Enable"), false,
+    TEXT("If true, use the dedicated vectorized kernels for the formats they ")
+        TEXT("support instead of swscale. Their output is not verified to ")
+            TEXT("match swscale, so they are off by default."));
+
+TAutoConsoleVariable<bool> CVarPixelConversionValidate(
+    TEXT("ffmpeg.PixelConversion.Validate"), false,
+    TEXT("If true, every frame converted by the dedicated kernels is also ")
+        TEXT("converted by swscale and the results are compared and logged. ")
+            TEXT("Slow, for debugging only."));
+
+/**
+ * Rectangle in pixels
+ */
+struct FRect {
+	int32 X      = 0;
+	int32 Y      = 0;
+	int32 Width  = 0;
+	int32 Height = 0;
+
+	bool operator==(const FRect& Other) const = default;
+};
+
+/**
+ * Rows [Begin, End) of a frame
+ */
+struct FBand {
+	int32 Begin = 0;
+	int32 End   = 0;
+};
+
+using FBandArray = TArray<FBand, TInlineAllocator<16>>;
+
+/**
+ * @return   flags of swscale for Filter
+ */
+int32 SwsFlagsOf(const EFFmpegScaleFilter Filter) {
+	switch (Filter) {
+	case EFFmpegScaleFilter::Point:
+		return SWS_POINT;
+	case EFFmpegScaleFilter::Area:
+		return SWS_AREA;
+	case EFFmpegScaleFilter::Lanczos:
+		return SWS_LANCZOS;
+	case EFFmpegScaleFilter::Bilinear:
+	default:
+		return SWS_BILINEAR;
+	}
+}
+
+/**
+ * Compute which part of the source is drawn to which part of the destination.
+ * Rectangles in the destination are aligned to 2 pixels for chroma
+ * subsampling.
+ */
+void ComputeFitRects(const int32 SrcWidth, const int32 SrcHeight,
+                     const int32 DstWidth, const int32 DstHeight,
+                     const EFFmpegScaleFitMode FitMode, FRect& SrcRect,
+                     FRect& DstRect) {
+	SrcRect = {0, 0, SrcWidth, SrcHeight};
+	DstRect = {0, 0, DstWidth, DstHeight};
+
+	// compare aspect ratios without division
+	const auto& SrcCross = static_cast<int64>(SrcWidth) * DstHeight;
+	const auto& DstCross = static_cast<int64>(DstWidth) * SrcHeight;
+	if (SrcCross == DstCross) {
+		return;
+	}
+	const bool bSrcIsWider = SrcCross > DstCross;
+
+	// round down to an even number, but not to 0
+	const auto& AlignToEven = [](const int64 Value) {
+		return FMath::Max(2, static_cast<int32>(Value) & ~1);
+	};
+
+	switch (FitMode) {
+	case EFFmpegScaleFitMode::Letterbox:
+		// shrink the destination
+		if (bSrcIsWider) {
+			DstRect.Height = FMath::Min(DstHeight, AlignToEven(DstCross / SrcWidth));
+			DstRect.Y      = ((DstHeight - DstRect.Height) / 2) & ~1;
+		} else {
+			DstRect.Width = FMath::Min(DstWidth, AlignToEven(SrcCross / SrcHeight));
+			DstRect.X     = ((DstWidth - DstRect.Width) / 2) & ~1;
+		}
+		break;
+	case EFFmpegScaleFitMode::Crop:
+		// shrink the source
+		if (bSrcIsWider) {
+			SrcRect.Width = FMath::Max<int32>(1, DstCross / DstHeight);
+			SrcRect.X     = (SrcWidth - SrcRect.Width) / 2;
+		} else {
+			SrcRect.Height = FMath::Max<int32>(1, SrcCross / DstWidth);
+			SrcRect.Y      = (SrcHeight - SrcRect.Height) / 2;
+		}
+		break;
+	case EFFmpegScaleFitMode::Stretch:
+	default:
+		break;
+	}
+}
+
+/**
+ * Get pointers to the top left of Rect in every plane of Frame.
+ */
+void OffsetPlanes(const AVFrame& Frame, const FRect& Rect,
+                  uint8* (&OutData)[AV_NUM_DATA_POINTERS]) {
+	const auto& Format     = static_cast<AVPixelFormat>(Frame.format);
+	const auto& Descriptor = av_pix_fmt_desc_get(Format);
+
+	FMemory::Memzero(OutData);
+	for (int32 Plane = 0; Plane < av_pix_fmt_count_planes(Format); ++Plane) {
+		// planes 1 and 2 are subsampled
+		const bool  bChroma = Plane == 1 || Plane == 2;
+		const auto& Row     = bChroma ? Rect.Y >> Descriptor->log2_chroma_h : Rect.Y;
+		const auto& ColumnBytes =
+		    FMath::Max(0, av_image_get_linesize(Format, Rect.X, Plane));
+
+		OutData[Plane] = Frame.data[Plane] +
+		                 static_cast<int64>(Row) * Frame.linesize[Plane] +
+		                 ColumnBytes;
+	}
+}
+
+/**
+ * Make a frame that refers to Rect of Frame. Buffers are shared with Frame.
+ */
+AVFrame* MakeFrameView(const AVFrame& Frame, const FRect& Rect) {
+	AVFrame* View = av_frame_alloc();
+	if (nullptr == View) {
+		return nullptr;
+	}
+
+	View->format = Frame.format;
+	View->width  = Rect.Width;
+	View->height = Rect.Height;
+
+	// share buffers
+	for (int32 Index = 0; Index < AV_NUM_DATA_POINTERS; ++Index) {
+		if (nullptr == Frame.buf[Index]) {
+			continue;
+		}
+		View->buf[Index] = av_buffer_ref(Frame.buf[Index]);
+		if (nullptr == View->buf[Index]) {
+			av_frame_free(&View);
+			return nullptr;
+		}
+	}
+
+	// point to Rect
+	OffsetPlanes(Frame, Rect, View->data);
+	FMemory::Memcpy(View->linesize, Frame.linesize);
+
+	return View;
+}
+
+/**
+ * Wrap pixels of Image into AVFrame without copying. The frame must not
+ * outlive Image.
+ */
+AVFrame* WrapImageAsFrame(const FImage& Image) {
+	AVFrame* Frame = av_frame_alloc();
+	if (nullptr == Frame) {
+		return nullptr;
+	}
+
+	Frame->format = UFFmpegUtils::FFmpegFrameFormatOf(Image.Format);
+	Frame->width  = Image.GetWidth();
+	Frame->height = Image.GetHeight();
+
+	// a reference counted buffer that never frees the pixels
+	Frame->buf[0] = av_buffer_create(
+	    const_cast<uint8*>(Image.RawData.GetData()), Image.RawData.Num(),
+	    [](void*, uint8_t*) {}, nullptr, AV_BUFFER_FLAG_READONLY);
+	if (nullptr == Frame->buf[0]) {
+		av_frame_free(&Frame);
+		return nullptr;
+	}
+
+	Frame->data[0]     = Frame->buf[0]->data;
+	Frame->linesize[0] = Image.GetWidth() * Image.GetBytesPerPixel();
+
+	return Frame;
+}
+
+/**
+ * Fill Rect of Frame with black.
+ */
+void FillBlack(AVFrame& Frame, const FRect& Rect) {
+	if (Rect.Width <= 0 || Rect.Height <= 0) {
+		return;
+	}
+
+	uint8* Data[AV_NUM_DATA_POINTERS];
+	OffsetPlanes(Frame, Rect, Data);
+
+	uint8_t*  BlackData[4]     = {Data[0], Data[1], Data[2], Data[3]};
+	ptrdiff_t BlackLineSize[4] = {Frame.linesize[0], Frame.linesize[1],
+	                              Frame.linesize[2], Frame.linesize[3]};
+	av_image_fill_black(BlackData, BlackLineSize,
+	                    static_cast<AVPixelFormat>(Frame.format),
+	                    AVCOL_RANGE_MPEG, Rect.Width, Rect.Height);
+}
+
+/**
+ * Split Height rows into bands as specified by Options.
+ * Every band except the last one has a multiple of Alignment rows.
+ */
+FBandArray SplitIntoBands(const int32                     Height,
+                          const FFFmpegConversionOptions& Options,
+                          const int32                     Alignment) {
+	FBandArray Bands;
+
+	// convert at once
+	if (Options.BandHeight <= 0 || Options.MaxBands <= 1) {
+		Bands.Add({0, Height});
+		return Bands;
+	}
+
+	// number of bands and rows per band
+	const auto& NumBands =
+	    FMath::Clamp(FMath::DivideAndRoundUp(Height, Options.BandHeight), 1,
+	                 Options.MaxBands);
+	const auto& BandHeight =
+	    FMath::DivideAndRoundUp(FMath::DivideAndRoundUp(Height, NumBands),
+	                            Alignment) *
+	    Alignment;
+
+	for (int32 Begin = 0; Begin < Height; Begin += BandHeight) {
+		Bands.Add({Begin, FMath::Min(Begin + BandHeight, Height)});
+	}
+
+	return Bands;
+}
+
+/**
+ * Convert and scale Src into Dst with swscale in a single pass.
+ */
+bool ConvertFrameWithSwscale(const AVFrame& Src, AVFrame& Dst,
+                             const FFFmpegConversionOptions& Options) {
+	// key of SwsContext in the cache
+	FFFmpegSwsContextKey Key;
+	Key.SrcFormat = static_cast<AVPixelFormat>(Src.format);
+	Key.SrcWidth  = Src.width;
+	Key.SrcHeight = Src.height;
+	Key.DstFormat = static_cast<AVPixelFormat>(Dst.format);
+	Key.DstWidth  = Dst.width;
+	Key.DstHeight = Dst.height;
+	Key.Flags     = SwsFlagsOf(Options.ScaleFilter);
+
+	// split into bands
+	FBandArray Bands;
+	{
+		// borrow SwsContext to know the alignment of slices
+		const auto& SwsConvertFormatContext =
+		    FFFmpegSwsContextCache::Get().Acquire(Key);
+		if (!SwsConvertFormatContext) {
+			UE_LOG(LogFFmpegEncoder, Error, TEXT("Failed to create SwsContext."));
+			return false;
+		}
+
+		// bands can be converted in parallel only if both frames have
+		// reference counted buffers, otherwise swscale allocates new ones
+		const bool  bCanSplit = nullptr != Src.buf[0] && nullptr != Dst.buf[0];
+		const auto& Alignment = FMath::Max(
+		    2, static_cast<int32>(
+		           sws_receive_slice_alignment(SwsConvertFormatContext.Get())));
+		Bands = SplitIntoBands(
+		    Key.DstHeight, bCanSplit ? Options : FFFmpegConversionOptions(),
+		    Alignment);
+
+		// convert at once
+		if (Bands.Num() == 1) {
+			sws_scale(SwsConvertFormatContext.Get(), Src.data, Src.linesize, 0,
+			          Src.height, Dst.data, Dst.linesize);
+			return true;
+		}
+	}
+
+	// convert each band with its own SwsContext
+	std::atomic_bool bSucceeded = true;
+	ParallelFor(Bands.Num(), [&](const int32 BandIndex) {
+		const auto& [Begin, End] = Bands[BandIndex];
+
+		const auto& SwsConvertFormatContext =
+		    FFFmpegSwsContextCache::Get().Acquire(Key);
+		if (!SwsConvertFormatContext) {
+			bSucceeded = false;
+			return;
+		}
+
+		// swscale reads only the source rows needed for this band
+		const auto& Context = SwsConvertFormatContext.Get();
+		if (sws_frame_start(Context, &Dst, &Src) < 0) {
+			bSucceeded = false;
+			return;
+		}
+		if (sws_send_slice(Context, 0, Src.height) < 0 ||
+		    sws_receive_slice(Context, Begin, End - Begin) < 0) {
+			bSucceeded = false;
+		}
+		sws_frame_end(Context);
+	});
+
+	if (!bSucceeded) {
+		UE_LOG(LogFFmpegEncoder, Error, TEXT("Failed to convert bands."));
+	}
+
+	return bSucceeded;
+}
+
+/**
+ * Convert Src with swscale as well and log how much Dst differs from it.
+ */
+void ValidateAgainstSwscale(const AVFrame& Src, const AVFrame& Dst) {
+	// convert with swscale into a scratch frame
+	AVFrame* ReferenceFrame = av_frame_alloc();
+	ReferenceFrame->format  = Dst.format;
+	ReferenceFrame->width   = Dst.width;
+	ReferenceFrame->height  = Dst.height;
+	if (av_frame_get_buffer(ReferenceFrame, 0) < 0 ||
+	    !ConvertFrameWithSwscale(Src, *ReferenceFrame, {})) {
+		UE_LOG(LogFFmpegEncoder, Error,
+		       TEXT("Failed to convert the reference frame for validation."));
+		av_frame_free(&ReferenceFrame);
+		return;
+	}
+
+	// compare every plane
+	const auto& Format        = static_cast<AVPixelFormat>(Dst.format);
+	const auto& Descriptor    = av_pix_fmt_desc_get(Format);
+	int32       MaxDifference = 0;
+	int64       NumMismatches = 0;
+	for (int32 Plane = 0; Plane < av_pix_fmt_count_planes(Format); ++Plane) {
+		const auto& Bytes  = av_image_get_linesize(Format, Dst.width, Plane);
+		const auto& Height = Plane == 0 ? Dst.height
+		                                : AV_CEIL_RSHIFT(Dst.height,
+		                                                 Descriptor->log2_chroma_h);
+		for (int32 Row = 0; Row < Height; ++Row) {
+			const auto& Actual =
+			    Dst.data[Plane] + static_cast<int64>(Row) * Dst.linesize[Plane];
+			const auto& Expected = ReferenceFrame->data[Plane] +
+			                       static_cast<int64>(Row) *
+			                           ReferenceFrame->linesize[Plane];
+			for (int32 Column = 0; Column < Bytes; ++Column) {
+				const auto& Difference = FMath::Abs(Actual[Column] - Expected[Column]);
+				MaxDifference          = FMath::Max(MaxDifference, Difference);
+				NumMismatches += Difference != 0 ? 1 : 0;
+			}
+		}
+	}
+	av_frame_free(&ReferenceFrame);
+
+	// the kernels filter chroma and round differently from swscale, so the
+	// difference is only reported
+	UE_LOG(LogFFmpegEncoder, Log,
+	       TEXT("Pixel conversion compared with swscale: max difference %d, "
+	            "%lld mismatched samples."),
+	       MaxDifference, NumMismatches);
+}
+
+/**
+ * Convert Src into Dst. Scales if their sizes differ.
+ */
+bool ConvertFrame(const AVFrame& Src, AVFrame& Dst,
+                  const FFFmpegConversionOptions&      Options,
+                  const FFFmpegFloatConversionOptions& FloatOptions) {
+	const auto& SrcFormat = static_cast<AVPixelFormat>(Src.format);
+	const auto& DstFormat = static_cast<AVPixelFormat>(Dst.format);
+
+	// use the dedicated kernels if they support this conversion
+	const bool bUseKernels =
+	    CVarPixelConversionEnable.GetValueOnAnyThread() &&
+	    FFFmpegPixelConversion::IsSupported(SrcFormat, DstFormat);
+	const bool bSameSize = Src.width == Dst.width && Src.height == Dst.height;
+	if (bUseKernels && bSameSize) {
+		// convert bands in parallel. a pair of rows shares a chroma row.
+		const auto& Bands = SplitIntoBands(Dst.height, Options, 2);
+		ParallelFor(Bands.Num(), [&](const int32 BandIndex) {
+			FFFmpegPixelConversion::ConvertRows(
+			    Src.data[0], Src.linesize[0], SrcFormat, Dst,
+			    Bands[BandIndex].Begin, Bands[BandIndex].End, FloatOptions);
+		});
+
+		// compare with swscale if requested. swscale does not tone map, so
+		// float images are not compared.
+		if (CVarPixelConversionValidate.GetValueOnAnyThread() &&
+		    !FFFmpegPixelConversion::IsFloatFormat(SrcFormat)) {
+			ValidateAgainstSwscale(Src, Dst);
+		}
+
+		return true;
+	}
+
+	// swscale does not tone map float images, so convert them at the source
+	// size first and then scale in YUV
+	if (bUseKernels && FFFmpegPixelConversion::IsFloatFormat(SrcFormat)) {
+		AVFrame* IntermediateFrame = av_frame_alloc();
+		if (nullptr == IntermediateFrame) {
+			return false;
+		}
+		IntermediateFrame->format = Dst.format;
+		IntermediateFrame->width  = Src.width;
+		IntermediateFrame->height = Src.height;
+
+		const bool bSucceeded =
+		    av_frame_get_buffer(IntermediateFrame, 0) >= 0 &&
+		    ConvertFrame(Src, *IntermediateFrame, Options, FloatOptions) &&
+		    ConvertFrameWithSwscale(*IntermediateFrame, Dst, Options);
+
+		av_frame_free(&IntermediateFrame);
+		return bSucceeded;
+	}
+
+	// otherwise scale and convert with swscale
+	return ConvertFrameWithSwscale(Src, Dst, Options);
+}
+
+/**
+ * Convert Src into Dst, fitting it by the fit mode of Options. Bars around
+ * the fitted image are filled with black.
+ */
+bool ConvertFrameToFit(const AVFrame& Src, AVFrame& Dst,
+                       const FFFmpegConversionOptions&      Options,
+                       const FFFmpegFloatConversionOptions& FloatOptions) {
+	// which part of Src goes to which part of Dst
+	FRect SrcRect, DstRect;
+	ComputeFitRects(Src.width, Src.height, Dst.width, Dst.height,
+	                Options.ScaleFitMode, SrcRect, DstRect);
+
+	// fill bars around the image with black
+	if (DstRect != FRect{0, 0, Dst.width, Dst.height}) {
+		const auto& DstRight  = DstRect.X + DstRect.Width;
+		const auto& DstBottom = DstRect.Y + DstRect.Height;
+		FillBlack(Dst, {0, 0, Dst.width, DstRect.Y});
+		FillBlack(Dst, {0, DstBottom, Dst.width, Dst.height - DstBottom});
+		FillBlack(Dst, {0, DstRect.Y, DstRect.X, DstRect.Height});
+		FillBlack(Dst,
+		          {DstRight, DstRect.Y, Dst.width - DstRight, DstRect.Height});
+	}
+
+	// convert between views of the rectangles
+	AVFrame* SrcView    = MakeFrameView(Src, SrcRect);
+	AVFrame* DstView    = MakeFrameView(Dst, DstRect);
+	const bool bSucceeded =
+	    nullptr != SrcView && nullptr != DstView &&
+	    ConvertFrame(*SrcView, *DstView, Options, FloatOptions);
+
+	av_frame_free(&SrcView);
+	av_frame_free(&DstView);
+
+	return bSucceeded;
+}
+
+// keyframe interval of x264 when GopSize is left to the preset
+constexpr int32 DefaultGopSize = 250;
+
+// logical cores per encoder when the number of chunks is chosen automatically
+constexpr int32 CoresPerChunk = 4;
+
+/**
+ * @return   number of encoders GenerateVideoFromImageFiles runs for
+ *           NumFrames frames.
+ */
+int32 NumChunksOf(const FFFmpegEncoderConfig& Config, int32 NumFrames) {
+	const auto& NumChunks =
+	    0 < Config.NumParallelChunks
+	        ? Config.NumParallelChunks
+	        : FPlatformMisc::NumberOfCoresIncludingHyperthreads() / CoresPerChunk;
+
+	// every chunk holds at least one GOP
+	const auto& GopSize = 0 < Config.GopSize ? Config.GopSize : DefaultGopSize;
+	return FMath::Clamp(NumChunks, 1,
+	                    FMath::DivideAndRoundUp(NumFrames, GopSize));
+}
+
+/**
+ * @return   task loading the image at ImagePath on a worker, completed with an
+ *           empty image if it can not be loaded.
+ */
+UE::Tasks::TTask<FImage> LoadImageAsync(const FString& ImagePath) {
+	return UE::Tasks::Launch(
+	    UE_SOURCE_LOCATION,
+	    [ImagePath]() {
+		    FImage Image;
+		    if (!FImageUtils::LoadImage(*ImagePath, Image)) {
+			    return FImage();
+		    }
+		    return Image;
+	    },
+	    LowLevelTasks::ETaskPriority::BackgroundNormal);
+}
+
+/**
+ * Split InputImagePaths into chunks of whole GOPs, encode them on NumChunks
+ * encoders in parallel, and join them into OutputFilePath by stream copy.
+ * Each chunk starts with a keyframe and does not reference other chunks, so
+ * the joined video plays as if it was encoded by one encoder.
+ */
+void GenerateVideoInChunks(const FString&              OutputFilePath,
+                           const TArray<FString>&      InputImagePaths,
+                           const FFFmpegEncoderConfig& Config,
+                           int32                       NumChunks) {
+	// chunks are split at keyframes
+	const auto& GopSize = 0 < Config.GopSize ? Config.GopSize : DefaultGopSize;
+	const auto& NumFrames = InputImagePaths.Num();
+	const auto& FramesPerChunk =
+	    FMath::DivideAndRoundUp(FMath::DivideAndRoundUp(NumFrames, NumChunks),
+	                            GopSize) *
+	    GopSize;
+
+	// the cores are shared between the encoders
+	auto ChunkConfig = Config;
+	if (0 == ChunkConfig.Threads) {
+		ChunkConfig.Threads = FMath::Max(
+		    1, FPlatformMisc::NumberOfCoresIncludingHyperthreads() / NumChunks);
+	}
+	ChunkConfig.ExpectedDuration = Config.ExpectedDuration / NumChunks;
+
+	// the codec settings of a chunk are not reused by a following recording
+	ChunkConfig.bPrewarmOnClose = false;
+
+	// open an encoder per chunk, written next to the output file
+	TArray<FString>                         ChunkPaths;
+	TArray<TUniquePtr<FFFmpegEncodeThread>> Encoders;
+	for (int32 Begin = 0; Begin < NumFrames; Begin += FramesPerChunk) {
+		ChunkPaths.Add(FPaths::Combine(
+		    FPaths::GetPath(OutputFilePath),
+		    FString::Printf(TEXT("%s.chunk%d.%s"),
+		                    *FPaths::GetBaseFilename(OutputFilePath),
+		                    ChunkPaths.Num(),
+		                    *FPaths::GetExtension(OutputFilePath))));
+
+		FFmpegEncoderOpenResult OpenResult;
+		FString                 Open_ErrorMessage;
+		Encoders.Add(MakeUnique<FFFmpegEncodeThread>());
+		Encoders.Last()->Open(ChunkConfig, ChunkPaths.Last(), OpenResult,
+		                      Open_ErrorMessage);
+		check(FFmpegEncoderOpenResult::Success == OpenResult);
+	}
+
+	// add frames to the chunks in turn, so that every encoder always has
+	// frames to encode
+	TArray<TPair<int32, int32>> Order;
+	for (int32 Offset = 0; Offset < FramesPerChunk; ++Offset) {
+		for (int32 Chunk = 0; Chunk < Encoders.Num(); ++Chunk) {
+			const auto& Index = Chunk * FramesPerChunk + Offset;
+			if (Index < NumFrames) {
+				Order.Emplace(Chunk, Index);
+			}
+		}
+	}
+
+	// images are decoded on the workers, a few frames ahead of the frame
+	// being added
+	const auto& NumLoadsAhead = FMath::Max(
+	    1, static_cast<int32>(LowLevelTasks::FScheduler::Get().GetNumWorkers()));
+	TArray<UE::Tasks::TTask<FImage>> Loads;
+	Loads.SetNum(Order.Num());
+	int32 NumLoadsLaunched = 0;
+
+	bool  bFailed             = false;
+	int32 NumDroppedFrames    = 0;
+	int32 NumDuplicatedFrames = 0;
+	for (int32 Step = 0; Step < Order.Num(); ++Step) {
+		const auto& [Chunk, Index] = Order[Step];
+
+		// keep the loads ahead in flight
+		for (; NumLoadsLaunched < Order.Num() &&
+		       NumLoadsLaunched <= Step + NumLoadsAhead;
+		     ++NumLoadsLaunched) {
+			Loads[NumLoadsLaunched] =
+			    LoadImageAsync(InputImagePaths[Order[NumLoadsLaunched].Value]);
+		}
+
+		// the image is checked here, so that a missing file fails the video
+		auto Load = MoveTemp(Loads[Step]);
+		if (Load.GetResult().RawData.IsEmpty()) {
+			UE_LOG(LogFFmpegEncoder, Error, TEXT("Failed to load %s."),
+			       *InputImagePaths[Index]);
+			bFailed = true;
+			break;
+		}
+
+		FFmpegEncoderAddFrameResult AddFrame_Result;
+		FString                     AddFrame_ErrorMessage;
+		Encoders[Chunk]->AddFrame(Load, AddFrame_Result, AddFrame_ErrorMessage);
+
+		// frames dropped or duplicated by the backpressure policy of Config are
+		// counted, not failed
+		if (FFmpegEncoderAddFrameResult::Failure == AddFrame_Result) {
+			bFailed = true;
+			break;
+		}
+		NumDroppedFrames +=
+		    FFmpegEncoderAddFrameResult::Dropped == AddFrame_Result ? 1 : 0;
+		NumDuplicatedFrames +=
+		    FFmpegEncoderAddFrameResult::Duplicated == AddFrame_Result ? 1 : 0;
+	}
+
+	if (0 < NumDroppedFrames || 0 < NumDuplicatedFrames) {
+		UE_LOG(LogFFmpegEncoder, Warning,
+		       TEXT("%d frames were dropped and %d duplicated in %s."),
+		       NumDroppedFrames, NumDuplicatedFrames, *OutputFilePath);
+	}
+
+	// the encoders finish writing the chunks when they are destroyed
+	for (auto& Encoder : Encoders) {
+		Encoder->Close();
+	}
+	Encoders.Empty();
+
+	// helper function to remove the chunks
+	const auto& DeleteChunks = [&]() {
+		for (const auto& ChunkPath : ChunkPaths) {
+			IFileManager::Get().Delete(*ChunkPath);
+		}
+	};
+
+	// incomplete chunks are not joined
+	if (bFailed) {
+		UE_LOG(LogFFmpegEncoder, Error, TEXT("Failed to encode %s."),
+		       *OutputFilePath);
+		return DeleteChunks();
+	}
+
+	// join the chunks without encoding again. the chunks are kept if they can
+	// not be joined, so that the encoded frames are not lost.
+	if (!UFFmpegUtils::ConcatVideoFiles(ChunkPaths, OutputFilePath)) {
+		UE_LOG(LogFFmpegEncoder, Error,
+		       TEXT("Failed to join chunks into %s. The chunks are kept as %s."),
+		       *OutputFilePath, *FString::Join(ChunkPaths, TEXT(", ")));
+		return;
+	}
+
+	// remove the chunks
+	DeleteChunks();
+}
+} // namespace
 
 void UFFmpegUtils::GenerateVideoFromImageFiles(
     const FString& OutputFilePath, const TArray<FString>& InputImagePaths,
     const FFFmpegEncoderConfig& FFmpegEncoderConfig) {
+	// encode chunks in parallel if requested
+	const auto& NumChunks =
+	    NumChunksOf(FFmpegEncoderConfig, InputImagePaths.Num());
+	if (1 < NumChunks) {
+		return GenerateVideoInChunks(OutputFilePath, InputImagePaths,
+		                             FFmpegEncoderConfig, NumChunks);
+	}
+
 	const auto FFmpegEncoder = NewObject<UFFmpegEncoder>();
 	check(nullptr != FFmpegEncoder);
 
@@ -21,8 +688,206 @@ void UFFmpegUtils::GenerateVideoFromImageFiles(
 		FString                     AddFrame_ErrorMessage;
 		FFmpegEncoder->AddFrameFromImagePath(ImagePath, AddFrame_Result,
 		                                     AddFrame_ErrorMessage);
-		check(FFmpegEncoderAddFrameResult::Success == AddFrame_Result);
+
+		// frames may be dropped or duplicated by the backpressure policy
+		check(FFmpegEncoderAddFrameResult::Failure != AddFrame_Result);
 	}
 
 	FFmpegEncoder->Close();
 }
+
+void UFFmpegUtils::PrewarmEncoders(
+    const FFFmpegEncoderConfig& FFmpegEncoderConfig, const int32 Count) {
+	FFFmpegEncoderPool::Get().Prewarm(FFmpegEncoderConfig, Count);
+}
+
+bool UFFmpegUtils::ConcatVideoFiles(const TArray<FString>& InputFilePaths,
+                                    const FString&         OutputFilePath) {
+	// helper function to finish with failure
+	const auto& Failure = [&](const FString& Message) {
+		UE_LOG(LogFFmpegEncoder, Error, TEXT("%s"), *Message);
+		return false;
+	};
+
+	if (InputFilePaths.IsEmpty()) {
+		return Failure(TEXT("No files to join."));
+	}
+
+	// output is created when the first input is opened
+	AVFormatContext* OutputContext = nullptr;
+	AVStream*        OutputStream  = nullptr;
+	ON_SCOPE_EXIT {
+		if (nullptr != OutputContext) {
+			avio_closep(&OutputContext->pb);
+			avformat_free_context(OutputContext);
+		}
+	};
+
+	// allocate Packet
+	AVPacket* Packet = av_packet_alloc();
+	if (nullptr == Packet) {
+		return Failure(TEXT("Failed to allocate packet."));
+	}
+	ON_SCOPE_EXIT { av_packet_free(&Packet); };
+
+	// timestamps of each input are shifted by the end of the previous inputs.
+	// both are in the time base of OutputStream.
+	int64 Offset  = 0;
+	int64 LastDts = AV_NOPTS_VALUE;
+
+	for (const auto& InputFilePath : InputFilePaths) {
+		// open input file
+		AVFormatContext* InputContext = nullptr;
+		if (avformat_open_input(&InputContext, TCHAR_TO_UTF8(*InputFilePath),
+		                        nullptr, nullptr) < 0) {
+			return Failure(FString::Printf(TEXT("Failed to open %s."),
+			                               *InputFilePath));
+		}
+		ON_SCOPE_EXIT { avformat_close_input(&InputContext); };
+
+		// find the video stream
+		const auto& StreamIndex =
+		    avformat_find_stream_info(InputContext, nullptr) < 0
+		        ? AVERROR_STREAM_NOT_FOUND
+		        : av_find_best_stream(InputContext, AVMEDIA_TYPE_VIDEO, -1, -1,
+		                              nullptr, 0);
+		if (StreamIndex < 0) {
+			return Failure(FString::Printf(TEXT("No video stream in %s."),
+			                               *InputFilePath));
+		}
+		const auto& InputStream = InputContext->streams[StreamIndex];
+
+		// the output takes the stream of the first input as is
+		if (nullptr == OutputContext) {
+			const auto& OutputFilePathInUTF8 =
+			    StringCast<UTF8CHAR>(*OutputFilePath);
+			const auto& OutputFileName =
+			    reinterpret_cast<const char*>(OutputFilePathInUTF8.Get());
+			if (avformat_alloc_output_context2(&OutputContext, nullptr, nullptr,
+			                                   OutputFileName) < 0 ||
+			    nullptr ==
+			        (OutputStream = avformat_new_stream(OutputContext, nullptr)) ||
+			    avcodec_parameters_copy(OutputStream->codecpar,
+			                            InputStream->codecpar) < 0) {
+				return Failure(TEXT("Failed to create output stream."));
+			}
+			OutputStream->codecpar->codec_tag = 0;
+			OutputStream->time_base           = InputStream->time_base;
+			OutputStream->avg_frame_rate      = InputStream->avg_frame_rate;
+
+			if (avio_open(&OutputContext->pb, OutputFileName, AVIO_FLAG_WRITE) <
+			        0 ||
+			    avformat_write_header(OutputContext, nullptr) < 0) {
+				return Failure(FString::Printf(TEXT("Failed to create %s."),
+				                               *OutputFilePath));
+			}
+		}
+
+		// copy packets
+		auto End = Offset;
+		while (0 <= av_read_frame(InputContext, Packet)) {
+			ON_SCOPE_EXIT { av_packet_unref(Packet); };
+			if (StreamIndex != Packet->stream_index) {
+				continue;
+			}
+
+			// shift timestamps to follow the previous input
+			av_packet_rescale_ts(Packet, InputStream->time_base,
+			                     OutputStream->time_base);
+			Packet->pts += AV_NOPTS_VALUE != Packet->pts ? Offset : 0;
+			Packet->dts += AV_NOPTS_VALUE != Packet->dts ? Offset : 0;
+
+			// keep dts increasing even if inputs start with different delays
+			if (AV_NOPTS_VALUE != LastDts && AV_NOPTS_VALUE != Packet->dts &&
+			    Packet->dts <= LastDts) {
+				Packet->dts = LastDts + 1;
+				Packet->pts = FMath::Max(Packet->pts, Packet->dts);
+			}
+			LastDts = Packet->dts;
+			End     = FMath::Max(End, Packet->pts +
+			                              FMath::Max<int64>(Packet->duration, 1));
+
+			Packet->stream_index = OutputStream->index;
+			Packet->pos          = -1;
+			if (av_interleaved_write_frame(OutputContext, Packet) < 0) {
+				return Failure(FString::Printf(TEXT("Failed to write %s."),
+				                               *OutputFilePath));
+			}
+		}
+		Offset = End;
+	}
+
+	// write trailer to output file
+	if (av_write_trailer(OutputContext) != 0) {
+		return Failure(FString::Printf(TEXT("Failed to write trailer of %s."),
+		                               *OutputFilePath));
+	}
+
+	return true;
+}
+
+bool UFFmpegUtils::ConvertImageToFrame(const FImage& Image, AVFrame& Frame,
+                                       const FFFmpegConversionOptions& Options) {
+	// wrap Image to handle it as a frame
+	AVFrame* ImageFrame = WrapImageAsFrame(Image);
+	if (nullptr == ImageFrame) {
+		UE_LOG(LogFFmpegEncoder, Error, TEXT("Failed to wrap image."));
+		return false;
+	}
+
+	// how float images are tone mapped and encoded
+	FFFmpegFloatConversionOptions FloatOptions;
+	FloatOptions.ToneMapping = Options.ToneMapping;
+	FloatOptions.bLinear     = EGammaSpace::Linear == Image.GetGammaSpace();
+	FloatOptions.bDither     = Options.bDither;
+
+	const auto& bSucceeded =
+	    ConvertFrameToFit(*ImageFrame, Frame, Options, FloatOptions);
+
+	av_frame_free(&ImageFrame);
+
+	return bSucceeded;
+}
+
+bool UFFmpegUtils::ConvertFrameToFrame(const AVFrame& Src, AVFrame& Dst,
+                                       const FFFmpegConversionOptions& Options) {
+	// frames hold encoded values, not linear ones
+	FFFmpegFloatConversionOptions FloatOptions;
+	FloatOptions.ToneMapping = Options.ToneMapping;
+	FloatOptions.bLinear     = false;
+	FloatOptions.bDither     = Options.bDither;
+
+	return ConvertFrameToFit(Src, Dst, Options, FloatOptions);
+}
+
+bool UFFmpegUtils::CanWrapImage(const FImage& Image, const int FrameWidth,
+                                const int           FrameHeight,
+                                const AVPixelFormat PixelFormat) noexcept {
+	if (Image.GetWidth() != FrameWidth || Image.GetHeight() != FrameHeight) {
+		return false;
+	}
+
+	// alpha is just ignored by formats with padding
+	const auto& ImageFormat = FFmpegFrameFormatOf(Image.Format);
+	switch (PixelFormat) {
+	case AV_PIX_FMT_BGR0:
+		return AV_PIX_FMT_BGR0 == ImageFormat || AV_PIX_FMT_BGRA == ImageFormat;
+	case AV_PIX_FMT_RGB0:
+		return AV_PIX_FMT_RGB0 == ImageFormat || AV_PIX_FMT_RGBA == ImageFormat;
+	default:
+		return AV_PIX_FMT_NONE != ImageFormat && ImageFormat == PixelFormat;
+	}
+}
+
+FFFmpegConversionOptions
+    FFFmpegConversionOptions::FromConfig(const FFFmpegEncoderConfig& Config) {
+	FFFmpegConversionOptions Options;
+	Options.BandHeight   = Config.ConversionBandHeight;
+	Options.MaxBands     = Config.MaxConversionBands;
+	Options.ScaleFilter  = Config.ScaleFilter;
+	Options.ScaleFitMode = Config.ScaleFitMode;
+	Options.ToneMapping  = Config.ToneMapping;
+	Options.bDither      = Config.bDither;
+	Options.TaskPriority = TaskPriorityOf(Config.Priority);
+	return Options;
+}
@@ -0,0 +1,127 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CreateImageFromTextureRHI.h"
+#include "FFmpegReadbackPoller.h"
+
+#include "Algo/AllOf.h"
+#include "Algo/AnyOf.h"
+#include "Misc/AutomationTest.h"
+#include "Misc/ScopeExit.h"
+#include "RenderingThread.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(
+    FFFmpegConcurrentCaptureTest, "BlueprintFFmpeg.Capture.ConcurrentCaptures",
+    EAutomationTestFlags::EditorContext | EAutomationTestFlags::ClientContext |
+        EAutomationTestFlags::EngineFilter)
+
+bool FFFmpegConcurrentCaptureTest::RunTest(const FString& Parameters) {
+	// captures need a GPU
+	if (!FApp::CanEverRender()) {
+		AddInfo(TEXT("Skipped: rendering is disabled."));
+		return true;
+	}
+
+	constexpr int32 Width  = 67;
+	constexpr int32 Height = 35;
+
+	// many more captures than workers are in flight at once
+	const auto& NumWorkers = FMath::Max(
+	    1, static_cast<int32>(LowLevelTasks::FScheduler::Get().GetNumWorkers()));
+	const auto& NumCaptures = 4 * NumWorkers;
+
+	// a render target cleared to red
+	FTextureRHIRef Texture;
+	ENQUEUE_RENDER_COMMAND(CreateFFmpegCaptureTestTexture)
+	([&](FRHICommandListImmediate& RHICmdList) {
+		const auto& Desc =
+		    FRHITextureCreateDesc::Create2D(TEXT("FFmpegCaptureTest"), Width,
+		                                    Height, PF_B8G8R8A8)
+		        .SetFlags(ETextureCreateFlags::RenderTargetable |
+		                  ETextureCreateFlags::ShaderResource)
+		        .SetClearValue(FClearValueBinding(FLinearColor::Red))
+		        .SetInitialState(ERHIAccess::RTV);
+		Texture = RHICreateTexture(Desc);
+
+		FRHIRenderPassInfo RenderPassInfo(Texture,
+		                                  ERenderTargetActions::Clear_Store);
+		RHICmdList.BeginRenderPass(RenderPassInfo,
+		                           TEXT("ClearFFmpegCaptureTest"));
+		RHICmdList.EndRenderPass();
+		RHICmdList.Transition(
+		    FRHITransitionInfo(Texture, ERHIAccess::RTV, ERHIAccess::SRVMask));
+	});
+	FlushRenderingCommands();
+
+	// hold the render thread, so that no capture can complete until released.
+	// the timeout keeps a broken capture from hanging the test.
+	const auto& Gate = FPlatformProcess::GetSynchEventFromPool(true);
+	ON_SCOPE_EXIT {
+		Gate->Trigger();
+		FlushRenderingCommands();
+		FPlatformProcess::ReturnSynchEventToPool(Gate);
+	};
+	ENQUEUE_RENDER_COMMAND(HoldFFmpegCaptureTest)
+	([Gate](FRHICommandListImmediate&) { Gate->Wait(10000); });
+
+	// launch every capture before any completes
+	TArray<UE::Tasks::TTask<FImage>> Captures;
+	for (int32 Index = 0; Index < NumCaptures; ++Index) {
+		Captures.Add(CreateImageFromTextureRHIAsync(FTextureRHIRef(Texture)));
+	}
+
+	// a task on every worker runs while the captures are pending, which fails
+	// if a capture parks a worker until the render thread reads the texture
+	TArray<UE::Tasks::FTask> Sentinels;
+	for (int32 Index = 0; Index < NumWorkers; ++Index) {
+		Sentinels.Add(UE::Tasks::Launch(
+		    UE_SOURCE_LOCATION, []() {},
+		    LowLevelTasks::ETaskPriority::BackgroundNormal));
+	}
+	const auto& bSentinelsCompleted =
+	    UE::Tasks::Wait(Sentinels, FTimespan::FromSeconds(5.0));
+	TestFalse(TEXT("Captures are pending while the render thread is held"),
+	          Algo::AnyOf(Captures, [](const UE::Tasks::TTask<FImage>& Capture) {
+		          return Capture.IsCompleted();
+	          }));
+	if (!TestTrue(TEXT("No worker is parked by a capture"),
+	              bSentinelsCompleted)) {
+		return false;
+	}
+
+	// release the render thread. the game thread does not tick here, so the
+	// poller is flushed until the captures complete
+	Gate->Trigger();
+	const auto& Deadline = FPlatformTime::Seconds() + 10.0;
+	bool        bCompleted = false;
+	while (!bCompleted && FPlatformTime::Seconds() < Deadline) {
+		FFFmpegReadbackPoller::Get().Flush();
+		FlushRenderingCommands();
+		bCompleted = UE::Tasks::Wait(Captures, FTimespan::FromMilliseconds(1.0));
+	}
+	if (!TestTrue(TEXT("All captures complete"), bCompleted)) {
+		return false;
+	}
+
+	// every capture holds the whole texture
+	for (auto& Capture : Captures) {
+		const auto& Image = Capture.GetResult();
+		TestEqual(TEXT("Width"), Image.GetWidth(), Width);
+		TestEqual(TEXT("Height"), Image.GetHeight(), Height);
+		TestEqual(TEXT("Format"), Image.Format, ERawImageFormat::BGRA8);
+		if (Image.GetWidth() != Width || Image.GetHeight() != Height) {
+			continue;
+		}
+
+		const auto& Pixels = Image.AsBGRA8();
+		TestTrue(TEXT("Pixels are red"),
+		         Algo::AllOf(Pixels, [](const FColor& Pixel) {
+			         return FColor::Red == Pixel;
+		         }));
+	}
+
+	return true;
+}
+
+#endif
@@ -0,0 +1,162 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Containers/Queue.h"
+#include "HAL/Event.h"
+#include "HAL/PlatformProcess.h"
+#include "HAL/PlatformTime.h"
+#include "Misc/AutomationTest.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace FFmpegFrameQueueBenchmark_Private {
+// the producer sends the time an entry was enqueued. 0 stops the consumer.
+constexpr uint64 StopStamp = 0;
+
+/**
+ * The handoff of FFFmpegEncodeThread: a lock-free queue and an event that is
+ * triggered only if the consumer is going to sleep.
+ */
+struct FLockFreeQueue {
+	TQueue<uint64, EQueueMode::Spsc> Queue;
+	FEvent*          Event    = FPlatformProcess::GetSynchEventFromPool();
+	std::atomic_bool bWaiting = false;
+
+	~FLockFreeQueue() { FPlatformProcess::ReturnSynchEventToPool(Event); }
+
+	void Push(const uint64 Stamp) {
+		Queue.Enqueue(Stamp);
+		if (bWaiting.exchange(false)) {
+			Event->Trigger();
+		}
+	}
+
+	uint64 Pop() {
+		uint64 Stamp;
+		while (!Queue.Dequeue(Stamp)) {
+			bWaiting = true;
+			if (!Queue.IsEmpty()) {
+				bWaiting = false;
+				continue;
+			}
+			Event->Wait();
+		}
+		return Stamp;
+	}
+};
+
+/**
+ * The handoff it replaced: a queue guarded by a mutex and a condition
+ * variable notified on every entry.
+ */
+struct FLockedQueue {
+	std::deque<uint64>      Queue;
+	std::mutex              Queue_mutex;
+	std::condition_variable Queue_cv;
+
+	void Push(const uint64 Stamp) {
+		{
+			std::lock_guard lk(Queue_mutex);
+			Queue.push_back(Stamp);
+		}
+		Queue_cv.notify_one();
+	}
+
+	uint64 Pop() {
+		std::unique_lock lk(Queue_mutex);
+		Queue_cv.wait(lk, [&]() { return !Queue.empty(); });
+		const auto Stamp = Queue.front();
+		Queue.pop_front();
+		return Stamp;
+	}
+};
+
+/**
+ * Timings of a queue in microseconds
+ */
+struct FResult {
+	// average time spent by the producer per entry, entries sent back to back
+	double EnqueueCost = 0.0;
+
+	// average time from enqueue to dequeue of entries sent to a sleeping
+	// consumer
+	double WakeLatency = 0.0;
+};
+
+template <typename FQueue_T>
+FResult Measure(const int32 NumBurstEntries, const int32 NumSparseEntries) {
+	FQueue_T Queue;
+
+	// the consumer sums the latency of every entry
+	std::atomic<uint64> LatencyCycles = 0;
+	std::thread         Consumer([&]() {
+		while (true) {
+			const auto Stamp = Queue.Pop();
+			if (StopStamp == Stamp) {
+				return;
+			}
+			LatencyCycles += FPlatformTime::Cycles64() - Stamp;
+		}
+	});
+
+	FResult Result;
+
+	// entries back to back measure the cost of the producer
+	const auto& BurstStart = FPlatformTime::Cycles64();
+	for (int32 Index = 0; Index < NumBurstEntries; ++Index) {
+		Queue.Push(FPlatformTime::Cycles64());
+	}
+	Result.EnqueueCost =
+	    FPlatformTime::ToSeconds64(FPlatformTime::Cycles64() - BurstStart) *
+	    1e6 / NumBurstEntries;
+
+	// let the consumer drain the burst and go to sleep
+	FPlatformProcess::Sleep(0.05f);
+	LatencyCycles = 0;
+
+	// entries apart from each other measure the latency of waking it
+	for (int32 Index = 0; Index < NumSparseEntries; ++Index) {
+		Queue.Push(FPlatformTime::Cycles64());
+		FPlatformProcess::Sleep(0.001f);
+	}
+	Queue.Push(StopStamp);
+	Consumer.join();
+
+	Result.WakeLatency = FPlatformTime::ToSeconds64(LatencyCycles.load()) *
+	                     1e6 / NumSparseEntries;
+	return Result;
+}
+} // namespace FFmpegFrameQueueBenchmark_Private
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(
+    FFFmpegFrameQueueBenchmark, "BlueprintFFmpeg.Performance.FrameQueue",
+    EAutomationTestFlags::EditorContext | EAutomationTestFlags::ClientContext |
+        EAutomationTestFlags::PerfFilter)
+
+bool FFFmpegFrameQueueBenchmark::RunTest(const FString& Parameters) {
+	using namespace FFmpegFrameQueueBenchmark_Private;
+
+	constexpr int32 NumBurstEntries  = 100000;
+	constexpr int32 NumSparseEntries = 200;
+
+	const auto& LockFree =
+	    Measure<FLockFreeQueue>(NumBurstEntries, NumSparseEntries);
+	const auto& Locked = Measure<FLockedQueue>(NumBurstEntries, NumSparseEntries);
+
+	AddInfo(FString::Printf(
+	    TEXT("Enqueue cost: lock-free %.3f us, mutex %.3f us"),
+	    LockFree.EnqueueCost, Locked.EnqueueCost));
+	AddInfo(FString::Printf(
+	    TEXT("Wake latency: lock-free %.1f us, mutex %.1f us"),
+	    LockFree.WakeLatency, Locked.WakeLatency));
+
+	// the timings are reported, not asserted, as they depend on the machine
+	return true;
+}
+
+#endif
@@ -3,6 +3,9 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include "FFmpegImagePool.h"
+#include "FFmpegReadbackPoller.h"
+#include "RHIGPUReadback.h"
 
 /**
  * @param TextureRHI   Source TextureRHI from which the image is created.
@@ -14,6 +17,204 @@ UE::Tasks::TTask<FImage>
     CreateImageFromTextureRHIAsync(FTextureRHIRef_T&& TextureRHI);
 
 #pragma region definition of template functions
+namespace CreateImageFromTextureRHI_Private {
+/**
+ * Read pixels of TextureRHI as BGRA8 on the render thread. No thread waits
+ * for the render thread: the render command triggers an event, and a task
+ * depending on it copies the pixels into an image taken from FFFmpegImagePool.
+ * @return   task to create image of the whole texture
+ */
+inline UE::Tasks::TTask<FImage>
+    ReadSurfaceToImageAsync(FTextureRHIRef TextureRHI) {
+	namespace Tasks = UE::Tasks;
+
+	// get description of source texture RHI
+	const auto& Desc = TextureRHI->GetDesc();
+
+	// get Width
+	const auto& Width = Desc.Extent.X;
+
+	// get Height
+	const auto& Height = Desc.Extent.Y;
+
+	// array of pixels filled on the render thread
+	const auto& Pixels = MakeShared<TArray<FColor>, ESPMode::ThreadSafe>();
+
+	// signaled when Pixels is filled
+	Tasks::FTaskEvent Read(UE_SOURCE_LOCATION);
+
+	// On Render Thread
+	ENQUEUE_RENDER_COMMAND(ReadTexture)
+	([TextureRHI = MoveTemp(TextureRHI), Pixels, Read, Width,
+	  Height](FRHICommandListImmediate& RHICmdList) mutable {
+		// Pixels.Num() becomes Width * Height
+		Pixels->Reserve(Width * Height);
+
+		// create settings
+		FReadSurfaceDataFlags ReadSurfaceDataFlags;
+
+		// assume color space of TextureRHI is gamma space
+		ReadSurfaceDataFlags.SetLinearToGamma(false);
+
+		// read texture color data to Pixels
+		RHICmdList.ReadSurfaceData(MoveTemp(TextureRHI),
+		                           FIntRect(0, 0, Width, Height), *Pixels,
+		                           ReadSurfaceDataFlags);
+
+		// Pixels is ready
+		Read.Trigger();
+	});
+
+	// launch a task that copies Pixels to an image once they are read
+	return Tasks::Launch(
+	    UE_SOURCE_LOCATION,
+	    [Pixels, Width, Height]() {
+		    // Pixels should be packed with all the pixel information without
+		    // wasting a single byte.
+		    check(Width * Height == Pixels->Num());
+
+		    // take storage of the image from the pool
+		    auto OutImage = FFFmpegImagePool::Get().Acquire(
+		        Width, Height, ERawImageFormat::BGRA8, EGammaSpace::sRGB);
+
+		    // copy Pixels to OutImage
+		    FMemory::Memcpy(OutImage.RawData.GetData(), Pixels->GetData(),
+		                    Pixels->Num() * sizeof(FColor));
+
+		    return OutImage;
+	    },
+	    Read, LowLevelTasks::ETaskPriority::BackgroundNormal);
+}
+
+/**
+ * Get the image format that has the same layout as PixelFormat.
+ * @param[out] ImageFormat   format of the image.
+ * @param[out] GammaSpace    gamma space of the image.
+ * @return   false if no image format has the same layout.
+ */
+inline bool ImageFormatOf(const EPixelFormat     PixelFormat,
+                          ERawImageFormat::Type& ImageFormat,
+                          EGammaSpace&           GammaSpace) {
+	switch (PixelFormat) {
+	case PF_B8G8R8A8:
+		ImageFormat = ERawImageFormat::BGRA8;
+		GammaSpace  = EGammaSpace::sRGB;
+		return true;
+	case PF_FloatRGBA:
+		ImageFormat = ERawImageFormat::RGBA16F;
+		GammaSpace  = EGammaSpace::Linear;
+		return true;
+	case PF_A32B32G32R32F:
+		ImageFormat = ERawImageFormat::RGBA32F;
+		GammaSpace  = EGammaSpace::Linear;
+		return true;
+	default:
+		return false;
+	}
+}
+
+/**
+ * Copy the mapped staging buffer of Readback into Image. Must be called on
+ * the render thread after the copy has completed.
+ * @param Image   destination image. Its size and format must be same as the
+ *                copied texture.
+ */
+inline void CopyReadbackToImage(FRHIGPUTextureReadback& Readback,
+                                FImage&                 Image) {
+	// map staging buffer
+	int32       RowPitchInPixels = 0;
+	const auto& SrcData =
+	    static_cast<const uint8*>(Readback.Lock(RowPitchInPixels));
+
+	// copy each row, skipping padding of staging buffer
+	const auto& Height        = Image.GetHeight();
+	const auto& BytesPerPixel = Image.GetBytesPerPixel();
+	const auto& SrcLineSize   = int64(RowPitchInPixels) * BytesPerPixel;
+	const auto& DstLineSize   = int64(Image.GetWidth()) * BytesPerPixel;
+	auto* const DstData       = Image.RawData.GetData();
+	for (int32 Row = 0; Row < Height; ++Row) {
+		FMemory::Memcpy(DstData + Row * DstLineSize,
+		                SrcData + Row * SrcLineSize, DstLineSize);
+	}
+
+	Readback.Unlock();
+}
+
+/**
+ * Copy TextureRHI to a staging buffer of its own, and copy the staging buffer
+ * into OutImage once FFFmpegReadbackPoller finds the copy completed. Nothing
+ * waits for the copy. Must be called on the render thread.
+ * @param OutImage   destination image. Its size and layout must be same as
+ *                   TextureRHI.
+ * @param Copied     triggered once OutImage is filled.
+ */
+inline void
+    EnqueueReadbackToImage(FRHICommandListImmediate&               RHICmdList,
+                           FRHITexture*                            TextureRHI,
+                           TSharedPtr<FImage, ESPMode::ThreadSafe> OutImage,
+                           UE::Tasks::FTaskEvent                   Copied) {
+	// copy texture to staging buffer
+	const auto& Readback =
+	    MakeShared<FRHIGPUTextureReadback>(TEXT("FFmpegTextureReadback"));
+	Readback->EnqueueCopy(RHICmdList, TextureRHI);
+
+	// copy staging buffer to the image once the copy has completed, without
+	// waiting for it here
+	FRHIGPUReadback* const Readbacks[] = {&Readback.Get()};
+	FFFmpegReadbackPoller::Get().Add(
+	    Readbacks, [Readback, OutImage = MoveTemp(OutImage),
+	                Copied = MoveTemp(Copied)]() mutable {
+		    CopyReadbackToImage(*Readback, *OutImage);
+
+		    // OutImage is ready
+		    Copied.Trigger();
+	    });
+}
+
+/**
+ * Copy pixels of TextureRHI into an image taken from FFFmpegImagePool.
+ * The texture is copied to a staging buffer and the mapped rows are written
+ * straight into the image, so no intermediate array is allocated. No thread
+ * waits for the render thread or the GPU: FFFmpegReadbackPoller maps the
+ * staging buffer once the copy has completed, and the task completes after
+ * it.
+ * @param ImageFormat   format of the image. Its layout must be same as the
+ *                      pixel format of TextureRHI.
+ * @param GammaSpace    gamma space of the image.
+ * @return   task to create image of the whole texture
+ */
+inline UE::Tasks::TTask<FImage>
+    ReadTextureToPooledImageAsync(FTextureRHIRef              TextureRHI,
+                                  const ERawImageFormat::Type ImageFormat,
+                                  const EGammaSpace           GammaSpace) {
+	namespace Tasks = UE::Tasks;
+
+	// get description of source texture RHI
+	const auto& Desc = TextureRHI->GetDesc();
+
+	// take storage of the image from the pool
+	const auto& OutImage = MakeShared<FImage, ESPMode::ThreadSafe>(
+	    FFFmpegImagePool::Get().Acquire(Desc.Extent.X, Desc.Extent.Y,
+	                                    ImageFormat, GammaSpace));
+
+	// signaled when OutImage is filled
+	Tasks::FTaskEvent Copied(UE_SOURCE_LOCATION);
+
+	// On Render Thread
+	ENQUEUE_RENDER_COMMAND(ReadTextureToPooledImage)
+	([TextureRHI = MoveTemp(TextureRHI), OutImage,
+	  Copied](FRHICommandListImmediate& RHICmdList) mutable {
+		EnqueueReadbackToImage(RHICmdList, TextureRHI, MoveTemp(OutImage),
+		                       MoveTemp(Copied));
+	});
+
+	// the task runs only after the image is filled, so it never waits
+	return Tasks::Launch(
+	    UE_SOURCE_LOCATION, [OutImage]() { return MoveTemp(*OutImage); }, Copied,
+	    LowLevelTasks::ETaskPriority::BackgroundNormal);
+}
+} // namespace CreateImageFromTextureRHI_Private
+
 template <typename FTextureRHIRef_T>
   requires std::is_same_v<FTextureRHIRef, std::remove_cvref_t<FTextureRHIRef_T>>
 UE::Tasks::TTask<FImage>
@@ -86,70 +287,23 @@ UE::Tasks::TTask<FImage>
 		    return OutImage;
 	    },
 	    LowLevelTasks::ETaskPriority::BackgroundNormal);
-	// not wait to ReadSurfaceData in GameThread (wait in WorkerThread)
+	// not wait to ReadSurfaceData in any thread (chain of task events)
 #elif true
-	return Tasks::Launch(
-	    UE_SOURCE_LOCATION,
-	    [TextureRHI = Forward<FTextureRHIRef_T>(TextureRHI)]() mutable {
-		    // get description of source texture RHI
-		    const auto& Desc = TextureRHI->GetDesc();
-
-		    // get Width
-		    const auto& Width = Desc.Extent.X;
-
-		    // get Height
-		    const auto& Height = Desc.Extent.Y;
-
-		    // get PixelFormat
-		    const auto& PixelFormat = Desc.Format;
+	using namespace CreateImageFromTextureRHI_Private;
 
-		    // pre allocate array of Color
-		    TArray<FColor> ColorArray_Pre;
-
-		    // ColorArray.Num() becomes Width * Height
-		    ColorArray_Pre.Reserve(Width * Height);
-
-		    // make promise to store Color
-		    TPromise<TArray<FColor>> Color_Promise;
-		    auto                     Color_Future = Color_Promise.GetFuture();
-
-		    // On Render Thread
-		    ENQUEUE_RENDER_COMMAND(ReadTexture)
-		    ([&](FRHICommandListImmediate& RHICmdList) mutable {
-			    // create settings
-			    FReadSurfaceDataFlags ReadSurfaceDataFlags;
-
-			    // assume color space of TextureRHI is gamma space
-			    ReadSurfaceDataFlags.SetLinearToGamma(false);
-
-			    // read texture color data to ColorArray_Pre
-			    RHICmdList.ReadSurfaceData(MoveTemp(TextureRHI),
-			                               FIntRect(0, 0, Width, Height),
-			                               ColorArray_Pre, ReadSurfaceDataFlags);
-
-			    // Store Color and delivers on promise
-			    Color_Promise.EmplaceValue(MoveTemp(ColorArray_Pre));
-		    });
-
-		    // get array of Color
-		    auto&& ColorArray = Color_Future.Consume();
-
-		    // ColorArray should be packed with all the pixel information without
-		    // wasting a single byte.
-		    check(Width * Height == ColorArray.Num());
-
-		    // initialize OutImage
-		    FImage OutImage(Width, Height, ERawImageFormat::BGRA8);
-
-		    // copy ColorArray to OutImage
-		    FMemory::Memcpy(OutImage.RawData.GetData(), ColorArray.GetData(),
-		                    ColorArray.Num() * sizeof(FColor));
-
-		    return OutImage;
-	    },
-	    LowLevelTasks::ETaskPriority::BackgroundNormal,
-	    Tasks::EExtendedTaskPriority::None,
-	    Tasks::ETaskFlags::DoNotRunInsideBusyWait);
+	// get PixelFormat
+	const auto& PixelFormat = TextureRHI->GetDesc().Format;
+
+	// formats that have the same layout as an image are read straight into
+	// pooled images. float render targets are read without losing precision.
+	ERawImageFormat::Type ImageFormat;
+	EGammaSpace           GammaSpace;
+	if (ImageFormatOf(PixelFormat, ImageFormat, GammaSpace)) {
+		return ReadTextureToPooledImageAsync(
+		    Forward<FTextureRHIRef_T>(TextureRHI), ImageFormat, GammaSpace);
+	}
+
+	return ReadSurfaceToImageAsync(Forward<FTextureRHIRef_T>(TextureRHI));
 #endif
 }
 #pragma endregion
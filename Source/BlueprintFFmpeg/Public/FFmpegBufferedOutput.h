@@ -0,0 +1,117 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Tasks/Task.h"
+
+#include <atomic>
+
+extern "C" {
+#include <libavformat/avio.h>
+}
+
+// Linux and Mac write through a file descriptor, which allows O_DIRECT,
+// F_NOCACHE and fallocate. Other platforms write through IFileHandle.
+#define FFMPEG_BUFFERED_OUTPUT_POSIX (PLATFORM_LINUX || PLATFORM_MAC)
+
+/**
+ * Options of FFFmpegBufferedOutput
+ */
+struct BLUEPRINTFFMPEG_API FFFmpegBufferedOutputOptions {
+	/** bytes of each of the two write buffers */
+	int64 BufferSize = 8 * 1024 * 1024;
+
+	/** bytes reserved on disk when the file is opened. 0 reserves nothing */
+	int64 PreallocateSize = 0;
+
+	/** true to bypass the page cache */
+	bool bDirectIO = false;
+};
+
+/**
+ * Output file backend of AVIOContext.
+ * Packets are collected into large aligned buffers. A full buffer is written
+ * by a background task while the other one is filled, so the mux thread
+ * rarely waits for the disk and the file is written with few large writes.
+ * The file can be preallocated to reduce fragmentation, and written with
+ * O_DIRECT (Linux) or F_NOCACHE (Mac) so that long captures do not pollute
+ * the page cache.
+ * Not threadsafe: used by a single thread at a time.
+ */
+class BLUEPRINTFFMPEG_API FFFmpegBufferedOutput {
+	// public functions
+public:
+	FFFmpegBufferedOutput() = default;
+	~FFFmpegBufferedOutput();
+
+	FFFmpegBufferedOutput(const FFFmpegBufferedOutput&)            = delete;
+	FFFmpegBufferedOutput& operator=(const FFFmpegBufferedOutput&) = delete;
+
+	/**
+	 * Create the file and the AVIOContext writing to it.
+	 * @return   false if failed to create the file or to allocate buffers.
+	 */
+	bool Open(const FString& Path, const FFFmpegBufferedOutputOptions& Options);
+
+	/**
+	 * @return   AVIOContext to set to AVFormatContext::pb. nullptr before Open.
+	 */
+	AVIOContext* GetIOContext() const noexcept;
+
+	/**
+	 * Write all buffered data, trim the preallocated space and close the file.
+	 * The AVIOContext is freed.
+	 * @return   false if any write has failed.
+	 */
+	bool Close();
+
+	// private types
+private:
+	// a write buffer and where its data goes in the file
+	struct FBuffer {
+		uint8* Data   = nullptr;
+		int64  Offset = 0;
+		int64  Size   = 0;
+	};
+
+	// private functions
+private:
+	// callbacks of AVIOContext
+	static int     WritePacket(void* Opaque, const uint8_t* Data, int Size);
+	static int64_t Seek(void* Opaque, int64_t Offset, int Whence);
+
+	// hand the current buffer to a background write and switch buffers
+	void FlushBuffer();
+
+	// wait for the background write
+	void WaitForFlush();
+
+	// write Data at Offset of the file. called by background writes.
+	bool WriteAt(const uint8* Data, int64 Size, int64 Offset);
+
+	// private constants
+private:
+	// alignment of buffers, offsets and sizes required by O_DIRECT
+	static constexpr int64 Alignment = 4096;
+
+	// bytes of the buffer of AVIOContext
+	static constexpr int32 IOContextBufferSize = 256 * 1024;
+
+	// private fields
+private:
+	AVIOContext*     IOContext     = nullptr;
+	FBuffer          Buffers[2]    = {};
+	int32            CurrentBuffer = 0;
+	int64            BufferSize    = 0;
+	int64            Position      = 0;
+	int64            FileSize      = 0;
+	bool             bDirectIO     = false;
+	UE::Tasks::FTask FlushTask;
+	std::atomic_bool bFailed = false;
+#if FFMPEG_BUFFERED_OUTPUT_POSIX
+	int FileDescriptor = -1;
+#else
+	TUniquePtr<IFileHandle> FileHandle;
+#endif
+};
@@ -0,0 +1,70 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "FFmpegEncoderConfig.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/dict.h>
+#include <libavutil/pixfmt.h>
+}
+
+/**
+ * What the encoder needs to know about each codec of EFFmpegCodec: which
+ * FFmpeg encoder implements it, which pixel format frames are converted to,
+ * and how the settings of FFFmpegEncoderConfig map to its options.
+ * Threadsafe.
+ */
+class BLUEPRINTFFMPEG_API FFFmpegCodecProfile {
+	// public functions
+public:
+	/**
+	 * @return   encoder of Config.Codec, or nullptr if this build of FFmpeg
+	 *           has none. The first available one is taken if several
+	 *           encoders implement the codec.
+	 */
+	static const AVCodec* FindEncoder(const FFFmpegEncoderConfig& Config);
+
+	/**
+	 * Choose the pixel format frames are converted to, so that Codec takes
+	 * them without another conversion.
+	 * @return   the format of EncodePixelFormat if Codec supports it,
+	 *           otherwise the supported format that loses the least.
+	 */
+	static AVPixelFormat
+	    NegotiatePixelFormat(const AVCodec&           Codec,
+	                         EFFmpegEncodePixelFormat EncodePixelFormat);
+
+	/**
+	 * Set preset, tune, lookahead and profile of Config to Context and Options
+	 * in the form Codec takes them. Settings Codec has no equivalent for are
+	 * ignored.
+	 * @param PixelFormat   format negotiated by NegotiatePixelFormat.
+	 */
+	static void ApplyOptions(const FFFmpegEncoderConfig& Config,
+	                         const AVCodec& Codec, AVPixelFormat PixelFormat,
+	                         AVCodecContext& Context, AVDictionary*& Options);
+
+	/**
+	 * Allocate and open a codec context with the settings of Config.
+	 * @param PixelFormat   format negotiated by NegotiatePixelFormat.
+	 * @return   opened context, or nullptr if failed.
+	 */
+	static AVCodecContext* OpenCodecContext(const FFFmpegEncoderConfig& Config,
+	                                        const AVCodec&              Codec,
+	                                        AVPixelFormat PixelFormat);
+
+	/**
+	 * @return   true if a codec context opened with A can encode with B, i.e.
+	 *           every setting the codec uses is equal.
+	 */
+	static bool HasSameCodecSettings(const FFFmpegEncoderConfig& A,
+	                                 const FFFmpegEncoderConfig& B);
+
+	/**
+	 * @return   true if Codec has the private option Name.
+	 */
+	static bool HasOption(const AVCodec& Codec, const char* Name);
+};
@@ -0,0 +1,123 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/Ticker.h"
+#include "FFmpegEncoderConfig.h"
+#include "Tasks/Task.h"
+
+#include <atomic>
+
+/**
+ * Counters of FFFmpegEncodeGovernor
+ */
+struct BLUEPRINTFFMPEG_API FFFmpegEncodeGovernorStats {
+	/** current throttle level, 0 if not throttling */
+	int32 Level = 0;
+
+	/** smoothed time between game frames in seconds */
+	double FrameTime = 0.0;
+
+	/** smoothed busy time of the game thread in seconds */
+	double GameThreadTime = 0.0;
+
+	/** smoothed busy time of the render thread in seconds */
+	double RenderThreadTime = 0.0;
+
+	/** number of times the level has been raised */
+	int32 NumThrottles = 0;
+};
+
+/**
+ * Throttles encode work while the game misses its frame time target, so that
+ * capture does not push the game thread or the render thread over budget.
+ * Every engine tick while encoders are recording, it smooths
+ * FApp::GetDeltaTime and the busy time of the game and render threads, and
+ * moves between levels:
+ *   0. no throttling
+ *   1. conversion tasks run one priority lower
+ *   2. the shared scheduler runs at most half its workers, and dedicated
+ *      encode threads run one priority lower
+ *   3. the shared scheduler runs a single worker, dedicated encode threads
+ *      run at the lowest priority, and prewarming encoders is deferred
+ * The threads of the codec itself are not capped: their number is fixed
+ * when the codec is opened.
+ * The level goes up one step after the target has been missed for some
+ * frames, and down one step after both threads have had headroom for
+ * longer. Every change is logged with the times it was based on.
+ * Tuned by the ffmpeg.Governor.* console variables.
+ * Threadsafe.
+ */
+class BLUEPRINTFFMPEG_API FFFmpegEncodeGovernor {
+	// public functions
+public:
+	/**
+	 * @return   the governor shared by the whole process
+	 */
+	static FFFmpegEncodeGovernor& Get();
+
+	/**
+	 * Start watching frame times. Called on the game thread at startup.
+	 */
+	void Start();
+
+	/**
+	 * Stop watching frame times and lift the throttling. Prewarming held back
+	 * by the throttling is dropped rather than run. Called on the game thread
+	 * at shutdown.
+	 */
+	void Stop();
+
+	/**
+	 * @return   priority of conversion tasks of an encoder of Priority at the
+	 *           current level
+	 */
+	LowLevelTasks::ETaskPriority
+	    GetTaskPriority(EFFmpegEncoderPriority Priority) const noexcept;
+
+	/**
+	 * @return   priority of the dedicated encode thread of an encoder of
+	 *           Priority at the current level
+	 */
+	EThreadPriority
+	    GetThreadPriority(EFFmpegEncoderPriority Priority) const noexcept;
+
+	/**
+	 * @return   current counters
+	 */
+	FFFmpegEncodeGovernorStats GetStats() const;
+
+	// private functions
+private:
+	// called every engine tick on the game thread
+	bool Tick(float DeltaTime);
+
+	// @return   ffmpeg.Governor.TargetFrameTime in seconds
+	static double GetTargetFrameTime();
+
+	// apply the throttling of NewLevel and log why
+	void SetLevel(int32 NewLevel);
+
+	// private constants
+private:
+	// the highest level
+	static constexpr int32 MaxLevel = 3;
+
+	// weight of the latest frame in the smoothed times
+	static constexpr double Smoothing = 0.1;
+
+	// private fields: game thread only
+private:
+	FTSTicker::FDelegateHandle TickerHandle;
+	int32                      NumFramesOverBudget   = 0;
+	int32                      NumFramesWithHeadroom = 0;
+
+	// private fields: beware of data race
+private:
+	std::atomic<int32>  Level            = 0;
+	std::atomic<double> FrameTime        = 0.0;
+	std::atomic<double> GameThreadTime   = 0.0;
+	std::atomic<double> RenderThreadTime = 0.0;
+	std::atomic<int32>  NumThrottles     = 0;
+};
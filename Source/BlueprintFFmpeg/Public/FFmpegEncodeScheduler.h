@@ -0,0 +1,208 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "FFmpegEncoderConfig.h"
+#include "HAL/Runnable.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+/**
+ * Work of an encoder run by FFFmpegEncodeScheduler. A session is run by at
+ * most one worker at a time, so its slices need no synchronization among
+ * themselves.
+ */
+class BLUEPRINTFFMPEG_API FFFmpegScheduledSession {
+	// public functions
+public:
+	virtual ~FFFmpegScheduledSession() = default;
+
+	/**
+	 * Do the work that is ready without blocking.
+	 * @param MaxFrames   number of frames to encode at most.
+	 * @return   true if more work is ready, then the session is run again
+	 *           after the other queued sessions.
+	 */
+	virtual bool RunSlice(int32 MaxFrames) = 0;
+
+	// private fields: guarded by the mutex of FFFmpegEncodeScheduler
+private:
+	friend class FFFmpegEncodeScheduler;
+
+	uint8                  ScheduleState = 0;
+	EFFmpegEncoderPriority Priority      = EFFmpegEncoderPriority::Normal;
+	double                 CPUShare      = 1.0;
+
+	// encode time divided by CPUShare, in seconds
+	double VirtualTime = 0.0;
+};
+
+/**
+ * Counters of FFFmpegEncodeScheduler
+ */
+struct BLUEPRINTFFMPEG_API FFFmpegEncodeSchedulerStats {
+	/** number of worker threads */
+	int32 NumWorkers = 0;
+
+	/** number of workers running a slice */
+	int32 NumRunningWorkers = 0;
+
+	/** number of sessions waiting for a worker */
+	int32 NumQueuedSessions = 0;
+
+	/** the largest NumQueuedSessions so far */
+	int32 MaxQueuedSessions = 0;
+
+	/** number of slices run so far */
+	uint64 NumSlices = 0;
+};
+
+/**
+ * Fixed pool of worker threads shared by all encoders, so that encoders do
+ * not each hold a thread that is idle between frames.
+ * Sessions with work ready are queued, and a worker runs a slice of the
+ * queued session of the highest priority that has used the least encode
+ * time for its CPU share. A session with more work is queued again, so that
+ * a busy encoder can not starve the others of its priority.
+ * The sessions recording on any encoder are also counted by priority, so
+ * that encoders of a lower priority can yield to them.
+ * The number of workers is ffmpeg.EncodeScheduler.NumWorkers, read when the
+ * first session is scheduled.
+ * Threadsafe.
+ */
+class BLUEPRINTFFMPEG_API FFFmpegEncodeScheduler {
+	// public functions
+public:
+	/**
+	 * @return   the scheduler shared by the whole process
+	 */
+	static FFFmpegEncodeScheduler& Get();
+
+	/**
+	 * Request Session to be run. Call whenever Session gets work. A session
+	 * already queued is not queued twice, and a running session is run again
+	 * after the current slice. After Shutdown, Session is run on the calling
+	 * thread instead.
+	 */
+	void Schedule(FFFmpegScheduledSession& Session);
+
+	/**
+	 * Set how Session competes with the other sessions.
+	 * @param CPUShare   weight of encode time among sessions of Priority.
+	 */
+	void SetPriority(FFFmpegScheduledSession& Session,
+	                 EFFmpegEncoderPriority Priority, float CPUShare);
+
+	/**
+	 * Limit the workers running slices at once, e.g. while the game is over
+	 * its frame time budget. At least one worker runs.
+	 * @param RunningWorkerFraction   fraction of the workers, 1 for all.
+	 */
+	void SetThrottle(double RunningWorkerFraction);
+
+	/**
+	 * @return   number of recording sessions counted by AddActiveSession
+	 */
+	int32 GetNumActiveSessions() const noexcept;
+
+	/**
+	 * Count a recording session of Priority, whether on the shared scheduler
+	 * or not. Call RemoveActiveSession when it has finished.
+	 */
+	void AddActiveSession(EFFmpegEncoderPriority Priority) noexcept;
+
+	/**
+	 * Stop counting a session counted by AddActiveSession.
+	 */
+	void RemoveActiveSession(EFFmpegEncoderPriority Priority) noexcept;
+
+	/**
+	 * @return   true if a session of a higher priority than Priority is
+	 *           recording.
+	 */
+	bool HasActiveSessionAbove(EFFmpegEncoderPriority Priority) const noexcept;
+
+	/**
+	 * Block until Session is neither queued nor running. Session must not be
+	 * scheduled again before it is destroyed.
+	 */
+	void WaitForIdle(FFFmpegScheduledSession& Session);
+
+	/**
+	 * @return   current counters
+	 */
+	FFFmpegEncodeSchedulerStats GetStats() const;
+
+	/**
+	 * Run the queued sessions and stop all workers. Sessions scheduled from
+	 * now on are run by the caller of Schedule.
+	 */
+	void Shutdown();
+
+	// private types
+private:
+	enum EScheduleState : uint8 { Idle, Queued, Running, RunningRequeued };
+
+	// a worker thread
+	class FWorker: public FRunnable {
+	public:
+		explicit FWorker(FFFmpegEncodeScheduler& InScheduler);
+
+		virtual uint32 Run() override;
+
+	private:
+		FFFmpegEncodeScheduler& Scheduler;
+	};
+
+	// private functions
+private:
+	// create the worker threads. Queue_mutex must be locked.
+	void StartWorkers();
+
+	// @return   true if a queued session can be run now. Queue_mutex must be
+	//           locked.
+	bool CanRunSlice() const;
+
+	// block until a session is queued and take it
+	// @return   nullptr if the scheduler is shutting down.
+	FFFmpegScheduledSession* Dequeue();
+
+	// run slices of Session on the calling thread until it has no more work.
+	// Session must have been set Running.
+	void RunInline(FFFmpegScheduledSession& Session);
+
+	// called by a worker when a slice of Session has finished
+	// @param Cycles   cycles of FPlatformTime::Cycles64 the slice took.
+	void FinishSlice(FFFmpegScheduledSession& Session, bool bMoreWork,
+	                 uint64 Cycles);
+
+	// private constants
+private:
+	// frames a session encodes per slice before yielding to the others
+	static constexpr int32 FramesPerSlice = 4;
+
+	// number of EFFmpegEncoderPriority values
+	static constexpr int32 NumPriorities = 3;
+
+	// private fields: guarded by Queue_mutex
+private:
+	TArray<FFFmpegScheduledSession*> Queue;
+	TArray<TUniquePtr<FWorker>>      Workers;
+	TArray<FRunnableThread*>         Threads;
+	bool                             bShuttingDown            = false;
+	int32                            MaxQueuedSessions        = 0;
+	double                           VirtualClock             = 0.0;
+	int32                            NumRunningWorkers        = 0;
+	double                           MaxRunningWorkerFraction = 1.0;
+	mutable std::mutex               Queue_mutex;
+	std::condition_variable          Queue_cv;
+	std::condition_variable          Idle_cv;
+
+	// private fields: beware of data race
+private:
+	std::atomic<uint64> NumSlices = 0;
+	std::atomic<int32>  NumActiveSessions[NumPriorities] = {};
+};
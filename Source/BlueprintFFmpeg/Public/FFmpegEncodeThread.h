@@ -5,12 +5,22 @@
 #include "CoreMinimal.h"
 #include "CreateImageFromTextureRHI.h"
 #include "Engine/TextureRenderTarget2D.h"
+#include "FFmpegBufferedOutput.h"
+#include "FFmpegCodecProfile.h"
+#include "FFmpegEncodeGovernor.h"
+#include "FFmpegEncodeScheduler.h"
 #include "FFmpegEncoderConfig.h"
+#include "FFmpegEncoderPool.h"
 #include "FFmpegFrameSharedPtr.h"
+#include "FFmpegGPUConversion.h"
+#include "FFmpegMuxThread.h"
+#include "FFmpegRateControl.h"
+#include "FFmpegTextureReadbackRing.h"
 #include "FFmpegUtils.h"
 #include "LogFFmpegEncoder.h"
 
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 
 /**
@@ -29,11 +39,46 @@ enum class FFmpegEncoderCloseResult : uint8 { Success, Failure };
  * Result type of UFFmpegEncoder::AddFrame
  */
 UENUM(BlueprintType)
-enum class FFmpegEncoderAddFrameResult : uint8 { Success, Failure };
+enum class FFmpegEncoderAddFrameResult : uint8 {
+	Success,
+	Failure,
+
+	/**
+	 * too many frames were in flight, so the added frame or an older frame
+	 * waiting for conversion was dropped
+	 */
+	Dropped,
+
+	/**
+	 * too many frames were in flight, so the previous frame is encoded again
+	 * instead of the added frame
+	 */
+	Duplicated
+};
+
+/**
+ * Counters of frames added to FFFmpegEncodeThread
+ */
+struct BLUEPRINTFFMPEG_API FFFmpegFrameQueueStats {
+	/** number of frames added but not encoded yet */
+	int32 NumFramesInFlight = 0;
+
+	/** estimated bytes of frames added but not encoded yet */
+	int64 BytesInFlight = 0;
+
+	/** the largest NumFramesInFlight so far */
+	int32 MaxFramesInFlight = 0;
+
+	/** number of frames dropped by the backpressure policy */
+	int32 NumDroppedFrames = 0;
+
+	/** number of frames replaced by the previous frame */
+	int32 NumDuplicatedFrames = 0;
+};
 
 enum class FFmpegEncoderThreadResult {
 	Success = 0,
-	CodecH264IsNotFound,
+	CodecIsNotFound,
 	FailedToAllocateCodecContext,
 	FailedToInitializeCodecContext,
 	FailedToInitializeIOContext,
@@ -41,13 +86,15 @@ enum class FFmpegEncoderThreadResult {
 	FailedToAddANewStream,
 	FailedToSetCodecParameters,
 	FailedToWriteHeader,
+	FailedToStartMuxThread,
 
 	FailedToSendFrame,
 	FailedToAllocatePacket,
 	FailedToWritePacket,
 
 	FailedToFlushSendFrame,
-	FailedToWriteTrailer
+	FailedToWriteTrailer,
+	FailedToCloseOutput
 };
 
 /**
@@ -58,8 +105,12 @@ enum class FFmpegEncoderThreadResult {
  *   3. call AddFrame function for each frames you want to encode
  *   4. call Close function
  * then the video is output to the OutputFilePath specified in Open function.
+ * Open function can be called again after Close function to record another
+ * video. The previous video is still written in the background, and the
+ * encode thread and frame buffers are reused.
  */
-class BLUEPRINTFFMPEG_API FFFmpegEncodeThread: public FRunnable {
+class BLUEPRINTFFMPEG_API FFFmpegEncodeThread: public FRunnable,
+                                              public FFFmpegScheduledSession {
 	// type aliases
 public:
 	using TTask_Frame = UE::Tasks::TTask<FFFmpegFrameThreadSafeSharedPtr>;
@@ -68,7 +119,8 @@ public:
 	// public functions
 public:
 	/**
-	 * Initialize and put into encoding standby status.
+	 * Initialize and put into encoding standby status. A previous video still
+	 * being written is finished in the background after it.
 	 * @param FFmpegEncoderConfig   setting.
 	 * @param OutputFilePath   Output destination file path.
 	 *                         The output format is determined by the
@@ -86,25 +138,25 @@ public:
 	void Close();
 
 	/**
-	 * Add a frame. The argument is converted to a YUV420P format image, added as
-	 * a frame, and appended to the file immediately after the frame data is
-	 * finalized.
+	 * Add a frame. The argument is converted to an image of EncodePixelFormat
+	 * of Config, added as a frame, and appended to the file immediately after
+	 * the frame data is finalized.
 	 */
 	void AddFrame(const UTextureRenderTarget2D* TextureRenderTarget,
 	              FFmpegEncoderAddFrameResult& Result, FString& ErrorMessage);
 
 	/**
-	 * Add a frame. The argument is converted to a YUV420P format image, added as
-	 * a frame, and appended to the file immediately after the frame data is
-	 * finalized.
+	 * Add a frame. The argument is converted to an image of EncodePixelFormat
+	 * of Config, added as a frame, and appended to the file immediately after
+	 * the frame data is finalized.
 	 */
 	void AddFrame(const FString& ImagePath, FFmpegEncoderAddFrameResult& Result,
 	              FString& ErrorMessage);
 
 	/**
-	 * Add a frame. The argument is converted to a YUV420P format image, added as
-	 * a frame, and appended to the file immediately after the frame data is
-	 * finalized.
+	 * Add a frame. The argument is converted to an image of EncodePixelFormat
+	 * of Config, added as a frame, and appended to the file immediately after
+	 * the frame data is finalized.
 	 */
 	template <typename FTextureRHIRef_T>
 	  requires std::is_same_v<FTextureRHIRef,
@@ -113,17 +165,17 @@ public:
 	              FFmpegEncoderAddFrameResult& Result, FString& ErrorMessage);
 
 	/**
-	 * Add a frame. The argument is converted to a YUV420P format image, added as
-	 * a frame, and appended to the file immediately after the frame data is
-	 * finalized.
+	 * Add a frame. The argument is converted to an image of EncodePixelFormat
+	 * of Config, added as a frame, and appended to the file immediately after
+	 * the frame data is finalized.
 	 */
 	void AddFrame(const TTask_Image&           ImageTask,
 	              FFmpegEncoderAddFrameResult& Result, FString& ErrorMessage);
 
 	/**
-	 * Add a frame. The argument is converted to a YUV420P format image, added as
-	 * a frame, and appended to the file immediately after the frame data is
-	 * finalized.
+	 * Add a frame. The argument is converted to an image of EncodePixelFormat
+	 * of Config, added as a frame, and appended to the file immediately after
+	 * the frame data is finalized.
 	 */
 	template <typename TTaskFFFmpegFrameThreadSafeSharedPtr_T>
 	  requires std::is_same_v<
@@ -132,6 +184,32 @@ public:
 	void AddFrame(TTaskFFFmpegFrameThreadSafeSharedPtr_T&& Frame,
 	              FFmpegEncoderAddFrameResult& Result, FString& ErrorMessage);
 
+	/**
+	 * @return   counters of the pool of frame buffers
+	 */
+	FFFmpegFramePoolStats GetFramePoolStats() const;
+
+	/**
+	 * @return   counters of frames in flight, dropped and duplicated
+	 */
+	FFFmpegFrameQueueStats GetFrameQueueStats() const;
+
+	/**
+	 * @return   utilization of the encode and mux stages
+	 */
+	FFFmpegPipelineStats GetPipelineStats() const;
+
+	/**
+	 * @return   bitrate and VBV buffer fullness of encoded frames
+	 */
+	FFFmpegRateControlStats GetRateControlStats() const;
+
+	/**
+	 * @return   pixel format frames are converted to for the codec. Valid
+	 *           after Open function succeeded.
+	 */
+	AVPixelFormat GetFrameFormat() const noexcept;
+
 public:
 	~FFFmpegEncodeThread();
 
@@ -140,6 +218,181 @@ public:
 	virtual uint32 Run() override;
 	virtual void   Stop() override;
 
+	// FFFmpegScheduledSession interfaces
+public:
+	virtual bool RunSlice(int32 MaxFrames) override;
+
+	// private types
+private:
+	/**
+	 * State of a frame waiting for conversion, shared by the producer and the
+	 * conversion task. A frame can be dropped only before its conversion
+	 * starts.
+	 */
+	struct FFrameTicket {
+		enum EState : uint8 { Pending, Converting, Dropped };
+
+		std::atomic<uint8> State = Pending;
+
+		// bytes counted in BytesInFlight. producer only.
+		int64 Bytes = 0;
+
+		bool TryStart() noexcept;
+		bool TryDrop() noexcept;
+		bool IsDropped() const noexcept;
+	};
+
+	using FFrameTicketPtr = TSharedPtr<FFrameTicket, ESPMode::ThreadSafe>;
+
+	// an entry of FrameTasks
+	struct FQueuedFrame {
+		TTask_Frame     Task;
+		FFrameTicketPtr Ticket;
+
+		// bytes counted in BytesInFlight, or -1 if not counted
+		int64 Bytes = -1;
+	};
+
+	/**
+	 * A video from Open to Close. Open queues a session and returns at once,
+	 * so a session may still be written while the next one is recording.
+	 */
+	struct FSession {
+		// set by Open before the session is queued
+		FFFmpegEncoderConfig Config;
+		FString              VideoPath;
+		const AVCodec*       Codec       = nullptr;
+		AVPixelFormat        FrameFormat = AV_PIX_FMT_NONE;
+
+		// frame pool of Open, which the next session may replace
+		TSharedPtr<FFFmpegFramePool, ESPMode::ThreadSafe> FramePool;
+
+		// single-producer, single-consumer, lock-free
+		TQueue<FQueuedFrame, EQueueMode::Spsc> FrameTasks;
+		std::atomic_bool                       bRunning = true;
+
+		// frames in flight, guarded by FramesInFlight_mutex
+		int32                   NumFramesInFlight = 0;
+		int64                   BytesInFlight     = 0;
+		bool                    bSessionEnded     = false;
+		mutable std::mutex      FramesInFlight_mutex;
+		std::condition_variable Producer_cv;
+
+		// counters
+		std::atomic<int32> PeakFramesInFlight  = 0;
+		std::atomic<int32> NumDroppedFrames    = 0;
+		std::atomic<int32> NumDuplicatedFrames = 0;
+
+		// stages of the pipeline
+		FFFmpegStageTimer  EncodeStageTimer;
+		FFFmpegStageTimer  MuxStageTimer;
+		std::atomic<int32> PeakQueuedPackets = 0;
+
+		// bitrate of encoded frames
+		FFFmpegRateControl RateControl;
+
+		// opened by the thread running the session
+		AVCodecContext*                   CodecContext  = nullptr;
+		TUniquePtr<FFFmpegBufferedOutput> Output;
+		AVFormatContext*                  FormatContext = nullptr;
+		AVStream*                         Stream        = nullptr;
+		TUniquePtr<FFFmpegMuxThread>      MuxThread;
+	};
+
+	using FSessionPtr = TSharedPtr<FSession, ESPMode::ThreadSafe>;
+
+	// private functions
+private:
+	/**
+	 * Add a frame from ImageTask.
+	 * @param bRecycleImage   true if the image is owned by this encoder and
+	 *                        can be returned to FFFmpegImagePool once it has
+	 *                        been converted into a frame.
+	 * @param ImageBytes      bytes of the image.
+	 */
+	void AddFrame(const TTask_Image& ImageTask, bool bRecycleImage,
+	              int64 ImageBytes, FFmpegEncoderAddFrameResult& Result,
+	              FString& ErrorMessage);
+
+	/**
+	 * Enqueue FrameTask applying the backpressure policy of Config.
+	 * @param Ticket       ticket checked by the conversion task of FrameTask,
+	 *                     or nullptr if the frame can not be dropped.
+	 * @param ImageBytes   bytes of the image the frame is converted from, or 0
+	 *                     if there is none.
+	 */
+	void EnqueueFrame(TTask_Frame FrameTask, const FFrameTicketPtr& Ticket,
+	                  int64 ImageBytes, FFmpegEncoderAddFrameResult& Result,
+	                  FString& ErrorMessage);
+
+	// @return   true if a frame of Bytes can not be in flight.
+	//           FramesInFlight_mutex must be locked.
+	bool IsFrameQueueFull(int64 Bytes) const;
+
+	// block until a frame of Bytes can be added
+	void WaitForRoomInFrameQueue(int64 Bytes);
+
+	// drop the oldest frame that has not been converted yet
+	bool DropOldestPendingFrame();
+
+	// called when an entry of Session no longer holds memory in flight
+	static void ReleaseFrameInFlight(FSession& Session, int64 Bytes);
+
+	// sleep until a frame of Session is enqueued or Session ends. encode
+	// thread only.
+	void WaitForFrameTasks(FSession& Session);
+
+	// end Session, so that the rest of the video is written
+	void EndSession(FSession& Session);
+
+	// block until every session queued by Open has finished, polling
+	// readbacks meanwhile
+	void WaitForSessionToFinish();
+
+	// block until no worker of the shared scheduler runs or will run this
+	void WaitForScheduler();
+
+	// schedule this again once FrameTask has finished. workers of the shared
+	// scheduler only.
+	void LaunchWakeTask(const TTask_Frame& FrameTask,
+	                    EFFmpegEncoderPriority Priority);
+
+	// block until Open queues a session or Stop is called. encode thread only.
+	// @return   the next session, or nullptr if the thread should exit.
+	FSessionPtr WaitForSession();
+
+	// @return   the next session queued for the shared scheduler, or nullptr
+	FSessionPtr TakeScheduledSession();
+
+	// encode frames of Session into its VideoPath. encode thread only.
+	FFmpegEncoderThreadResult RunSession(FSession& Session);
+
+	// the functions below are called by the thread running the session: the
+	// encode thread or a worker of the shared scheduler.
+
+	// open the codec context and the output of Session
+	FFmpegEncoderThreadResult OpenSession(FSession& Session);
+
+	// send a frame to the codec and mux the packets it outputs
+	FFmpegEncoderThreadResult EncodeFrame(FSession&     Session,
+	                                      FQueuedFrame& QueuedFrame);
+
+	// mux all packets the codec has output
+	FFmpegEncoderThreadResult ReceiveAllPendingPackets(FSession& Session);
+
+	// flush the codec, write the trailer and close the output
+	FFmpegEncoderThreadResult CloseSession(FSession& Session);
+
+	// free what a failed session has left open
+	void AbortSession(FSession& Session);
+
+	// called when Session has finished
+	void FinishSession(FSession& Session, FFmpegEncoderThreadResult Result);
+
+	// counters of Session
+	static FFFmpegFrameQueueStats FrameQueueStatsOf(const FSession& Session);
+	static FFFmpegPipelineStats   PipelineStatsOf(const FSession& Session);
+
 	// private constants
 private:
 	static constexpr const TCHAR checkfMesNotOpened_AddFrame[] =
@@ -147,22 +400,60 @@ private:
 	static constexpr const TCHAR checkfMesClosed_AddFrame[] = TEXT(
 	    "Once Close function is called, this function can no longer be called.");
 
+	// presets an encoder yielding to a higher priority goes faster by
+	static constexpr int32 DegradedPresetSteps = 2;
+
+	// how often the game thread polls readbacks while it is blocked, as no
+	// tick polls them then
+	static constexpr std::chrono::milliseconds ReadbackPollInterval{1};
+
 	// private fields: no data race
 private:
-	bool                 bOpened = false;
-	bool                 bClosed = false;
-	FFFmpegEncoderConfig Config;
-	FString              VideoPath;
-	int64_t              FrameIndex = 0;
-	FRunnableThread*     Thread     = nullptr;
+	bool                                                        bOpened = false;
+	bool                                                        bClosed = false;
+	FFFmpegEncoderConfig                                        Config;
+	FSessionPtr                                                 CurrentSession;
+	AVPixelFormat                                               FrameFormat = AV_PIX_FMT_NONE;
+	FFFmpegConversionOptions                                    ConversionOptions;
+	TSharedPtr<FFFmpegFramePool, ESPMode::ThreadSafe>           FramePool;
+	TSharedPtr<FFFmpegTextureReadbackRing, ESPMode::ThreadSafe> ReadbackRing;
+	int64_t                                                     FrameIndex    = 0;
+	FRunnableThread*                                            Thread        = nullptr;
+	int64                                                       FrameBytes    = 0;
+	TTask_Frame                                                 LastFrameTask;
+	TArray<FFrameTicketPtr>                                     PendingTickets;
+	TArray<UE::Tasks::FTaskEvent>                               ConversionWindow;
+	int32                                                       NextConversionWindowSlot = 0;
+	bool                                                        bSharedScheduler = false;
+	bool                                                        bUsedScheduler   = false;
+	bool                                                        bYielding        = false;
+
+	// private fields: workers of the shared scheduler only
+private:
+	// the session being written on the shared scheduler
+	FSessionPtr ScheduledSession;
 
 	// private fields: beware of data race
 private:
-	// single-producer, single-consumer
-	TQueue<TTask_Frame, EQueueMode::Spsc> FrameTasks;
-	std::atomic_bool                      bRunning = true;
-	std::mutex                            FrameTasks_mutex;
-	std::condition_variable               EncodeThread_cv;
+	// the producer triggers EncodeThreadEvent only if bEncodeThreadWaiting
+	FEvent*          EncodeThreadEvent    = nullptr;
+	std::atomic_bool bEncodeThreadWaiting = false;
+
+	// sessions queued by Open and finished by the encode thread or the shared
+	// scheduler, and wake tasks that have not finished, guarded by
+	// Session_mutex
+	TArray<FSessionPtr>     ThreadSessions;
+	TArray<FSessionPtr>     ScheduledSessions;
+	int32                   NumSessionsStarted  = 0;
+	int32                   NumSessionsFinished = 0;
+	int32                   NumPendingWakeTasks = 0;
+	bool                    bShuttingDown       = false;
+	std::mutex              Session_mutex;
+	std::condition_variable Session_cv;
+
+	// bytes of the last image converted, the estimate for images that have
+	// not been created yet
+	std::atomic<int64> LastImageBytes = 0;
 };
 
 #pragma region definition of template functions
@@ -177,11 +468,44 @@ void FFFmpegEncodeThread::AddFrame(FTextureRHIRef_T&&           TextureRHI,
 	// and Close function must not be called.
 	checkf(!bClosed, checkfMesClosed_AddFrame);
 
+	// conversion tasks run at the priority the governor allows now
+	ConversionOptions.TaskPriority =
+	    FFFmpegEncodeGovernor::Get().GetTaskPriority(Config.Priority);
+
+	// convert on the GPU if possible
+	if (Config.bGPUConversion &&
+	    FFFmpegGPUConversion::IsSupported(TextureRHI, FrameFormat, Config.Width,
+	                                      Config.Height)) {
+		auto FrameTask =
+		    FFFmpegGPUConversion::ConvertAsync(Forward<FTextureRHIRef_T>(TextureRHI),
+		                                       FrameIndex, ConversionOptions);
+		return AddFrame(MoveTemp(FrameTask), Result, ErrorMessage);
+	}
+
+	// bytes of the image read back from the texture
+	const auto& Extent = TextureRHI->GetDesc().Extent;
+	auto        ImageFormat = ERawImageFormat::BGRA8;
+	EGammaSpace GammaSpace;
+	CreateImageFromTextureRHI_Private::ImageFormatOf(
+	    TextureRHI->GetDesc().Format, ImageFormat, GammaSpace);
+	const auto& ImageBytes = int64(Extent.X) * Extent.Y *
+	                         ERawImageFormat::GetBytesPerPixel(ImageFormat);
+
+	// capture through the readback ring if possible
+	const auto& bUseReadbackRing =
+	    ReadbackRing.IsValid() &&
+	    FFFmpegTextureReadbackRing::IsSupported(TextureRHI->GetDesc().Format);
+
 	// launch task to create image
 	auto ImageTask =
-	    CreateImageFromTextureRHIAsync(Forward<FTextureRHIRef_T>(TextureRHI));
-
-	return AddFrame(MoveTemp(ImageTask), Result, ErrorMessage);
+	    bUseReadbackRing
+	        ? ReadbackRing->Enqueue(Forward<FTextureRHIRef_T>(TextureRHI))
+	        : CreateImageFromTextureRHIAsync(
+	              Forward<FTextureRHIRef_T>(TextureRHI));
+
+	// the image is created here, so it can be recycled
+	return AddFrame(MoveTemp(ImageTask), true, ImageBytes, Result,
+	                ErrorMessage);
 }
 
 template <typename TTaskFFFmpegFrameThreadSafeSharedPtr_T>
@@ -197,36 +521,8 @@ void FFFmpegEncodeThread::AddFrame(
 	// and Close function must not be called.
 	checkf(!bClosed, checkfMesClosed_AddFrame);
 
-	// helper function to finish with success
-	const auto& Success = [&]() {
-		Result = FFmpegEncoderAddFrameResult::Success;
-	};
-
-	// helper function to finish with failure
-	const auto& Failure = [&](const FString& Message) {
-		ErrorMessage = Message;
-		UE_LOG(LogFFmpegEncoder, Error, TEXT("%s"), *ErrorMessage);
-		Result = FFmpegEncoderAddFrameResult::Failure;
-	};
-
-	// enqueue frame
-	const auto& SuccessToEnqueue = FrameTasks.Enqueue(
-	    Forward<TTaskFFFmpegFrameThreadSafeSharedPtr_T>(Frame));
-
-	// if failed to enqueue
-	if (!SuccessToEnqueue) {
-		return Failure("Failed to enqueue the frame.");
-	}
-
-	// increment FrameIndex
-	++FrameIndex;
-
-	// notify that a task has been enqueued to FrameTasks
-	{
-		std::lock_guard lk(FrameTasks_mutex);
-		EncodeThread_cv.notify_one();
-	}
-
-	return Success();
+	// a frame made by the caller can not be dropped before conversion
+	return EnqueueFrame(Forward<TTaskFFFmpegFrameThreadSafeSharedPtr_T>(Frame),
+	                    nullptr, 0, Result, ErrorMessage);
 }
 #pragma endregion
@@ -16,6 +16,10 @@
  *   3. call AddFrame function for each frames you want to encode
  *   4. call Close function
  * then the video is output to the OutputFilePath specified in Open function.
+ * Open function can be called again after Close function to record another
+ * video without waiting for the previous one to be written. The encode thread
+ * and frame buffers are reused, and a codec of the same settings is opened in
+ * the background for the next video.
  */
 UCLASS(Blueprintable, BlueprintType)
 class BLUEPRINTFFMPEG_API UFFmpegEncoder: public UObject {
@@ -101,6 +105,26 @@ public:
 	void AddFrame(TTaskFFFmpegFrameThreadSafeSharedPtr_T&& Frame,
 	              FFmpegEncoderAddFrameResult& Result, FString& ErrorMessage);
 
+	/**
+	 * @return   counters of the pool of frame buffers
+	 */
+	FFFmpegFramePoolStats GetFramePoolStats() const;
+
+	/**
+	 * @return   counters of frames in flight, dropped and duplicated
+	 */
+	FFFmpegFrameQueueStats GetFrameQueueStats() const;
+
+	/**
+	 * @return   utilization of the encode and mux stages
+	 */
+	FFFmpegPipelineStats GetPipelineStats() const;
+
+	/**
+	 * @return   bitrate and VBV buffer fullness of encoded frames
+	 */
+	FFFmpegRateControlStats GetRateControlStats() const;
+
 	// private fields
 private:
 	FFFmpegEncodeThread FFmpegEncodeThread;
@@ -6,6 +6,207 @@
 
 #include "FFmpegEncoderConfig.generated.h"
 
+/**
+ * Filter used when the source image is scaled to the output size
+ */
+UENUM(BlueprintType)
+enum class EFFmpegScaleFilter : uint8 { Point, Bilinear, Area, Lanczos };
+
+/**
+ * How the source image is fitted into the output size when their aspect
+ * ratios differ
+ */
+UENUM(BlueprintType)
+enum class EFFmpegScaleFitMode : uint8 {
+	/** scale to the output size ignoring the aspect ratio */
+	Stretch,
+
+	/** fit the whole image and fill the rest with black */
+	Letterbox,
+
+	/** fill the whole output and cut off the overflowing part of the image */
+	Crop
+};
+
+/**
+ * Codec of encoded video. The codec must be enabled in the FFmpeg build and
+ * supported by the container of the output file.
+ */
+UENUM(BlueprintType)
+enum class EFFmpegCodec : uint8 {
+	/** H.264 by libx264 */
+	H264,
+
+	/** H.265 by libx265. About half the size of H.264 at equal quality */
+	HEVC,
+
+	/** AV1 by SVT-AV1, or libaom if SVT-AV1 is not available */
+	AV1,
+
+	/** VP9 by libvpx */
+	VP9,
+
+	/** lossless intra-only codec for archiving. Use .mkv or .avi */
+	FFV1,
+
+	/** intra-only JPEG frames. Use .avi, .mkv or .mov */
+	MJPEG
+};
+
+/**
+ * Pixel format of encoded video
+ */
+UENUM(BlueprintType)
+enum class EFFmpegEncodePixelFormat : uint8 {
+	/** 8-bit YUV 4:2:0 */
+	YUV420P,
+
+	/** 10-bit YUV 4:2:0, encoded with the High 10 profile */
+	YUV420P10,
+
+	/**
+	 * 8-bit BGR encoded by libx264rgb. BGRA images are encoded without
+	 * conversion or copy, but few players support it.
+	 */
+	BGR0
+};
+
+/**
+ * Tone mapping applied when float images are converted to video
+ */
+UENUM(BlueprintType)
+enum class EFFmpegToneMapping : uint8 {
+	/** clamp values to [0, 1] */
+	None,
+
+	/** x / (1 + x) */
+	Reinhard,
+
+	/** fitted ACES filmic curve */
+	ACES
+};
+
+/**
+ * How render targets are read back from the GPU
+ */
+UENUM(BlueprintType)
+enum class EFFmpegCaptureMode : uint8 {
+	/**
+	 * read back every capture on its own and complete it once its copy has
+	 * finished, polled every engine tick
+	 */
+	Immediate,
+
+	/**
+	 * copy into a ring of reused staging buffers and map each once its copy
+	 * has finished, so that capturing never stalls the GPU
+	 */
+	ReadbackRing
+};
+
+/**
+ * Priority of an encoder over other encoders running at once
+ */
+UENUM(BlueprintType)
+enum class EFFmpegEncoderPriority : uint8 {
+	/** e.g. background captures. degraded first with bDegradeWhenYielding. */
+	Low,
+
+	Normal,
+
+	/** e.g. the main camera. degraded last. */
+	High
+};
+
+/**
+ * What AddFrame does when the limit of frames in flight is reached
+ */
+UENUM(BlueprintType)
+enum class EFFmpegBackpressurePolicy : uint8 {
+	/** wait until the encoder catches up */
+	Block,
+
+	/** drop the added frame */
+	DropNewest,
+
+	/** drop the oldest frame that has not been converted yet */
+	DropOldest,
+
+	/** encode the previous frame again instead of the added frame */
+	DuplicatePrevious
+};
+
+/**
+ * How the encoder distributes bits between frames
+ */
+UENUM(BlueprintType)
+enum class EFFmpegRateControl : uint8 {
+	/** constant quality given by CRF. The size depends on the content */
+	CRF,
+
+	/** constant quantizer given by QP. Mostly for testing */
+	CQP,
+
+	/** the average bitrate over the whole video approaches BitRate */
+	ABR,
+
+	/**
+	 * constant bitrate: BitRate every second, constrained by the VBV buffer.
+	 * For streaming and captures with a fixed disk budget.
+	 */
+	CBR
+};
+
+/**
+ * Preset of libx264, trading encoding speed for compression
+ */
+UENUM(BlueprintType)
+enum class EFFmpegX264Preset : uint8 {
+	Ultrafast,
+	Superfast,
+	Veryfast,
+	Faster,
+	Fast,
+	Medium,
+	Slow,
+	Slower,
+	Veryslow,
+	Placebo
+};
+
+/**
+ * Tune of libx264, adjusting the preset for a kind of content or use
+ */
+UENUM(BlueprintType)
+enum class EFFmpegX264Tune : uint8 {
+	/** no tuning */
+	None,
+
+	Film,
+	Animation,
+	Grain,
+	StillImage,
+	FastDecode,
+
+	/** no frame delay, for realtime capture and streaming */
+	ZeroLatency
+};
+
+/**
+ * How the encoder splits work between its threads
+ */
+UENUM(BlueprintType)
+enum class EFFmpegThreadType : uint8 {
+	/** chosen by the encoder */
+	Auto,
+
+	/** frames are encoded in parallel. Higher throughput, more latency */
+	Frame,
+
+	/** each frame is split into slices encoded in parallel. Lower latency */
+	Slice
+};
+
 /**
  * Structure for FFmpegEncoder settings
  */
@@ -32,8 +233,290 @@ struct BLUEPRINTFFMPEG_API FFFmpegEncoderConfig {
 	float FrameRate = 30.0f;
 
 	/**
-	 * BitRate of output media
+	 * BitRate of output media in bits per second. Used by ABR and CBR.
 	 */
 	UPROPERTY(EditAnywhere, BlueprintReadWrite)
 	int32 BitRate = 5000000;
+
+	/**
+	 * Rate control mode
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	EFFmpegRateControl RateControl = EFFmpegRateControl::CRF;
+
+	/**
+	 * Quality of CRF. Lower is better, 18 is visually lossless.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite,
+	          meta = (ClampMin = "0", ClampMax = "51"))
+	float CRF = 18.0f;
+
+	/**
+	 * Quantizer of CQP. Lower is better.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "0"))
+	int32 QP = 23;
+
+	/**
+	 * Maximum rate of the VBV buffer in bits per second, which bounds
+	 * bitrate spikes of CRF and ABR. 0 leaves them unbounded. CBR uses
+	 * BitRate.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "0"))
+	int32 MaxBitRate = 0;
+
+	/**
+	 * Size of the VBV buffer in bits. Smaller buffers bound the rate over
+	 * shorter periods. 0 holds one second at the maximum rate.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "0"))
+	int32 VBVBufferSize = 0;
+
+	/**
+	 * Codec of output media
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	EFFmpegCodec Codec = EFFmpegCodec::H264;
+
+	/**
+	 * Pixel format of output media. Use YUV420P10 to keep the precision of
+	 * float render targets. If Codec does not support it, the closest format
+	 * Codec supports is used.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	EFFmpegEncodePixelFormat EncodePixelFormat = EFFmpegEncodePixelFormat::YUV420P;
+
+	/**
+	 * Tone mapping applied to float images
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	EFFmpegToneMapping ToneMapping = EFFmpegToneMapping::None;
+
+	/**
+	 * If true, float images are quantized with ordered dithering to avoid
+	 * banding in gradients
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	bool bDither = false;
+
+	/**
+	 * Filter used when the size of source images differs from the output size
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	EFFmpegScaleFilter ScaleFilter = EFFmpegScaleFilter::Bilinear;
+
+	/**
+	 * How source images are fitted when their aspect ratio differs from the
+	 * output
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	EFFmpegScaleFitMode ScaleFitMode = EFFmpegScaleFitMode::Stretch;
+
+	/**
+	 * Rows per band when a single frame is converted by several workers in
+	 * parallel. 0 converts each frame on a single worker.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "0"))
+	int32 ConversionBandHeight = 0;
+
+	/**
+	 * Maximum number of bands a single frame is split into.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "1"))
+	int32 MaxConversionBands = 8;
+
+	/**
+	 * How render targets are read back from the GPU
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	EFFmpegCaptureMode CaptureMode = EFFmpegCaptureMode::Immediate;
+
+	/**
+	 * Number of staging buffers reused when CaptureMode is ReadbackRing.
+	 * Captures beyond it while all are in flight get a staging buffer of
+	 * their own.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "1"))
+	int32 ReadbackRingDepth = 3;
+
+	/**
+	 * If true, render targets are converted to YUV by a compute shader and
+	 * only the YUV planes are read back. Used when EncodePixelFormat is
+	 * YUV420P and the render target is 8-bit RGB of the output size.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	bool bGPUConversion = false;
+
+	/**
+	 * Maximum number of frames added but not encoded yet. 0 means unlimited.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "0"))
+	int32 MaxFramesInFlight = 0;
+
+	/**
+	 * Maximum bytes of images and frames added but not encoded yet. 0 means
+	 * unlimited. Images are counted in their own pixel format, e.g. 8 bytes
+	 * per pixel for RGBA16F.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "0"))
+	int64 MaxBytesInFlight = 0;
+
+	/**
+	 * What AddFrame does when MaxFramesInFlight or MaxBytesInFlight is reached
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	EFFmpegBackpressurePolicy BackpressurePolicy =
+	    EFFmpegBackpressurePolicy::Block;
+
+	/**
+	 * Maximum number of frames converted at once. Converted frames are still
+	 * encoded in the order they were added. 0 uses the number of task workers.
+	 * Only frames converted from images on the CPU are limited, i.e. frames
+	 * added from image files, image tasks and render targets read back as
+	 * images. Frames converted by bGPUConversion and frame tasks added by the
+	 * caller do no conversion here and are not limited.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "0"))
+	int32 MaxConcurrentConversions = 0;
+
+	/**
+	 * Maximum number of encoded packets waiting to be written to the output.
+	 * Encoding waits when the output falls this far behind.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "1"))
+	int32 MaxQueuedPackets = 256;
+
+	/**
+	 * Bytes of each of the two buffers the output file is written through.
+	 * Larger buffers mean fewer, larger writes.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "65536"))
+	int32 OutputBufferSize = 8 * 1024 * 1024;
+
+	/**
+	 * Expected length of the video in seconds. BitRate times this is
+	 * reserved on disk when the file is created (Linux). 0 reserves nothing.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "0"))
+	float ExpectedDuration = 0.0f;
+
+	/**
+	 * true to write the output file bypassing the page cache (Linux and Mac)
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	bool bDirectIO = false;
+
+	/**
+	 * Preset of the encoder. Faster presets suit realtime capture, slower
+	 * ones offline renders. Encoders other than x264 and x265 use the speed
+	 * closest to it.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	EFFmpegX264Preset Preset = EFFmpegX264Preset::Medium;
+
+	/**
+	 * Tune of x264 and x265. ZeroLatency also disables the lookahead of VP9
+	 * and AV1.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	EFFmpegX264Tune Tune = EFFmpegX264Tune::None;
+
+	/**
+	 * H.264 profile such as "baseline", "main" or "high". Empty uses the
+	 * highest profile the pixel format requires.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	FString Profile;
+
+	/**
+	 * Number of encoder threads. 0 uses the number of cores.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "0"))
+	int32 Threads = 0;
+
+	/**
+	 * How the encoder threads split work
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	EFFmpegThreadType ThreadType = EFFmpegThreadType::Auto;
+
+	/**
+	 * Number of frames the rate control looks ahead. -1 uses the value of
+	 * Preset and Tune.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "-1"))
+	int32 LookaheadDepth = -1;
+
+	/**
+	 * Maximum number of frames between keyframes. -1 uses the value of
+	 * Preset and Tune.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "-1"))
+	int32 GopSize = -1;
+
+	/**
+	 * Maximum number of consecutive B-frames. -1 uses the value of Preset and
+	 * Tune. Ignored by ZeroLatency, which encodes no B-frames.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "-1"))
+	int32 MaxBFrames = -1;
+
+	/**
+	 * Options passed to the codec as is, e.g. "x264-params". They override
+	 * the settings above.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	TMap<FString, FString> CodecOptions;
+
+	/**
+	 * If true, once a recording has finished, a codec of the same settings
+	 * is opened in the background unless FFFmpegEncoderPool already holds
+	 * one, so that the next recording starts without opening the codec.
+	 * Set it to false for one-off recordings.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	bool bPrewarmOnClose = true;
+
+	/**
+	 * Number of encoders GenerateVideoFromImageFiles runs in parallel. The
+	 * images are split into chunks of whole GOPs, which are encoded
+	 * separately and joined by stream copy. 1 encodes with a single encoder.
+	 * 0 runs an encoder per 4 logical cores.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "0"))
+	int32 NumParallelChunks = 1;
+
+	/**
+	 * If true, frames are encoded on the workers of FFFmpegEncodeScheduler
+	 * shared by all encoders instead of a thread of this encoder, so that many
+	 * low frame rate recordings do not each hold idle threads. With Threads 0
+	 * the codec then runs on the worker alone.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	bool bSharedScheduler = false;
+
+	/**
+	 * Priority over other encoders running at once. It sets the priority of
+	 * conversion tasks and of the encode thread, and the shared scheduler runs
+	 * sessions of a higher priority first.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	EFFmpegEncoderPriority Priority = EFFmpegEncoderPriority::Normal;
+
+	/**
+	 * If true, this encoder degrades while an encoder of a higher Priority is
+	 * recording: it drops frames instead of blocking, keeps half the frames in
+	 * flight and opens the codec with a faster preset. If false, the config
+	 * is followed as is.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	bool bDegradeWhenYielding = false;
+
+	/**
+	 * Share of the workers of the shared scheduler relative to other encoders
+	 * of the same Priority. When both have frames ready, an encoder of 2 gets
+	 * twice the encode time of an encoder of 1.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "0.01"))
+	float CPUShare = 1.0f;
 };
@@ -0,0 +1,168 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/Ticker.h"
+#include "FFmpegEncoderConfig.h"
+#include "Tasks/Task.h"
+
+#include <atomic>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+/**
+ * Opened codec context that has not encoded any frame
+ */
+struct BLUEPRINTFFMPEG_API FFFmpegPooledCodecContext {
+	/** opened codec context, or nullptr if none */
+	AVCodecContext* Context = nullptr;
+};
+
+/**
+ * Counters of FFFmpegEncoderPool
+ */
+struct BLUEPRINTFFMPEG_API FFFmpegEncoderPoolStats {
+	/** number of Acquire calls that took an idle context */
+	uint64 Hits = 0;
+
+	/** number of Acquire calls that found no context of the settings */
+	uint64 Misses = 0;
+
+	/** number of contexts currently waiting in the pool */
+	int32 NumIdleContexts = 0;
+};
+
+/**
+ * Pool of opened codec contexts shared by all encoders.
+ * Opening a codec allocates its lookahead and thread pool, which takes long
+ * enough to delay the first frames of a recording. Prewarm opens contexts in
+ * the background before a recording starts, and encoders prewarm one when a
+ * recording finishes, so that the next encoder with the same codec settings
+ * starts without opening the codec. A context is used for one stream only.
+ * The pool keeps the most recently released contexts, and frees contexts
+ * idle for longer than ffmpeg.EncoderPool.IdleTimeout.
+ * Threadsafe.
+ */
+class BLUEPRINTFFMPEG_API FFFmpegEncoderPool {
+	// public functions
+public:
+	/**
+	 * @return   the pool shared by the whole process
+	 */
+	static FFFmpegEncoderPool& Get();
+
+	/**
+	 * Start freeing contexts that have been idle for too long. Called on the
+	 * game thread at startup.
+	 */
+	void Start();
+
+	/**
+	 * Stop freeing idle contexts. Called on the game thread at shutdown.
+	 */
+	void Stop();
+
+	/**
+	 * Open codec contexts for Config in the background and keep them in the
+	 * pool.
+	 * @param Count   number of contexts to open.
+	 */
+	void Prewarm(const FFFmpegEncoderConfig& Config, int32 Count = 1);
+
+	/**
+	 * Prewarm a context for Config unless the pool holds, is opening or has
+	 * deferred one with the same codec settings.
+	 */
+	void PrewarmIfMissing(const FFFmpegEncoderConfig& Config);
+
+	/**
+	 * Hold back Prewarm while bDefer is true, e.g. while the game is over its
+	 * frame time budget. Held requests are run once deferring ends.
+	 */
+	void SetDeferPrewarm(bool bDefer);
+
+	/**
+	 * Forget the Prewarm requests held back by SetDeferPrewarm, e.g. on
+	 * shutdown, so that ending deferring does not run them.
+	 */
+	void ClearDeferredPrewarms();
+
+	/**
+	 * Take a context opened with the codec settings of Config.
+	 * @return   Context is nullptr if the pool has none.
+	 */
+	FFFmpegPooledCodecContext Acquire(const FFFmpegEncoderConfig& Config);
+
+	/**
+	 * Keep Context for following Acquire calls. Context must have been opened
+	 * with the codec settings of Config and not have encoded any frame.
+	 * If the pool is full, the context released least recently is freed.
+	 */
+	void Release(const FFFmpegEncoderConfig& Config,
+	             FFFmpegPooledCodecContext   Context);
+
+	/**
+	 * @return   current counters
+	 */
+	FFFmpegEncoderPoolStats GetStats() const;
+
+	/**
+	 * Forget held Prewarm requests, wait for contexts being prewarmed and free
+	 * all idle contexts.
+	 */
+	void Empty();
+
+	// private types
+private:
+	struct FIdleContext {
+		FFFmpegEncoderConfig      Config;
+		FFFmpegPooledCodecContext Context;
+
+		// FPlatformTime::Seconds when the context was released
+		double ReleaseTime = 0.0;
+	};
+
+	// a context being opened by Prewarm
+	struct FPrewarmTask {
+		FFFmpegEncoderConfig Config;
+		UE::Tasks::FTask     Task;
+	};
+
+	// a Prewarm request held back by SetDeferPrewarm
+	struct FDeferredPrewarm {
+		FFFmpegEncoderConfig Config;
+		int32                Count = 0;
+	};
+
+	// private functions
+private:
+	// called every second on the game thread
+	bool Tick(float DeltaTime);
+
+	// @return   true if the pool holds, is opening or has deferred a context
+	//           of the codec settings of Config. IdleContexts_Mutex must be
+	//           locked.
+	bool HasContextFor(const FFFmpegEncoderConfig& Config) const;
+
+	// private constants
+private:
+	// upper limit of idle contexts, each holds a codec's lookahead buffers
+	static constexpr int32 MaxIdleContexts = 4;
+
+	// private fields: game thread only
+private:
+	FTSTicker::FDelegateHandle TickerHandle;
+
+	// private fields
+private:
+	mutable FCriticalSection IdleContexts_Mutex;
+	TArray<FIdleContext>     IdleContexts;
+	TArray<FPrewarmTask>     PrewarmTasks;
+	TArray<FDeferredPrewarm> DeferredPrewarms;
+	bool                     bDeferPrewarm = false;
+	std::atomic<uint64>      Hits   = 0;
+	std::atomic<uint64>      Misses = 0;
+};
@@ -0,0 +1,100 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include <atomic>
+
+extern "C" {
+#include <libavutil/buffer.h>
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+}
+
+/**
+ * Counters of FFFmpegFramePool
+ */
+struct BLUEPRINTFFMPEG_API FFFmpegFramePoolStats {
+	/** number of buffers allocated by the pool */
+	int32 NumBuffers = 0;
+
+	/** number of buffers currently referenced by frames */
+	int32 NumBuffersInUse = 0;
+
+	/** the largest NumBuffersInUse so far */
+	int32 MaxBuffersInUse = 0;
+
+	/** bytes of a buffer */
+	int64 BufferSize = 0;
+};
+
+/**
+ * Pool of frame buffers of a single format and size, backed by AVBufferPool.
+ * A buffer returns to the pool when the last frame referencing it is freed,
+ * so steady-state encoding allocates nothing once the pool has grown to the
+ * number of frames in flight.
+ * Must be created by MakeShared because buffers keep the pool alive.
+ * Threadsafe.
+ */
+class BLUEPRINTFFMPEG_API FFFmpegFramePool
+    : public TSharedFromThis<FFFmpegFramePool, ESPMode::ThreadSafe> {
+	// public functions
+public:
+	FFFmpegFramePool(AVPixelFormat InFormat, int32 InWidth, int32 InHeight);
+	~FFFmpegFramePool();
+
+	FFFmpegFramePool(const FFFmpegFramePool&)            = delete;
+	FFFmpegFramePool& operator=(const FFFmpegFramePool&) = delete;
+
+	/**
+	 * @return   true if frames of the format and size can be taken from this
+	 *           pool.
+	 */
+	bool Matches(AVPixelFormat InFormat, int32 InWidth,
+	             int32 InHeight) const noexcept;
+
+	/**
+	 * Take a buffer from the pool and set it to Frame, same as
+	 * av_frame_get_buffer. The format, width and height of Frame are also set.
+	 * The content of the buffer is undefined.
+	 * @return   false if failed to allocate a buffer.
+	 */
+	bool GetBuffer(AVFrame& Frame);
+
+	/**
+	 * @return   current counters
+	 */
+	FFFmpegFramePoolStats GetStats() const;
+
+	// private types
+private:
+	// opaque of a buffer taken by GetBuffer
+	struct FBufferHolder;
+
+	// private functions
+private:
+	// called by AVBufferPool when the pool has no free buffer
+	static AVBufferRef* AllocateBuffer(void* Opaque, size_t Size);
+
+	// called when the last frame releases a buffer taken by GetBuffer
+	static void ReleaseBuffer(void* Opaque, uint8_t* Data);
+
+	// private constants
+private:
+	// alignment of rows and planes in bytes
+	static constexpr int32 Alignment = 64;
+
+	// private fields
+private:
+	AVPixelFormat      Format = AV_PIX_FMT_NONE;
+	int32              Width  = 0;
+	int32              Height = 0;
+	int32              LineSizes[4]    = {};
+	int64              PlaneOffsets[4] = {};
+	int64              BufferSize      = 0;
+	AVBufferPool*      Pool            = nullptr;
+	std::atomic<int32> NumBuffers      = 0;
+	std::atomic<int32> NumBuffersInUse = 0;
+	std::atomic<int32> MaxBuffersInUse = 0;
+};
@@ -0,0 +1,47 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "FFmpegFrameSharedPtr.h"
+#include "FFmpegUtils.h"
+#include "Tasks/Task.h"
+
+extern "C" {
+#include <libavutil/pixfmt.h>
+}
+
+/**
+ * Conversion of render targets to YUV 4:2:0 frames by a compute shader.
+ * Only the Y, U and V planes (1.5 bytes per pixel) are read back instead of
+ * the BGRA pixels (4 bytes per pixel), and no conversion is left for the CPU.
+ * The planes are read back through FFFmpegReadbackPoller, so neither the GPU
+ * nor the render thread waits for them.
+ * The shader is meant to match FFFmpegPixelConversion exactly, but this has
+ * not been verified on any GPU. Setting ffmpeg.GPUConversion.Validate
+ * compares every frame against it and logs the mismatches.
+ * Threadsafe.
+ */
+class BLUEPRINTFFMPEG_API FFFmpegGPUConversion {
+	// public functions
+public:
+	/**
+	 * @return   true if TextureRHI can be converted to a frame of PixelFormat
+	 *           and the size.
+	 */
+	static bool IsSupported(const FTextureRHIRef& TextureRHI,
+	                        AVPixelFormat PixelFormat, int32 FrameWidth,
+	                        int32 FrameHeight);
+
+	/**
+	 * Convert TextureRHI to a YUV420P frame. Called on the game thread.
+	 * TextureRHI must satisfy IsSupported.
+	 * @param FrameIndex   pts of the frame.
+	 * @param Options      FramePool is used to allocate the frame buffer.
+	 * @return   task completed with the frame once it is read back, or with
+	 *           nullptr if no frame buffer could be allocated.
+	 */
+	static UE::Tasks::TTask<FFFmpegFrameThreadSafeSharedPtr>
+	    ConvertAsync(FTextureRHIRef TextureRHI, int FrameIndex,
+	                 const FFFmpegConversionOptions& Options);
+};
@@ -0,0 +1,92 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "ImageCore.h"
+
+#include <atomic>
+
+/**
+ * Size and format that identify pooled images.
+ * Images with the same key have the same size of storage.
+ */
+struct BLUEPRINTFFMPEG_API FFFmpegImagePoolKey {
+	int32                 Width  = 0;
+	int32                 Height = 0;
+	ERawImageFormat::Type Format = ERawImageFormat::Invalid;
+
+	bool operator==(const FFFmpegImagePoolKey& Other) const = default;
+
+	friend uint32 GetTypeHash(const FFFmpegImagePoolKey& Key) {
+		uint32 Hash = ::GetTypeHash(Key.Width);
+		Hash        = HashCombine(Hash, ::GetTypeHash(Key.Height));
+		return HashCombine(Hash, ::GetTypeHash(static_cast<int32>(Key.Format)));
+	}
+};
+
+/**
+ * Counters of FFFmpegImagePool
+ */
+struct BLUEPRINTFFMPEG_API FFFmpegImagePoolStats {
+	/** number of Acquire calls that reused an idle image */
+	uint64 Hits = 0;
+
+	/** number of Acquire calls that had to allocate a new image */
+	uint64 Misses = 0;
+
+	/** number of images currently waiting in the pool */
+	int32 NumIdleImages = 0;
+};
+
+/**
+ * Pool of image storage shared by all encoders.
+ * Texture readbacks are written into images taken from this pool, and the
+ * images are returned once they have been converted into frames, so
+ * capturing at a steady rate does not allocate a frame-sized buffer per
+ * frame.
+ * Threadsafe.
+ */
+class BLUEPRINTFFMPEG_API FFFmpegImagePool {
+	// public functions
+public:
+	/**
+	 * @return   the pool shared by the whole process
+	 */
+	static FFFmpegImagePool& Get();
+
+	/**
+	 * Take an image of the size and format. A new image is allocated if there
+	 * is no idle one. The content of the image is undefined.
+	 */
+	FImage Acquire(int32 Width, int32 Height, ERawImageFormat::Type Format,
+	               EGammaSpace GammaSpace);
+
+	/**
+	 * Return Image to the pool so that following Acquire calls can reuse its
+	 * storage. Images that the pool can not keep are freed.
+	 */
+	void Release(FImage&& Image);
+
+	/**
+	 * @return   current counters
+	 */
+	FFFmpegImagePoolStats GetStats() const;
+
+	/**
+	 * Free all idle images.
+	 */
+	void Empty();
+
+	// private constants
+private:
+	// upper limit of idle images kept per key
+	static constexpr int32 MaxIdleImagesPerKey = 8;
+
+	// private fields
+private:
+	mutable FCriticalSection                   IdleImages_Mutex;
+	TMap<FFFmpegImagePoolKey, TArray<FImage>> IdleImages;
+	std::atomic<uint64>                        Hits   = 0;
+	std::atomic<uint64>                        Misses = 0;
+};
@@ -0,0 +1,125 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "FFmpegEncodeThread.h"
+#include "FFmpegEncoderConfig.h"
+
+#include "FFmpegMultiRenditionEncoder.generated.h"
+
+/**
+ * An output of UFFmpegMultiRenditionEncoder
+ */
+USTRUCT(BlueprintType)
+struct BLUEPRINTFFMPEG_API FFFmpegRendition {
+	GENERATED_BODY()
+
+	/**
+	 * Settings of this output, including its size and codec
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	FFFmpegEncoderConfig Config;
+
+	/**
+	 * Output destination file path. The output format is determined by the
+	 * extension of this path.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	FString OutputFilePath;
+};
+
+/**
+ * A video encoder that encodes the same frames into several renditions, e.g.
+ * 2160p, 1080p and 540p, each with its own settings.
+ * Each frame is read back and converted once, at the size of the largest
+ * rendition. Smaller renditions are scaled from the closest larger one, and
+ * renditions of the same size and pixel format share the buffers of one
+ * frame, so readback and conversion do not multiply with the number of
+ * outputs.
+ * How to use:
+ *   1. Create instance of this class
+ *   2. call Open function with the renditions
+ *   3. call AddFrame function for each frames you want to encode
+ *   4. call Close function
+ * then the videos are output to the OutputFilePath of each rendition.
+ */
+UCLASS(Blueprintable, BlueprintType)
+class BLUEPRINTFFMPEG_API UFFmpegMultiRenditionEncoder: public UObject {
+	GENERATED_BODY()
+
+	// type aliases
+public:
+	using TTask_Frame = FFFmpegEncodeThread::TTask_Frame;
+	using TTask_Image = FFFmpegEncodeThread::TTask_Image;
+
+	// blueprint functions
+public:
+	/**
+	 * Initialize an encoder per rendition and put them into encoding standby
+	 * status. If any rendition fails to open, the renditions opened before it
+	 * are closed and their output files removed.
+	 * @param Renditions   outputs. Must not be empty.
+	 * @param[out] Result   result.
+	 */
+	UFUNCTION(BlueprintCallable, meta = (ExpandEnumAsExecs = "Result"))
+	void Open(const TArray<FFFmpegRendition>& Renditions,
+	          FFmpegEncoderOpenResult& Result, FString& ErrorMessage);
+
+	/**
+	 * Terminate encoding of every rendition.
+	 */
+	UFUNCTION(BlueprintCallable)
+	void Close();
+
+	/**
+	 * Add a frame to every rendition.
+	 * @param[out] Result   the worst result among the renditions.
+	 */
+	UFUNCTION(BlueprintCallable, meta = (ExpandEnumAsExecs = "Result"))
+	void AddFrameFromRenderTarget(
+	    const UTextureRenderTarget2D* TextureRenderTarget,
+	    FFmpegEncoderAddFrameResult& Result, FString& ErrorMessage);
+
+	/**
+	 * Add a frame to every rendition.
+	 * @param[out] Result   the worst result among the renditions.
+	 */
+	UFUNCTION(BlueprintCallable, meta = (ExpandEnumAsExecs = "Result"))
+	void AddFrameFromImagePath(const FString&               ImagePath,
+	                           FFmpegEncoderAddFrameResult& Result,
+	                           FString&                     ErrorMessage);
+
+	// C++ functions
+public:
+	/**
+	 * Add a frame to every rendition.
+	 * @param[out] Result   the worst result among the renditions.
+	 */
+	void AddFrame(const TTask_Image&           ImageTask,
+	              FFmpegEncoderAddFrameResult& Result, FString& ErrorMessage);
+
+	// private types
+private:
+	// a rendition and where its frames come from
+	struct FRenditionNode {
+		TUniquePtr<FFFmpegEncodeThread> Encoder;
+		FFFmpegConversionOptions        ConversionOptions;
+		int32                           Width       = 0;
+		int32                           Height      = 0;
+		AVPixelFormat                   FrameFormat = AV_PIX_FMT_NONE;
+
+		// node the frames are scaled from, or INDEX_NONE if they are
+		// converted from the image
+		int32 Parent = INDEX_NONE;
+	};
+
+	// private fields
+private:
+	// sorted from the largest rendition, so that parents come first
+	TArray<FRenditionNode> Nodes;
+	EFFmpegEncoderPriority Priority   = EFFmpegEncoderPriority::Normal;
+	int64                  FrameIndex = 0;
+	bool                   bOpened    = false;
+	bool                   bClosed    = false;
+};
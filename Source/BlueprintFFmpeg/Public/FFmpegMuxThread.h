@@ -0,0 +1,149 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/Runnable.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+extern "C" {
+#include <libavcodec/packet.h>
+#include <libavformat/avformat.h>
+}
+
+/**
+ * Busy time of a pipeline stage, used to tell whether a capture is bound by
+ * the CPU (encode stage) or by IO (mux stage).
+ * Threadsafe.
+ */
+class BLUEPRINTFFMPEG_API FFFmpegStageTimer {
+	// public functions
+public:
+	/**
+	 * Mark the stage as started and clear the cycles of the previous run.
+	 * Called by the thread of the stage.
+	 */
+	void Begin() noexcept;
+
+	/**
+	 * Mark the stage as finished. Called by the thread of the stage.
+	 */
+	void End() noexcept;
+
+	/**
+	 * Add time the stage spent working.
+	 * @param Cycles   cycles of FPlatformTime::Cycles64.
+	 */
+	void AddBusyCycles(uint64 Cycles) noexcept;
+
+	/**
+	 * @return   fraction of time the stage spent working since Begin, in
+	 *           [0, 1]. 0 if the stage has not begun.
+	 */
+	double GetUtilization() const noexcept;
+
+	// private fields
+private:
+	std::atomic<uint64> BeginCycles = 0;
+	std::atomic<uint64> EndCycles   = 0;
+	std::atomic<uint64> BusyCycles  = 0;
+};
+
+/**
+ * Counters of the encode pipeline
+ */
+struct BLUEPRINTFFMPEG_API FFFmpegPipelineStats {
+	/** fraction of time the encode thread spent encoding */
+	double EncodeUtilization = 0.0;
+
+	/** fraction of time the mux thread spent writing packets */
+	double MuxUtilization = 0.0;
+
+	/** the largest number of packets waiting for the mux thread so far */
+	int32 MaxQueuedPackets = 0;
+};
+
+/**
+ * Thread that writes encoded packets to the output, so that a slow disk does
+ * not stall encoding. Packets are passed through a bounded queue: Push blocks
+ * while the queue is full.
+ * How to use:
+ *   1. Create instance of this class after the header is written
+ *   2. call Push function for each packet
+ *   3. call Finish function, then write the trailer
+ * Encoders on a shared worker call StartInline instead of Start, then Push
+ * writes the packet on the calling thread.
+ */
+class BLUEPRINTFFMPEG_API FFFmpegMuxThread: public FRunnable {
+	// public functions
+public:
+	/**
+	 * @param InFormatContext     output to write packets to. Must outlive this.
+	 * @param InMaxQueuedPackets  capacity of the queue.
+	 * @param InStageTimer        receives busy time of writing packets.
+	 */
+	FFFmpegMuxThread(AVFormatContext* InFormatContext, int32 InMaxQueuedPackets,
+	                 FFFmpegStageTimer& InStageTimer);
+	~FFFmpegMuxThread();
+
+	FFFmpegMuxThread(const FFFmpegMuxThread&)            = delete;
+	FFFmpegMuxThread& operator=(const FFFmpegMuxThread&) = delete;
+
+	/**
+	 * Start the thread.
+	 * @return   false if failed to create the thread.
+	 */
+	bool Start();
+
+	/**
+	 * Write packets on the thread calling Push instead of a thread of its own.
+	 * Called instead of Start.
+	 */
+	void StartInline();
+
+	/**
+	 * Hand a packet to the thread. The reference of Packet is moved, so Packet
+	 * is unreferenced on return.
+	 * @return   false if writing a packet has failed.
+	 */
+	bool Push(AVPacket& Packet);
+
+	/**
+	 * Wait until all pushed packets are written and stop the thread.
+	 * @return   false if writing a packet has failed.
+	 */
+	bool Finish();
+
+	/**
+	 * @return   the largest number of queued packets so far
+	 */
+	int32 GetMaxQueuedPackets() const noexcept;
+
+	// FRunnable interfaces
+public:
+	virtual uint32 Run() override;
+	virtual void   Stop() override;
+
+	// private fields: no data race
+private:
+	AVFormatContext*   FormatContext    = nullptr;
+	int32              MaxQueuedPackets = 0;
+	FFFmpegStageTimer& StageTimer;
+	FRunnableThread*   Thread           = nullptr;
+	bool               bInline          = false;
+
+	// private fields: guarded by Packets_mutex
+private:
+	TArray<AVPacket*>       Packets;
+	bool                    bFinishing = false;
+	std::mutex              Packets_mutex;
+	std::condition_variable Packets_cv;
+
+	// private fields: beware of data race
+private:
+	std::atomic_bool   bFailed           = false;
+	std::atomic<int32> PeakQueuedPackets = 0;
+};
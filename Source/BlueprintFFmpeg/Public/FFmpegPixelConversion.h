@@ -0,0 +1,103 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "FFmpegEncoderConfig.h"
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+}
+
+/**
+ * Instruction set used by the conversion kernels of FFFmpegPixelConversion
+ */
+enum class EFFmpegPixelConversionISA : uint8 { Scalar, SSE41, AVX2 };
+
+/**
+ * Options of converting float images
+ */
+struct BLUEPRINTFFMPEG_API FFFmpegFloatConversionOptions {
+	/** tone mapping applied to linear values */
+	EFFmpegToneMapping ToneMapping = EFFmpegToneMapping::None;
+
+	/** true if values are linear and need to be encoded with the sRGB curve */
+	bool bLinear = true;
+
+	/** true to quantize with 4x4 ordered dithering */
+	bool bDither = false;
+};
+
+/**
+ * Dedicated packed RGB -> YUV 4:2:0 conversion kernels.
+ * They cover the formats most frames arrive in and are much faster than the
+ * generic path of swscale. The kernel is selected at runtime by CPUID.
+ *
+ * Supported source formats:
+ *   AV_PIX_FMT_BGRA, AV_PIX_FMT_RGBA, AV_PIX_FMT_BGR0, AV_PIX_FMT_RGB0,
+ *   AV_PIX_FMT_GRAY8, AV_PIX_FMT_RGBA64LE
+ * Supported destination formats:
+ *   AV_PIX_FMT_YUV420P, AV_PIX_FMT_NV12
+ *
+ * Float sources, AV_PIX_FMT_RGBAF16LE and AV_PIX_FMT_RGBAF32LE, are tone
+ * mapped and encoded with the sRGB curve as specified by
+ * FFFmpegFloatConversionOptions. They can also be converted to
+ * AV_PIX_FMT_YUV420P10LE.
+ *
+ * The output is BT.601 limited range, same as swscale's default. Every
+ * instruction set runs the same integer arithmetic as the scalar kernel.
+ * The output is not guaranteed to match swscale: chroma is the average of
+ * each 2x2 block, while swscale filters it with the scale filter, and luma
+ * is rounded differently. No test compares them, so the kernels are used
+ * only if ffmpeg.PixelConversion.Enable is set; setting
+ * ffmpeg.PixelConversion.Validate then logs how much a frame differs.
+ * Threadsafe.
+ */
+class BLUEPRINTFFMPEG_API FFFmpegPixelConversion {
+	// public functions
+public:
+	/**
+	 * @return   true if Convert supports the pair of formats.
+	 */
+	static bool IsSupported(AVPixelFormat SrcFormat,
+	                        AVPixelFormat DstFormat) noexcept;
+
+	/**
+	 * @return   true if Format is a float format supported as a source.
+	 */
+	static bool IsFloatFormat(AVPixelFormat Format) noexcept;
+
+	/**
+	 * Convert a packed image into Frame without scaling.
+	 * @param SrcData       pointer to the first pixel of the source image.
+	 * @param SrcLineSize   bytes per row of the source image.
+	 * @param SrcFormat     format of the source image.
+	 * @param Frame         destination frame. Its format, size and buffer must
+	 *                      be initialized, and its size must be equal to the
+	 *                      source image.
+	 * @param FloatOptions  options used if the source image is float.
+	 * @return   false if the pair of formats is not supported.
+	 */
+	static bool Convert(const uint8* SrcData, int64 SrcLineSize,
+	                    AVPixelFormat SrcFormat, AVFrame& Frame,
+	                    const FFFmpegFloatConversionOptions& FloatOptions = {});
+
+	/**
+	 * Convert rows [RowBegin, RowEnd) of a packed image into Frame without
+	 * scaling. Disjoint row ranges can be converted in parallel.
+	 * @param RowBegin   first row. Must be even.
+	 * @param RowEnd     row after the last row. Must be even or the height.
+	 * @see Convert
+	 */
+	static bool
+	    ConvertRows(const uint8* SrcData, int64 SrcLineSize,
+	                AVPixelFormat SrcFormat, AVFrame& Frame, int32 RowBegin,
+	                int32 RowEnd,
+	                const FFFmpegFloatConversionOptions& FloatOptions = {});
+
+	/**
+	 * @return   instruction set selected for this CPU.
+	 */
+	static EFFmpegPixelConversionISA GetActiveISA() noexcept;
+};
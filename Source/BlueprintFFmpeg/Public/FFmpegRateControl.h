@@ -0,0 +1,92 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "FFmpegEncoderConfig.h"
+
+#include <mutex>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/dict.h>
+}
+
+/**
+ * Counters of the rate control, updated for every encoded frame
+ */
+struct BLUEPRINTFFMPEG_API FFFmpegRateControlStats {
+	/** true if the output is constrained by a VBV buffer */
+	bool bVBV = false;
+
+	/** fullness of the VBV buffer in [0, 1] after the last frame */
+	double BufferFill = 0.0;
+
+	/** the lowest BufferFill so far */
+	double MinBufferFill = 0.0;
+
+	/** number of frames larger than the buffer held */
+	int32 NumUnderflows = 0;
+
+	/** number of encoded frames */
+	int64 NumFrames = 0;
+
+	/** bytes of encoded frames */
+	int64 TotalBytes = 0;
+
+	/** bits per second of encoded frames so far */
+	double AverageBitRate = 0.0;
+};
+
+/**
+ * Rate control of the encoder.
+ * Configure sets the rate control mode of the config to a codec context.
+ * The VBV model follows the buffer of a decoder reading the output at the
+ * maximum rate: each frame removes its bits from the buffer, and the buffer
+ * refills between frames. A buffer that runs empty means the output exceeded
+ * the bandwidth it was constrained to.
+ * Threadsafe.
+ */
+class BLUEPRINTFFMPEG_API FFFmpegRateControl {
+	// public functions
+public:
+	/**
+	 * Set the rate control mode of Config to Context and Options in the form
+	 * Codec takes it. Must be called before avcodec_open2.
+	 */
+	static void Configure(const FFFmpegEncoderConfig& Config,
+	                      const AVCodec& Codec, AVCodecContext& Context,
+	                      AVDictionary*& Options);
+
+	/**
+	 * Start modeling the VBV buffer of Context. Counters are cleared.
+	 */
+	void Reset(const AVCodecContext& Context);
+
+	/**
+	 * Account an encoded frame.
+	 * @param Bytes   size of the packet of the frame.
+	 * @return   fullness of the VBV buffer after the frame, in [0, 1]. 0 if
+	 *           the output is not constrained by a VBV buffer.
+	 */
+	double AddFrame(int64 Bytes);
+
+	/**
+	 * @return   current counters
+	 */
+	FFFmpegRateControlStats GetStats() const;
+
+	// private constants
+private:
+	// fullness when the first frame arrives, same as x264's vbv-init
+	static constexpr double InitialBufferFill = 0.9;
+
+	// private fields
+private:
+	double                  BufferSize    = 0.0;
+	double                  BitsPerFrame  = 0.0;
+	double                  FrameDuration = 0.0;
+	double                  Fullness      = 0.0;
+	FFFmpegRateControlStats Stats;
+	mutable std::mutex      Stats_mutex;
+};
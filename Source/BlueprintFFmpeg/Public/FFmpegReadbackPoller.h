@@ -0,0 +1,92 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/Ticker.h"
+#include "RHIGPUReadback.h"
+
+#include <atomic>
+
+/**
+ * Completes GPU readbacks without waiting for the GPU.
+ * A capture adds its readbacks on the render thread right after enqueuing
+ * the copies. Every engine tick while readbacks are pending, a render command
+ * polls them, and the callback of a capture runs on the render thread once
+ * all of its readbacks are ready. So neither the GPU, the render thread nor a
+ * task worker waits for a copy.
+ * Flush polls without waiting for a tick, for callers that block the game
+ * thread while captures are pending.
+ * Threadsafe.
+ */
+class BLUEPRINTFFMPEG_API FFFmpegReadbackPoller {
+	// public functions
+public:
+	/**
+	 * @return   the poller shared by the whole process
+	 */
+	static FFFmpegReadbackPoller& Get();
+
+	/**
+	 * Start polling every engine tick. Called on the game thread at startup.
+	 */
+	void Start();
+
+	/**
+	 * Stop polling every tick and poll the readbacks left once. Called on the
+	 * game thread at shutdown.
+	 */
+	void Stop();
+
+	/**
+	 * Call OnReady once all Readbacks are ready. Called on the render thread
+	 * after their copies have been enqueued.
+	 * @param Readbacks   readbacks of a capture. They must be kept alive by
+	 *                    OnReady.
+	 * @param OnReady     called on the render thread, where the readbacks can
+	 *                    be locked.
+	 */
+	void Add(TArrayView<FRHIGPUReadback* const> Readbacks,
+	         TUniqueFunction<void()>            OnReady);
+
+	/**
+	 * Submit the copies of the readbacks added so far to the GPU and poll them
+	 * once, without waiting for a copy. Enqueues a render command, so it
+	 * returns before they complete. Call it repeatedly while blocking the game
+	 * thread, as no tick polls them then.
+	 */
+	void Flush();
+
+	// private types
+private:
+	// readbacks of a capture and its callback
+	struct FPending {
+		TArray<FRHIGPUReadback*, TInlineAllocator<4>> Readbacks;
+		TUniqueFunction<void()>                       OnReady;
+	};
+
+	// private functions
+private:
+	// called every engine tick on the game thread
+	bool Tick(float DeltaTime);
+
+	// enqueue a poll unless one is already queued
+	// @param bSubmit   true to submit pending commands to the GPU first.
+	void QueuePoll(bool bSubmit);
+
+	// complete the captures whose readbacks are ready. render thread only.
+	void Poll();
+
+	// private fields: game thread only
+private:
+	FTSTicker::FDelegateHandle TickerHandle;
+
+	// private fields: render thread only
+private:
+	TArray<FPending> Pending;
+
+	// private fields: beware of data race
+private:
+	std::atomic<int32> NumPending  = 0;
+	std::atomic_bool   bPollQueued = false;
+};
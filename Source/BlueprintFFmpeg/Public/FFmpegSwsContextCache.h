@@ -0,0 +1,133 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include <atomic>
+
+extern "C" {
+#include <libswscale/swscale.h>
+}
+
+/**
+ * Parameters that identify a SwsContext.
+ * Two conversions with the same key can share the same SwsContext.
+ */
+struct BLUEPRINTFFMPEG_API FFFmpegSwsContextKey {
+	AVPixelFormat SrcFormat = AV_PIX_FMT_NONE;
+	int32         SrcWidth  = 0;
+	int32         SrcHeight = 0;
+	AVPixelFormat DstFormat = AV_PIX_FMT_NONE;
+	int32         DstWidth  = 0;
+	int32         DstHeight = 0;
+	int32         Flags     = 0;
+
+	bool operator==(const FFFmpegSwsContextKey& Other) const = default;
+
+	friend uint32 GetTypeHash(const FFFmpegSwsContextKey& Key) {
+		uint32 Hash = ::GetTypeHash(static_cast<int32>(Key.SrcFormat));
+		Hash        = HashCombine(Hash, ::GetTypeHash(Key.SrcWidth));
+		Hash        = HashCombine(Hash, ::GetTypeHash(Key.SrcHeight));
+		Hash = HashCombine(Hash, ::GetTypeHash(static_cast<int32>(Key.DstFormat)));
+		Hash = HashCombine(Hash, ::GetTypeHash(Key.DstWidth));
+		Hash = HashCombine(Hash, ::GetTypeHash(Key.DstHeight));
+		return HashCombine(Hash, ::GetTypeHash(Key.Flags));
+	}
+};
+
+/**
+ * Counters of FFFmpegSwsContextCache
+ */
+struct BLUEPRINTFFMPEG_API FFFmpegSwsContextCacheStats {
+	/** number of Acquire calls that reused an idle context */
+	uint64 Hits = 0;
+
+	/** number of Acquire calls that had to create a new context */
+	uint64 Misses = 0;
+
+	/** number of contexts currently waiting in the cache */
+	int32 NumIdleContexts = 0;
+};
+
+/**
+ * Pool of SwsContext shared by all encoders.
+ * A SwsContext is not thread-safe, so each Acquire lends a context to the
+ * caller exclusively and it returns to the pool when the handle is destroyed.
+ * Thus any number of conversion tasks can run at the same time, and the number
+ * of contexts per key converges to the number of concurrent conversions.
+ * Threadsafe.
+ */
+class BLUEPRINTFFMPEG_API FFFmpegSwsContextCache {
+	// public types
+public:
+	/**
+	 * Handle of a lent SwsContext.
+	 * The context returns to the cache on destruction.
+	 */
+	class BLUEPRINTFFMPEG_API FScopedContext {
+	public:
+		FScopedContext() = default;
+		FScopedContext(FFFmpegSwsContextCache& InCache,
+		               const FFFmpegSwsContextKey& InKey, SwsContext* InContext);
+		FScopedContext(FScopedContext&& Other) noexcept;
+		FScopedContext& operator=(FScopedContext&& Other) noexcept;
+		FScopedContext(const FScopedContext&)            = delete;
+		FScopedContext& operator=(const FScopedContext&) = delete;
+		~FScopedContext();
+
+		SwsContext*      Get() const { return Context; }
+		explicit operator bool() const { return nullptr != Context; }
+
+	private:
+		void Reset();
+
+	private:
+		FFFmpegSwsContextCache* Cache   = nullptr;
+		FFFmpegSwsContextKey    Key;
+		SwsContext*             Context = nullptr;
+	};
+
+	// public functions
+public:
+	/**
+	 * @return   the cache shared by the whole process
+	 */
+	static FFFmpegSwsContextCache& Get();
+
+	/**
+	 * Lend a SwsContext that matches Key. A new context is created if there is
+	 * no idle one.
+	 * @return   handle of the context. It is empty if failed to create context.
+	 */
+	FScopedContext Acquire(const FFFmpegSwsContextKey& Key);
+
+	/**
+	 * @return   current counters
+	 */
+	FFFmpegSwsContextCacheStats GetStats() const;
+
+	/**
+	 * Free all idle contexts. Lent contexts are freed when they are returned.
+	 */
+	void Empty();
+
+public:
+	~FFFmpegSwsContextCache();
+
+	// private functions
+private:
+	void Release(const FFFmpegSwsContextKey& Key, SwsContext* Context);
+
+	// private constants
+private:
+	// upper limit of idle contexts kept per key
+	static constexpr int32 MaxIdleContextsPerKey = 32;
+
+	// private fields
+private:
+	mutable FCriticalSection                      IdleContexts_Mutex;
+	TMap<FFFmpegSwsContextKey, TArray<SwsContext*>> IdleContexts;
+	std::atomic<uint64>                           Hits   = 0;
+	std::atomic<uint64>                           Misses = 0;
+};
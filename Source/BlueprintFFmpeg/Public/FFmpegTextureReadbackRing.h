@@ -0,0 +1,64 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "RHIGPUReadback.h"
+#include "Tasks/Task.h"
+
+/**
+ * Ring of GPU readbacks that captures textures without stalling.
+ * Each Enqueue only copies the texture into the staging buffer of a free
+ * slot, and FFFmpegReadbackPoller maps it once the copy has completed. So
+ * neither the GPU pipeline, the render thread nor a task worker waits for the
+ * readback. While every slot is in flight, a capture gets a staging buffer of
+ * its own instead of waiting for a slot.
+ * A larger Depth reuses staging buffers for more captures in flight.
+ * Slots are only touched on the render thread.
+ * Must be created by MakeShared because render commands keep the ring alive.
+ * Threadsafe.
+ */
+class BLUEPRINTFFMPEG_API FFFmpegTextureReadbackRing
+    : public TSharedFromThis<FFFmpegTextureReadbackRing, ESPMode::ThreadSafe> {
+	// public functions
+public:
+	/**
+	 * @param InDepth   number of staging buffers reused by captures.
+	 */
+	explicit FFFmpegTextureReadbackRing(int32 InDepth);
+
+	FFFmpegTextureReadbackRing(const FFFmpegTextureReadbackRing&) = delete;
+	FFFmpegTextureReadbackRing&
+	    operator=(const FFFmpegTextureReadbackRing&) = delete;
+
+	/**
+	 * @return   true if textures of PixelFormat can be captured by this ring.
+	 */
+	static bool IsSupported(EPixelFormat PixelFormat) noexcept;
+
+	/**
+	 * Enqueue a copy of TextureRHI. Called on the game thread.
+	 * The format of TextureRHI must satisfy IsSupported.
+	 * @return   task completed with the image once the copy is mapped.
+	 */
+	UE::Tasks::TTask<FImage> Enqueue(FTextureRHIRef TextureRHI);
+
+	// private types
+private:
+	// a readback and the capture waiting for it
+	struct FSlot {
+		TUniquePtr<FRHIGPUTextureReadback>      Readback;
+		TSharedPtr<FImage, ESPMode::ThreadSafe> Image;
+		UE::Tasks::FTaskEvent                   Mapped{UE_SOURCE_LOCATION};
+		bool                                    bInFlight = false;
+	};
+
+	// private functions
+private:
+	// map the readback of Slot and complete its capture. render thread only.
+	void Resolve(FSlot& Slot);
+
+	// private fields: render thread only
+private:
+	TArray<FSlot> Slots;
+};
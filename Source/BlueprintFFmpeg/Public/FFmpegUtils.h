@@ -3,9 +3,12 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include "FFmpegEncoderConfig.h"
+#include "FFmpegFramePool.h"
 #include "FFmpegFrameSharedPtr.h"
 #include "ImageCore.h"
 #include "ImageUtils.h"
+#include "Tasks/Task.h"
 
 #include <optional>
 
@@ -16,6 +19,59 @@ extern "C" {
 
 #include "FFmpegUtils.generated.h"
 
+/**
+ * Options of UFFmpegUtils::CreateFrame
+ */
+struct BLUEPRINTFFMPEG_API FFFmpegConversionOptions {
+	/**
+	 * Rows per band converted in parallel. 0 converts the whole frame at once.
+	 */
+	int32 BandHeight = 0;
+
+	/**
+	 * Maximum number of bands a frame is split into.
+	 */
+	int32 MaxBands = 1;
+
+	/**
+	 * Filter used when the image size differs from the frame size.
+	 */
+	EFFmpegScaleFilter ScaleFilter = EFFmpegScaleFilter::Bilinear;
+
+	/**
+	 * How the image is fitted when its aspect ratio differs from the frame.
+	 */
+	EFFmpegScaleFitMode ScaleFitMode = EFFmpegScaleFitMode::Stretch;
+
+	/**
+	 * Tone mapping applied to float images.
+	 */
+	EFFmpegToneMapping ToneMapping = EFFmpegToneMapping::None;
+
+	/**
+	 * If true, float images are quantized with ordered dithering.
+	 */
+	bool bDither = false;
+
+	/**
+	 * Pool that frame buffers are taken from. Buffers are allocated per frame
+	 * if null or if the pool does not match the frame.
+	 */
+	TSharedPtr<FFFmpegFramePool, ESPMode::ThreadSafe> FramePool;
+
+	/**
+	 * Priority of conversion tasks.
+	 */
+	LowLevelTasks::ETaskPriority TaskPriority =
+	    LowLevelTasks::ETaskPriority::BackgroundNormal;
+
+	/**
+	 * @return   options specified by Config
+	 */
+	static FFFmpegConversionOptions
+	    FromConfig(const FFFmpegEncoderConfig& Config);
+};
+
 /**
  *
  */
@@ -24,26 +80,160 @@ class BLUEPRINTFFMPEG_API UFFmpegUtils: public UBlueprintFunctionLibrary {
 	GENERATED_BODY()
 
 public:
+	/**
+	 * Encode images into a video. If NumParallelChunks of the config is not
+	 * 1, the images are split into chunks of whole GOPs, encoded in parallel
+	 * and joined.
+	 */
 	UFUNCTION(BlueprintCallable)
 	static void GenerateVideoFromImageFiles(
 	    const FString& OutputFilePath, const TArray<FString>& InputImagePaths,
 	    const FFFmpegEncoderConfig& FFmpegEncoderConfig);
 
+	/**
+	 * Join videos encoded with the same settings into one file by stream
+	 * copy, without encoding again. Only the video stream is copied.
+	 * @param InputFilePaths   videos in the order they are joined. Each must
+	 *                         start with a keyframe.
+	 * @return   true if succeeded to join.
+	 */
+	UFUNCTION(BlueprintCallable)
+	static bool ConcatVideoFiles(const TArray<FString>& InputFilePaths,
+	                             const FString&         OutputFilePath);
+
+	/**
+	 * Open encoders for FFmpegEncoderConfig in the background and keep them in
+	 * FFFmpegEncoderPool, so that a recording with the same codec settings
+	 * starts without opening the codec.
+	 * @param Count   number of encoders to open.
+	 */
+	UFUNCTION(BlueprintCallable)
+	static void PrewarmEncoders(const FFFmpegEncoderConfig& FFmpegEncoderConfig,
+	                            int32                       Count = 1);
+
 public:
 	static constexpr AVPixelFormat
 	    FFmpegFrameFormatOf(ERawImageFormat::Type UEImageFormat) noexcept;
 
+	static constexpr AVPixelFormat
+	    FFmpegFrameFormatOf(EFFmpegEncodePixelFormat EncodePixelFormat) noexcept;
+
+	/**
+	 * @return   name of Preset as libx264 takes it
+	 */
+	static constexpr const char*
+	    X264PresetNameOf(EFFmpegX264Preset Preset) noexcept;
+
+	/**
+	 * @return   name of Tune as libx264 takes it. nullptr if Tune is None.
+	 */
+	static constexpr const char* X264TuneNameOf(EFFmpegX264Tune Tune) noexcept;
+
+	/**
+	 * @return   priority of tasks working for an encoder of Priority
+	 */
+	static constexpr LowLevelTasks::ETaskPriority
+	    TaskPriorityOf(EFFmpegEncoderPriority Priority) noexcept;
+
+	/**
+	 * @return   priority of a thread working for an encoder of Priority
+	 */
+	static constexpr EThreadPriority
+	    ThreadPriorityOf(EFFmpegEncoderPriority Priority) noexcept;
+
 	template <ESPMode InMode = ESPMode::ThreadSafe>
 	static TFFmpegFrameSharedPtr<InMode> CreateFrame(
 	    const FString& ImagePath, int FrameIndex,
 	    std::optional<int> FrameWidth = {}, std::optional<int> FrameHeight = {},
-	    AVPixelFormat PixelFormat = AVPixelFormat::AV_PIX_FMT_YUV420P);
+	    AVPixelFormat PixelFormat = AVPixelFormat::AV_PIX_FMT_YUV420P,
+	    const FFFmpegConversionOptions& Options = {});
 
 	template <ESPMode InMode = ESPMode::ThreadSafe>
 	static TFFmpegFrameSharedPtr<InMode> CreateFrame(
 	    const FImage& Image, int FrameIndex, std::optional<int> FrameWidth = {},
 	    std::optional<int> FrameHeight = {},
-	    AVPixelFormat      PixelFormat = AVPixelFormat::AV_PIX_FMT_YUV420P);
+	    AVPixelFormat PixelFormat = AVPixelFormat::AV_PIX_FMT_YUV420P,
+	    const FFFmpegConversionOptions& Options = {});
+
+	/**
+	 * Same as CreateFrame above, but if no conversion is needed, the frame
+	 * takes Image and references its pixels instead of copying them.
+	 */
+	template <ESPMode InMode = ESPMode::ThreadSafe>
+	static TFFmpegFrameSharedPtr<InMode> CreateFrame(
+	    FImage&& Image, int FrameIndex, std::optional<int> FrameWidth = {},
+	    std::optional<int> FrameHeight = {},
+	    AVPixelFormat PixelFormat = AVPixelFormat::AV_PIX_FMT_YUV420P,
+	    const FFFmpegConversionOptions& Options = {});
+
+	/**
+	 * Create a frame from the result of ImageTask. If no conversion is needed,
+	 * the frame keeps ImageTask and references the pixels of its result
+	 * instead of copying them.
+	 */
+	template <ESPMode InMode = ESPMode::ThreadSafe>
+	static TFFmpegFrameSharedPtr<InMode> CreateFrame(
+	    UE::Tasks::TTask<FImage> ImageTask, int FrameIndex,
+	    std::optional<int> FrameWidth = {}, std::optional<int> FrameHeight = {},
+	    AVPixelFormat PixelFormat = AVPixelFormat::AV_PIX_FMT_YUV420P,
+	    const FFFmpegConversionOptions& Options = {});
+
+	/**
+	 * @return   true if a frame of PixelFormat and the size can reference the
+	 *           pixels of Image as they are.
+	 */
+	static bool CanWrapImage(const FImage& Image, int FrameWidth,
+	                         int FrameHeight, AVPixelFormat PixelFormat) noexcept;
+
+	/**
+	 * Create a frame that references the pixels of Image without copying.
+	 * @param Image   source image. It must satisfy CanWrapImage.
+	 * @param Owner   object that keeps Image alive, such as Image itself or the
+	 *                task that holds it. It is moved into the frame buffer and
+	 *                destroyed when the buffer is released.
+	 */
+	template <ESPMode InMode = ESPMode::ThreadSafe, typename TOwner>
+	static TFFmpegFrameSharedPtr<InMode> WrapImage(const FImage& Image,
+	                                               TOwner&&      Owner,
+	                                               int           FrameIndex,
+	                                               AVPixelFormat PixelFormat);
+
+	/**
+	 * Convert pixels of Image into the buffer of Frame. Scaling to the frame
+	 * size is done in the same pass as the format conversion.
+	 * The SwsContext used for the conversion is taken from
+	 * FFFmpegSwsContextCache, so calling this every frame does not rebuild the
+	 * scaler tables.
+	 * @param Image   source image.
+	 * @param Frame   destination frame. Its format, size and buffer must be
+	 *                initialized.
+	 * @param Options   options of conversion.
+	 * @return   true if succeeded to convert.
+	 */
+	static bool ConvertImageToFrame(const FImage& Image, AVFrame& Frame,
+	                                const FFFmpegConversionOptions& Options = {});
+
+	/**
+	 * Create a frame of another size or format from Frame. Buffers of Frame
+	 * are shared instead of copied if no conversion is needed.
+	 * @param Frame   source frame. Its pts is kept.
+	 * @param Options   options of conversion.
+	 */
+	template <ESPMode InMode = ESPMode::ThreadSafe>
+	static TFFmpegFrameSharedPtr<InMode>
+	    ScaleFrame(const AVFrame& Frame, int FrameWidth, int FrameHeight,
+	               AVPixelFormat                   PixelFormat,
+	               const FFFmpegConversionOptions& Options = {});
+
+	/**
+	 * Convert pixels of Src into the buffer of Dst, scaling to the size of Dst
+	 * in the same pass.
+	 * @param Dst   destination frame. Its format, size and buffer must be
+	 *              initialized.
+	 * @return   true if succeeded to convert.
+	 */
+	static bool ConvertFrameToFrame(const AVFrame& Src, AVFrame& Dst,
+	                                const FFFmpegConversionOptions& Options = {});
 };
 
 #pragma region          definition of inline functions
@@ -61,11 +251,9 @@ constexpr AVPixelFormat UFFmpegUtils::FFmpegFrameFormatOf(
 	case UEFormat::RGBA16:
 		return AV_PIX_FMT_RGBA64; // 16-bit RGBA
 	case UEFormat::RGBA16F:
-		return AV_PIX_FMT_RGBA64; // No direct 16F in FFmpeg, using 64-bit RGBA as
-		                          // closest
+		return AV_PIX_FMT_RGBAF16; // 16-bit float RGBA
 	case UEFormat::RGBA32F:
-		return AV_PIX_FMT_RGBA; // No direct 32F, using 8-bit RGBA as an
-		                        // approximation
+		return AV_PIX_FMT_RGBAF32; // 32-bit float RGBA
 	case UEFormat::G16:
 		return AV_PIX_FMT_GRAY16; // 16-bit grayscale
 	case UEFormat::R16F:
@@ -83,24 +271,110 @@ constexpr AVPixelFormat UFFmpegUtils::FFmpegFrameFormatOf(
 	}
 }
 
+constexpr AVPixelFormat UFFmpegUtils::FFmpegFrameFormatOf(
+    EFFmpegEncodePixelFormat EncodePixelFormat) noexcept {
+	switch (EncodePixelFormat) {
+	case EFFmpegEncodePixelFormat::YUV420P:
+		return AV_PIX_FMT_YUV420P;
+	case EFFmpegEncodePixelFormat::YUV420P10:
+		return AV_PIX_FMT_YUV420P10LE;
+	case EFFmpegEncodePixelFormat::BGR0:
+		return AV_PIX_FMT_BGR0;
+	default:
+		return AV_PIX_FMT_NONE;
+	}
+}
+
+constexpr const char*
+    UFFmpegUtils::X264PresetNameOf(EFFmpegX264Preset Preset) noexcept {
+	switch (Preset) {
+	case EFFmpegX264Preset::Ultrafast:
+		return "ultrafast";
+	case EFFmpegX264Preset::Superfast:
+		return "superfast";
+	case EFFmpegX264Preset::Veryfast:
+		return "veryfast";
+	case EFFmpegX264Preset::Faster:
+		return "faster";
+	case EFFmpegX264Preset::Fast:
+		return "fast";
+	case EFFmpegX264Preset::Slow:
+		return "slow";
+	case EFFmpegX264Preset::Slower:
+		return "slower";
+	case EFFmpegX264Preset::Veryslow:
+		return "veryslow";
+	case EFFmpegX264Preset::Placebo:
+		return "placebo";
+	default:
+		return "medium";
+	}
+}
+
+constexpr const char*
+    UFFmpegUtils::X264TuneNameOf(EFFmpegX264Tune Tune) noexcept {
+	switch (Tune) {
+	case EFFmpegX264Tune::Film:
+		return "film";
+	case EFFmpegX264Tune::Animation:
+		return "animation";
+	case EFFmpegX264Tune::Grain:
+		return "grain";
+	case EFFmpegX264Tune::StillImage:
+		return "stillimage";
+	case EFFmpegX264Tune::FastDecode:
+		return "fastdecode";
+	case EFFmpegX264Tune::ZeroLatency:
+		return "zerolatency";
+	default:
+		return nullptr;
+	}
+}
+
+constexpr LowLevelTasks::ETaskPriority
+    UFFmpegUtils::TaskPriorityOf(EFFmpegEncoderPriority Priority) noexcept {
+	switch (Priority) {
+	case EFFmpegEncoderPriority::Low:
+		return LowLevelTasks::ETaskPriority::BackgroundLow;
+	case EFFmpegEncoderPriority::High:
+		return LowLevelTasks::ETaskPriority::BackgroundHigh;
+	default:
+		return LowLevelTasks::ETaskPriority::BackgroundNormal;
+	}
+}
+
+constexpr EThreadPriority
+    UFFmpegUtils::ThreadPriorityOf(EFFmpegEncoderPriority Priority) noexcept {
+	switch (Priority) {
+	case EFFmpegEncoderPriority::Low:
+		return TPri_BelowNormal;
+	case EFFmpegEncoderPriority::High:
+		return TPri_AboveNormal;
+	default:
+		return TPri_Normal;
+	}
+}
+
 template <ESPMode InMode>
 TFFmpegFrameSharedPtr<InMode>
     UFFmpegUtils::CreateFrame(const FString& ImagePath, const int FrameIndex,
                               std::optional<int> FrameWidth,
                               std::optional<int> FrameHeight,
-                              AVPixelFormat      PixelFormat) {
+                              AVPixelFormat      PixelFormat,
+                              const FFFmpegConversionOptions& Options) {
 	FImage Image;
 	FImageUtils::LoadImage(*ImagePath, Image);
-	return CreateFrame(Image, FrameIndex, FrameWidth, FrameHeight, PixelFormat);
+	return CreateFrame<InMode>(MoveTemp(Image), FrameIndex, FrameWidth,
+	                           FrameHeight, PixelFormat, Options);
 }
 
 template <ESPMode InMode>
 TFFmpegFrameSharedPtr<InMode> UFFmpegUtils::CreateFrame(
     const FImage& Image, const int FrameIndex, std::optional<int> FrameWidth,
-    std::optional<int> FrameHeight, AVPixelFormat PixelFormat) {
+    std::optional<int> FrameHeight, AVPixelFormat PixelFormat,
+    const FFFmpegConversionOptions& Options) {
 	TFFmpegFrameSharedPtr<InMode> FFmpegFrame;
 
-	const auto& SrcFormat = UFFmpegUtils::FFmpegFrameFormatOf(Image.Format);
 	const auto& SrcWidth  = Image.GetWidth();
 	const auto& SrcHeight = Image.GetHeight();
 
@@ -111,36 +385,139 @@ TFFmpegFrameSharedPtr<InMode> UFFmpegUtils::CreateFrame(
 	RawFrame->width  = FrameWidth.value_or(SrcWidth);
 	RawFrame->height = FrameHeight.value_or(SrcHeight);
 
-	// initialize frame buffer
-	if (av_frame_get_buffer(RawFrame, 0) < 0) {
+	// initialize frame buffer, from the pool if possible
+	if (const auto& FramePool = Options.FramePool;
+	    FramePool.IsValid() &&
+	    FramePool->Matches(PixelFormat, RawFrame->width, RawFrame->height)) {
+		if (!FramePool->GetBuffer(*RawFrame)) {
+			UE_LOG(LogTemp, Error, TEXT("Failed to get AVFrame buffer from pool"));
+			return FFmpegFrame;
+		}
+	} else if (av_frame_get_buffer(RawFrame, 0) < 0) {
+		UE_LOG(LogTemp, Error, TEXT("Failed to allocate AVFrame buffer"));
+		return FFmpegFrame;
+	}
+
+	// convert pixels of Image into the frame buffer
+	ConvertImageToFrame(Image, *RawFrame, Options);
+
+	return FFmpegFrame;
+}
+
+template <ESPMode InMode>
+TFFmpegFrameSharedPtr<InMode> UFFmpegUtils::CreateFrame(
+    FImage&& Image, const int FrameIndex, std::optional<int> FrameWidth,
+    std::optional<int> FrameHeight, AVPixelFormat PixelFormat,
+    const FFFmpegConversionOptions& Options) {
+	const auto& Width  = FrameWidth.value_or(Image.GetWidth());
+	const auto& Height = FrameHeight.value_or(Image.GetHeight());
+
+	// reference the pixels if no conversion is needed
+	if (CanWrapImage(Image, Width, Height, PixelFormat)) {
+		return WrapImage<InMode>(Image, MoveTemp(Image), FrameIndex, PixelFormat);
+	}
+
+	return CreateFrame<InMode>(static_cast<const FImage&>(Image), FrameIndex,
+	                           Width, Height, PixelFormat, Options);
+}
+
+template <ESPMode InMode>
+TFFmpegFrameSharedPtr<InMode> UFFmpegUtils::CreateFrame(
+    UE::Tasks::TTask<FImage> ImageTask, const int FrameIndex,
+    std::optional<int> FrameWidth, std::optional<int> FrameHeight,
+    AVPixelFormat PixelFormat, const FFFmpegConversionOptions& Options) {
+	// wait for the image
+	const auto& Image = ImageTask.GetResult();
+
+	const auto& Width  = FrameWidth.value_or(Image.GetWidth());
+	const auto& Height = FrameHeight.value_or(Image.GetHeight());
+
+	// reference the pixels if no conversion is needed. the result of the task
+	// lives as long as the task.
+	if (CanWrapImage(Image, Width, Height, PixelFormat)) {
+		return WrapImage<InMode>(Image, MoveTemp(ImageTask), FrameIndex,
+		                         PixelFormat);
+	}
+
+	return CreateFrame<InMode>(Image, FrameIndex, Width, Height, PixelFormat,
+	                           Options);
+}
+
+template <ESPMode InMode>
+TFFmpegFrameSharedPtr<InMode>
+    UFFmpegUtils::ScaleFrame(const AVFrame& Frame, const int FrameWidth,
+                             const int FrameHeight, AVPixelFormat PixelFormat,
+                             const FFFmpegConversionOptions& Options) {
+	// reference the buffers if no conversion is needed
+	if (Frame.width == FrameWidth && Frame.height == FrameHeight &&
+	    Frame.format == PixelFormat) {
+		return TFFmpegFrameSharedPtr<InMode>(av_frame_clone(&Frame));
+	}
+
+	TFFmpegFrameSharedPtr<InMode> FFmpegFrame;
+
+	const auto& RawFrame = FFmpegFrame.Get();
+
+	RawFrame->pts    = Frame.pts;
+	RawFrame->format = PixelFormat;
+	RawFrame->width  = FrameWidth;
+	RawFrame->height = FrameHeight;
+
+	// initialize frame buffer, from the pool if possible
+	if (const auto& FramePool = Options.FramePool;
+	    FramePool.IsValid() &&
+	    FramePool->Matches(PixelFormat, RawFrame->width, RawFrame->height)) {
+		if (!FramePool->GetBuffer(*RawFrame)) {
+			UE_LOG(LogTemp, Error, TEXT("Failed to get AVFrame buffer from pool"));
+			return FFmpegFrame;
+		}
+	} else if (av_frame_get_buffer(RawFrame, 0) < 0) {
 		UE_LOG(LogTemp, Error, TEXT("Failed to allocate AVFrame buffer"));
 		return FFmpegFrame;
 	}
 
-	SwsContext* SwsConvertFormatContext =
-	    sws_getContext(SrcWidth, SrcHeight, SrcFormat, SrcWidth, SrcHeight,
-	                   PixelFormat, SWS_BILINEAR, nullptr, nullptr, nullptr);
-	if (nullptr == SwsConvertFormatContext) {
-		UE_LOG(LogTemp, Error, TEXT("Failed to create SwsContext."));
+	// scale pixels of Frame into the frame buffer
+	ConvertFrameToFrame(Frame, *RawFrame, Options);
+
+	return FFmpegFrame;
+}
+
+template <ESPMode InMode, typename TOwner>
+TFFmpegFrameSharedPtr<InMode>
+    UFFmpegUtils::WrapImage(const FImage& Image, TOwner&& Owner,
+                            const int FrameIndex, AVPixelFormat PixelFormat) {
+	using FOwner = std::decay_t<TOwner>;
+
+	TFFmpegFrameSharedPtr<InMode> FFmpegFrame;
+
+	const auto& RawFrame = FFmpegFrame.Get();
+
+	RawFrame->pts    = FrameIndex;
+	RawFrame->format = PixelFormat;
+	RawFrame->width  = Image.GetWidth();
+	RawFrame->height = Image.GetHeight();
+
+	// Image may be Owner itself, so take its layout before moving Owner.
+	// moving an image keeps its allocation.
+	const auto& Data     = const_cast<uint8*>(Image.RawData.GetData());
+	const auto& DataSize = Image.RawData.Num();
+	const auto& LineSize = Image.GetWidth() * Image.GetBytesPerPixel();
+
+	// the buffer owns Owner and deletes it when the last reference is released
+	const auto& DeleteOwner = [](void* Opaque, uint8_t*) {
+		delete static_cast<FOwner*>(Opaque);
+	};
+	const auto& OwnerOnHeap = new FOwner(Forward<TOwner>(Owner));
+	RawFrame->buf[0]        = av_buffer_create(Data, DataSize, DeleteOwner,
+	                                           OwnerOnHeap, AV_BUFFER_FLAG_READONLY);
+	if (nullptr == RawFrame->buf[0]) {
+		delete OwnerOnHeap;
+		UE_LOG(LogTemp, Error, TEXT("Failed to wrap image into AVFrame buffer"));
 		return FFmpegFrame;
 	}
 
-	const auto&    RawImageData  = Image.RawData;
-	const auto&    BytesPerPixel = Image.GetBytesPerPixel();
-	const auto&    DestImageData = RawFrame->data[0];
-	const uint8_t* SrcData[8]    = {RawImageData.GetData(),
-	                                nullptr,
-	                                nullptr,
-	                                nullptr,
-	                                nullptr,
-	                                nullptr,
-	                                nullptr,
-	                                nullptr};
-	const int SrcLineSize[8] = {SrcWidth * BytesPerPixel, 0, 0, 0, 0, 0, 0, 0};
-	sws_scale(SwsConvertFormatContext, SrcData, SrcLineSize, 0, SrcHeight,
-	          RawFrame->data, RawFrame->linesize);
-
-	sws_freeContext(SwsConvertFormatContext);
+	RawFrame->data[0]     = RawFrame->buf[0]->data;
+	RawFrame->linesize[0] = LineSize;
 
 	return FFmpegFrame;
 }